@@ -0,0 +1,178 @@
+//
+//  FFEncoderBenchmark.cpp
+//  FFAudioMixing
+//
+//  Per-chunk cost of FFAudioBufferEncoder::appendData, the way FFRecorder feeds it: s16 chunks of 20 ms.
+//  A capture at the output rate takes the direct path, other rates go through the filter graph.
+//  Then every encoder preset is measured on mp3 and m4a at the output rate, see getEncoderPresetOptions.
+//  The encoded files are written into the directory given as the first argument.
+//
+
+#include "FFAudioBufferEncoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int CHUNK_MS = 20;
+    const int RUNS     = 3;
+
+    struct FFEncodeCase
+    {
+        const char* fileType;
+        int         bitRate;
+        int         outputSampleRate;
+        int         captureSampleRate;
+        int         channels;
+    };
+
+    const char* encoderPresets[] = { "default", "realtime", "export", "archival" };
+
+    const FFEncodeCase encodeCases[] =
+    {
+        { "mp3", 64000, 44100, 44100, 1 },
+        { "mp3", 64000, 44100, 48000, 1 },
+        { "mp3", 64000, 48000, 48000, 1 },
+        { "m4a", 64000, 44100, 44100, 1 },
+        { "m4a", 64000, 44100, 48000, 1 },
+        { "m4a", 64000, 48000, 48000, 1 },
+    };
+
+    struct FFEncodeResult
+    {
+        double chunkMicros;     // mean cost of one appendData
+        double maxChunkMicros;
+        double realtime;        // seconds of audio per second of encoding, with endInput
+    };
+
+    std::vector<int16_t> makeVoice(int sampleRate, int channels, double seconds)
+    {
+        // a tone with a slow tremolo and some noise, so that the encoder doesn't see digital silence
+        std::vector<int16_t> pcm((size_t)(seconds * sampleRate) * channels);
+        unsigned int seed = 1;
+        for (size_t i = 0; i < pcm.size() / channels; ++i)
+        {
+            double t = (double)i / sampleRate;
+            seed = seed * 1103515245 + 12345;
+            double noise = ((seed >> 16) & 0x7fff) / 32768.0 - 0.5;
+            double sample = 0.3 * sin(2 * M_PI * 220 * t) * (0.6 + 0.4 * sin(2 * M_PI * 3 * t)) + 0.02 * noise;
+            for (int c = 0; c < channels; ++c)
+                pcm[i * channels + c] = (int16_t)(sample * 32767);
+        }
+        return pcm;
+    }
+
+    int runEncoder(const FFEncodeCase& encodeCase, const std::string& codecOptions, const std::string& outputFile,
+                   const std::vector<int16_t>& pcm, FFEncodeResult& result)
+    {
+        FFAudioBufferEncoder encoder(outputFile.c_str(), encodeCase.fileType, encodeCase.bitRate,
+                                     FFOutputProfile(encodeCase.outputSampleRate, encodeCase.channels), codecOptions);
+
+        auto start = std::chrono::steady_clock::now();
+        int err = encoder.beginInput(encodeCase.captureSampleRate, AV_SAMPLE_FMT_S16, encodeCase.channels);
+        if (err < 0)
+            return err;
+
+        size_t chunkSamples = (size_t)encodeCase.captureSampleRate * CHUNK_MS / 1000 * encodeCase.channels;
+        double total = 0, longest = 0;
+        int chunks = 0;
+        for (size_t offset = 0; offset < pcm.size(); offset += chunkSamples)
+        {
+            size_t samples = std::min(chunkSamples, pcm.size() - offset);
+            auto chunkStart = std::chrono::steady_clock::now();
+            err = encoder.appendData((const uint8_t*)&pcm[offset], (int)(samples * sizeof(int16_t)));
+            if (err < 0)
+                return err;
+            double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - chunkStart).count();
+            total += elapsed;
+            longest = std::max(longest, elapsed);
+            ++chunks;
+        }
+
+        err = encoder.endInput();
+        if (err < 0)
+            return err;
+        double seconds = (double)pcm.size() / encodeCase.channels / encodeCase.captureSampleRate;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        result.chunkMicros    = total / std::max(chunks, 1);
+        result.maxChunkMicros = longest;
+        result.realtime       = seconds / std::max(elapsed, 1e-9);
+        return 0;
+    }
+
+    // the best of the runs
+    int measure(const FFEncodeCase& encodeCase, const std::string& codecOptions, const std::string& outputFile, double seconds, FFEncodeResult& result)
+    {
+        std::vector<int16_t> pcm = makeVoice(encodeCase.captureSampleRate, encodeCase.channels, seconds);
+        for (int run = 0; run < RUNS; ++run)
+        {
+            FFEncodeResult current;
+            int err = runEncoder(encodeCase, codecOptions, outputFile, pcm, current);
+            if (err < 0)
+                return err;
+            if (!run || current.chunkMicros < result.chunkMicros)
+                result = current;
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s output-directory [seconds of audio per case]\n", argv[0]);
+        return 1;
+    }
+    std::string directory = argv[1];
+    double seconds = (argc > 2) ? atof(argv[2]) : 60;
+
+    printf("%.0f s of s16 capture per case in %d ms chunks\n", seconds, CHUNK_MS);
+
+    for (const FFEncodeCase& encodeCase : encodeCases)
+    {
+        char name[64] = {0};
+        snprintf(name, sizeof(name), "/encoder-%d-%d.%s", encodeCase.captureSampleRate, encodeCase.outputSampleRate, encodeCase.fileType);
+        const char* path = (encodeCase.captureSampleRate == encodeCase.outputSampleRate) ? "direct" : "graph";
+
+        FFEncodeResult result;
+        int err = measure(encodeCase, std::string(), directory + name, seconds, result);
+        if (err < 0)
+            printf("%-4s %5d -> %5d %-6s  error %d\n", encodeCase.fileType, encodeCase.captureSampleRate, encodeCase.outputSampleRate, path, err);
+        else
+            printf("%-4s %5d -> %5d %-6s  %7.1f us/chunk (max %7.1f)  %6.1fx realtime\n", encodeCase.fileType,
+                   encodeCase.captureSampleRate, encodeCase.outputSampleRate, path, result.chunkMicros, result.maxChunkMicros, result.realtime);
+    }
+
+    for (const FFEncodeCase& encodeCase : encodeCases)
+    {
+        if (encodeCase.captureSampleRate != encodeCase.outputSampleRate || encodeCase.outputSampleRate != 44100)
+            continue;
+
+        for (const char* preset : encoderPresets)
+        {
+            std::string codecOptions;
+            FFAudioHelper::getEncoderPresetOptions(preset, encodeCase.fileType, codecOptions);
+
+            char name[64] = {0};
+            snprintf(name, sizeof(name), "/encoder-%s.%s", preset, encodeCase.fileType);
+
+            FFEncodeResult result;
+            int err = measure(encodeCase, codecOptions, directory + name, seconds, result);
+            if (err < 0)
+                printf("%-4s %-8s  error %d\n", encodeCase.fileType, preset, err);
+            else
+                printf("%-4s %-8s  %7.1f us/chunk (max %7.1f)  %6.1fx realtime  %s\n", encodeCase.fileType, preset,
+                       result.chunkMicros, result.maxChunkMicros, result.realtime, codecOptions.c_str());
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,293 @@
+//
+//  FFFixedPointBenchmark.cpp
+//  FFAudioMixing
+//
+//  The fixed point mix of the s16p profile against the float mix, see FFOutputProfile::isFixedPoint.
+//  Every case is rendered twice through the filters of the library, once with the fltp profile and once
+//  with the s16p profile: makeFade, makeGain and makeVolumeExpression per track, then amix (makeMix and the
+//  volume of the count, or the averaging amix of configFilterGraphForMixing) or makeMixFixed.
+//  The error is in LSB of the s16 output of the fixed path against the s16 output of the float path,
+//  every case fails above its tolerance. The host has an fpu, on armeabi the float path is emulated
+//  and the speedup is larger.
+//
+
+#include "FFAudioHelper.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace FFAudioHelper;
+
+namespace
+{
+    const int SAMPLE_RATE   = 44100;
+    const int FRAME_SAMPLES = 1152;     // a decoded mp3 frame, the volume expressions are evaluated once per frame
+    const int RUNS          = 3;
+
+    // ducks to a quarter and back every 4 s
+    const char* SWELL_EXPRESSION = "0.25+0.375*(1+cos(2*PI*t/4))";
+
+    std::vector<int16_t> makeVoice(double frequency, double level, int samples, unsigned int seed)
+    {
+        std::vector<int16_t> pcm(samples);
+        for (int i = 0; i < samples; ++i)
+        {
+            double t = (double)i / SAMPLE_RATE;
+            seed = seed * 1103515245 + 12345;
+            double noise = ((seed >> 16) & 0x7fff) / 32768.0 - 0.5;
+            double sample = level * (sin(2 * M_PI * frequency * t) * (0.6 + 0.4 * sin(2 * M_PI * 3 * t)) + 0.05 * noise);
+            pcm[i] = (int16_t)std::max(std::min(lrint(sample * 32767), 32767L), -32768L);
+        }
+        return pcm;
+    }
+
+    struct FFTrack
+    {
+        std::vector<int16_t> pcm;
+        double  gain;       // the gain of the piece, makeGain
+        int64_t fadeIn;     // samples, makeFade
+        bool    swell;      // the background swell, makeVolumeExpression
+    };
+
+    struct FFFixedPointCase
+    {
+        const char* name;
+        bool   average;        // the gains and the averaging amix of configFilterGraphForMixing, otherwise the timeline
+        int    tolerance;      // max error in LSB
+        std::vector<FFTrack> tracks;
+    };
+
+    /*
+     The graph of configFilterGraphForMixing with average, the gains are divided by the count like amix does,
+     or the graph of the timeline: fade in, piece gain and swell per track, then the tracks summed at unity.
+     */
+    int makeGraph(AVFilterGraph* graph, const FFFixedPointCase& c, const FFOutputProfile& profile, const AVCodecContext* outputCodec,
+                  std::vector<AVFilterContext*>& sources, AVFilterContext*& sink)
+    {
+        std::vector<AVFilterContext*> tracks;
+        std::vector<double> gains;
+        for (const FFTrack& t : c.tracks)
+        {
+            AVFilterContext* source = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffer"), NULL);
+            if (!source)
+                return AVERROR(ENOMEM);
+            int err = configInputFilter(source, AV_SAMPLE_FMT_S16, SAMPLE_RATE, 1);
+            if (err < 0)
+                return err;
+            sources.push_back(source);
+
+            AVFilterContext* track = NULL;
+            err = makeFormatForAMIX(graph, profile, source, track);
+            if (err >= 0 && c.average && t.gain != 1 && !profile.isFixedPoint())
+                err = makeVolume(graph, track, t.gain, track);
+            if (err >= 0 && !c.average && t.fadeIn)
+                err = makeFade(graph, profile, track, false, 0, t.fadeIn, track);
+            if (err >= 0 && !c.average && t.gain != 1)
+                err = makeGain(graph, profile, track, t.gain, track);
+            if (err >= 0 && !c.average && t.swell)
+                err = makeVolumeExpression(graph, profile, track, SWELL_EXPRESSION, track);
+            if (err < 0)
+                return err;
+
+            tracks.push_back(track);
+            gains.push_back(c.average ? t.gain / c.tracks.size() : 1.);
+        }
+
+        int err = 0;
+        AVFilterContext* mix = tracks.front();
+        if (tracks.size() > 1 && profile.isFixedPoint())
+            err = makeMixFixed(graph, profile, tracks, gains, mix);
+        else if (tracks.size() > 1)
+        {
+            err = makeMix(graph, tracks, mix);
+            if (err >= 0 && !c.average)
+                err = makeVolume(graph, mix, (double)tracks.size(), mix);
+        }
+        if (err >= 0)
+            err = makeFormatForOutput(graph, outputCodec, mix, mix);
+        if (err >= 0)
+            err = makeOutput(graph, outputCodec, mix, sink);
+        if (err >= 0)
+            err = avfilter_graph_config(graph, NULL);
+        return err;
+    }
+
+    int drainSink(AVFilterContext* sink, AVFrame* frame, std::vector<int16_t>& output)
+    {
+        while (true)
+        {
+            int err = av_buffersink_get_frame(sink, frame);
+            if ((AVERROR(EAGAIN) == err) || (AVERROR_EOF == err))
+                return 0;
+            if (err < 0)
+                return err;
+
+            const int16_t* samples = (const int16_t*)frame->data[0];
+            output.insert(output.end(), samples, samples + frame->nb_samples);
+            av_frame_unref(frame);
+        }
+    }
+
+    // the tracks are fed in frames like decoded inputs, the mix is read as it comes out
+    int render(const FFFixedPointCase& c, const FFOutputProfile& profile, std::vector<int16_t>& output)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            output.clear();
+
+            AVCodecContext* outputCodec = avcodec_alloc_context3(NULL);
+            pool.autoRelease([&outputCodec]
+                             {
+                                 avcodec_free_context(&outputCodec);
+                             });
+            ERROR_CHECKEX(outputCodec, err = AVERROR(ENOMEM));
+            outputCodec->sample_fmt     = AV_SAMPLE_FMT_S16;
+            outputCodec->sample_rate    = SAMPLE_RATE;
+            outputCodec->channels       = 1;
+            outputCodec->channel_layout = AV_CH_LAYOUT_MONO;
+
+            AVFilterGraph* graph = avfilter_graph_alloc();
+            pool.autoRelease([&graph]
+                             {
+                                 avfilter_graph_free(&graph);
+                             });
+            ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
+
+            std::vector<AVFilterContext*> sources;
+            AVFilterContext* sink = NULL;
+            err = makeGraph(graph, c, profile, outputCodec, sources, sink);
+            AV_ERROR_CHECK(err);
+
+            AVFrame* frame = av_frame_alloc();
+            pool.autoRelease([&frame]
+                             {
+                                 av_frame_free(&frame);
+                             });
+            ERROR_CHECKEX(frame, err = AVERROR(ENOMEM));
+
+            int samples = (int)c.tracks.front().pcm.size();
+            for (int offset = 0; offset < samples; offset += FRAME_SAMPLES)
+            {
+                for (size_t i = 0; i < sources.size(); ++i)
+                {
+                    frame->format         = AV_SAMPLE_FMT_S16;
+                    frame->sample_rate    = SAMPLE_RATE;
+                    frame->channel_layout = AV_CH_LAYOUT_MONO;
+                    frame->nb_samples     = std::min(FRAME_SAMPLES, samples - offset);
+                    frame->pts            = offset;
+                    err = av_frame_get_buffer(frame, 0);
+                    AV_ERROR_CHECK(err);
+                    memcpy(frame->data[0], &c.tracks[i].pcm[offset], frame->nb_samples * sizeof(int16_t));
+
+                    err = av_buffersrc_add_frame(sources[i], frame);
+                    AV_ERROR_CHECK(err);
+                }
+
+                err = drainSink(sink, frame, output);
+                AV_ERROR_CHECK(err);
+            }
+
+            for (AVFilterContext* source : sources)
+            {
+                err = av_buffersrc_add_frame(source, NULL);
+                AV_ERROR_CHECK(err);
+            }
+            err = drainSink(sink, frame, output);
+            AV_ERROR_CHECK(err);
+        }
+
+    Exit0:
+        return err;
+    }
+
+    // the best of the runs
+    int measure(const FFFixedPointCase& c, const FFOutputProfile& profile, std::vector<int16_t>& output, double& best)
+    {
+        for (int run = 0; run < RUNS; ++run)
+        {
+            auto start = std::chrono::steady_clock::now();
+            int err = render(c, profile, output);
+            if (err < 0)
+                return err;
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = (run == 0) ? elapsed : std::min(best, elapsed);
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 30;
+    if (seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [seconds of audio per case]\n", argv[0]);
+        return 1;
+    }
+    int samples = (int)(seconds * SAMPLE_RATE);
+
+    avfilter_register_all();
+
+    /*
+     The Q15 stages round the gain to 1/32768 and the sum to 1 LSB, the float path rounds once, so a gain or
+     a mix is within 2 LSB. The 8.8 volume rounds the gain to 1/512, 26 LSB at the 13400 peak of the background.
+     The fixed fade is stepped per frame, off by up to a step of its ramp: 1152 / 44100 of the 7900 peak over
+     the 1 s fade and 1152 / 22050 of the 4900 peak over the 0.5 s fade, 460 LSB where they meet.
+     */
+    std::vector<FFFixedPointCase> cases;
+    cases.push_back({ "gain 0.7",                   false, 2, { { makeVoice(220, 0.5, samples, 1), 0.7, 0, false } } });
+    cases.push_back({ "mix 2 averaged",             true,  2, { { makeVoice(220, 0.5, samples, 1), 1.0, 0, false },
+                                                                { makeVoice(330, 0.5, samples, 2), 0.6, 0, false } } });
+    cases.push_back({ "timeline 3 tracks faded",    false, 470, { { makeVoice(220, 0.3, samples, 1), 0.8, SAMPLE_RATE, false },
+                                                                  { makeVoice(330, 0.3, samples, 2), 1.0, 0, false },
+                                                                  { makeVoice(440, 0.3, samples, 3), 0.5, SAMPLE_RATE / 2, false } } });
+    cases.push_back({ "timeline swell background",  false, 28, { { makeVoice(220, 0.3, samples, 1), 1.0, 0, false },
+                                                                 { makeVoice(110, 0.5, samples, 2), 0.8, 0, true } } });
+
+    printf("%.0f s of mono s16 at %d Hz per case, %d sample frames\n", seconds, SAMPLE_RATE, FRAME_SAMPLES);
+
+    FFOutputProfile floatProfile(SAMPLE_RATE, 1, AV_SAMPLE_FMT_FLTP);
+    FFOutputProfile fixedProfile(SAMPLE_RATE, 1, AV_SAMPLE_FMT_S16P);
+
+    bool passed = true;
+    for (const FFFixedPointCase& c : cases)
+    {
+        std::vector<int16_t> floatOutput, fixedOutput;
+        double floatTime = 0, fixedTime = 0;
+        int err = measure(c, floatProfile, floatOutput, floatTime);
+        if (err >= 0)
+            err = measure(c, fixedProfile, fixedOutput, fixedTime);
+        if (err < 0 || floatOutput.size() != fixedOutput.size())
+        {
+            printf("%-26s  error %d, %d and %d samples\n", c.name, err, (int)floatOutput.size(), (int)fixedOutput.size());
+            passed = false;
+            continue;
+        }
+
+        int maxError = 0;
+        double signal = 0, noise = 0;
+        for (size_t i = 0; i < floatOutput.size(); ++i)
+        {
+            int error = fixedOutput[i] - floatOutput[i];
+            maxError = std::max(maxError, std::abs(error));
+            signal += (double)floatOutput[i] * floatOutput[i];
+            noise  += (double)error * error;
+        }
+        double snr = 10 * log10(signal / std::max(noise, 1e-30));
+        bool ok = (maxError <= c.tolerance);
+        passed = passed && ok;
+
+        printf("%-26s  max error %3d LSB (tolerance %3d)  SNR %6.1f dB  float %7.1fx  fixed %7.1fx realtime  speedup %4.2f  %s\n",
+               c.name, maxError, c.tolerance, snr, seconds / std::max(floatTime, 1e-9), seconds / std::max(fixedTime, 1e-9),
+               floatTime / std::max(fixedTime, 1e-9), ok ? "ok" : "FAILED");
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+//
+//  FFResampleBenchmark.cpp
+//  FFAudioMixing
+//
+//  Speed and quality of the resampling profiles for the common input rates, see FFResampleProfile,
+//  libswresample with the options of every profile against FFPolyphaseResampler with its taps.
+//  Every case converts stereo fltp in frames of 1024 samples to 44100 Hz, like the aformat filters do.
+//  The speed is the best of 3 runs in multiples of real time, the quality is the SNR of a resampled
+//  tone against the best fitting sine, the noise includes aliasing, imaging and ripple.
+//
+
+#include "FFPolyphaseResampler.hpp"
+
+#if defined(FF_BENCHMARK_SWR)
+extern "C"
+{
+#include <libswresample/swresample.h>
+#include <libavutil/opt.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+}
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int CHANNELS           = 2;
+    const int FRAME_SAMPLES      = 1024;
+    const int OUTPUT_SAMPLE_RATE = 44100;
+    const int RUNS               = 3;
+
+    const int inputSampleRates[] = { 48000, 16000 };
+
+    // the options of getResampleOptions and the taps of getResampleTaps in FFAudioMixing.cpp
+    struct FFNativeProfile
+    {
+        const char* name;
+        int taps;
+    };
+
+    const FFNativeProfile nativeProfiles[] =
+    {
+        { "fast",       16 },
+        { "balanced",   32 },
+    };
+
+#if defined(FF_BENCHMARK_SWR)
+    struct FFSwrProfile
+    {
+        const char* name;
+        const char* options;
+    };
+
+    const FFSwrProfile swrProfiles[] =
+    {
+        { "fast",               "filter_size=8:phase_shift=5:linear_interp=0:cutoff=0.9" },
+        { "balanced",           "filter_size=32:phase_shift=10:linear_interp=0" },
+        { "high quality",       "filter_size=64:phase_shift=12:linear_interp=1:cutoff=0.97" },
+        { "high quality soxr",  "resampler=soxr:precision=28" },
+    };
+#endif
+
+    class FFBenchResampler
+    {
+    public:
+        virtual ~FFBenchResampler() {}
+
+        // planar float, a NULL input flushes, returns the output samples written or < 0 on error
+        virtual int process(const float* const* input, int inputSamples, float* const* output, int outputCapacity) = 0;
+        virtual int getOutputCapacity(int inputSamples) const = 0;
+    };
+
+    class FFNativeResampler : public FFBenchResampler
+    {
+    private:
+        FFPolyphaseResampler _resampler;
+
+    public:
+        FFNativeResampler(int inputSampleRate, int taps)
+        : _resampler(inputSampleRate, OUTPUT_SAMPLE_RATE, CHANNELS, taps)
+        {
+
+        }
+
+        int process(const float* const* input, int inputSamples, float* const* output, int outputCapacity)
+        {
+            if (!input)
+                return _resampler.flush(output, outputCapacity);
+            return _resampler.process(input, inputSamples, output, outputCapacity);
+        }
+
+        int getOutputCapacity(int inputSamples) const
+        {
+            return _resampler.getOutputCapacity(inputSamples) + 256;
+        }
+    };
+
+#if defined(FF_BENCHMARK_SWR)
+    class FFSwrResampler : public FFBenchResampler
+    {
+    private:
+        SwrContext* _swr;
+        int _inputSampleRate;
+
+    public:
+        FFSwrResampler(int inputSampleRate, const char* options)
+        : _swr(NULL)
+        , _inputSampleRate(inputSampleRate)
+        {
+            int64_t layout = av_get_default_channel_layout(CHANNELS);
+            _swr = swr_alloc_set_opts(NULL, layout, AV_SAMPLE_FMT_FLTP, OUTPUT_SAMPLE_RATE,
+                                      layout, AV_SAMPLE_FMT_FLTP, inputSampleRate, 0, NULL);
+            if (_swr && (av_opt_set_from_string(_swr, options, NULL, "=", ":") < 0 || swr_init(_swr) < 0))
+                swr_free(&_swr);
+        }
+
+        ~FFSwrResampler()
+        {
+            swr_free(&_swr);
+        }
+
+        bool isValid() const
+        {
+            return (NULL != _swr);
+        }
+
+        int process(const float* const* input, int inputSamples, float* const* output, int outputCapacity)
+        {
+            return swr_convert(_swr, (uint8_t**)output, outputCapacity, (const uint8_t**)input, input ? inputSamples : 0);
+        }
+
+        int getOutputCapacity(int inputSamples) const
+        {
+            return (int)av_rescale_rnd(inputSamples, OUTPUT_SAMPLE_RATE, _inputSampleRate, AV_ROUND_UP) + 256;
+        }
+    };
+#endif
+
+    struct FFBenchResult
+    {
+        double realtime;    // seconds of audio per second of processing
+        double snr;         // dB
+    };
+
+    std::vector<float> makeTone(double frequency, int sampleRate, int64_t samples)
+    {
+        std::vector<float> tone(samples);
+        for (int64_t i = 0; i < samples; ++i)
+            tone[i] = (float)(0.5 * sin(2 * M_PI * frequency * i / sampleRate));
+        return tone;
+    }
+
+    // the sine of the frequency with the least squares amplitude and phase is the signal, the rest is noise
+    double measureSNR(const std::vector<float>& output, double frequency, int sampleRate)
+    {
+        // the edges carry the transients of the filter
+        size_t skip = sampleRate / 10;
+        if (output.size() <= 2 * skip)
+            return 0;
+
+        double a = 0, b = 0;
+        size_t count = output.size() - 2 * skip;
+        for (size_t i = skip; i < output.size() - skip; ++i)
+        {
+            double w = 2 * M_PI * frequency * i / sampleRate;
+            a += output[i] * sin(w);
+            b += output[i] * cos(w);
+        }
+        a *= 2. / count;
+        b *= 2. / count;
+
+        double signal = 0, noise = 0;
+        for (size_t i = skip; i < output.size() - skip; ++i)
+        {
+            double w = 2 * M_PI * frequency * i / sampleRate;
+            double fit = a * sin(w) + b * cos(w);
+            signal += fit * fit;
+            noise  += (output[i] - fit) * (output[i] - fit);
+        }
+        return 10 * log10(signal / std::max(noise, 1e-30));
+    }
+
+    // feeds the input in frames and collects the first channel of the output
+    int runResampler(FFBenchResampler& resampler, const std::vector<float>& input, std::vector<float>& output)
+    {
+        std::vector<std::vector<float>> outputBuffers(CHANNELS, std::vector<float>(resampler.getOutputCapacity(FRAME_SAMPLES)));
+        float* outputPlanes[CHANNELS];
+        for (int c = 0; c < CHANNELS; ++c)
+            outputPlanes[c] = &outputBuffers[c][0];
+
+        output.clear();
+
+        int capacity = (int)outputBuffers[0].size();
+        size_t offset = 0;
+        while (true)
+        {
+            int samples = (int)std::min<size_t>(FRAME_SAMPLES, input.size() - offset);
+            const float* inputPlanes[CHANNELS];
+            for (int c = 0; c < CHANNELS; ++c)
+                inputPlanes[c] = input.data() + offset;
+
+            // after the input is consumed, flush until the resampler has nothing left
+            int written = resampler.process(samples ? inputPlanes : NULL, samples, outputPlanes, capacity);
+            if (written < 0)
+                return written;
+            output.insert(output.end(), outputPlanes[0], outputPlanes[0] + written);
+
+            if (!samples && !written)
+                break;
+            offset += samples;
+        }
+        return 0;
+    }
+
+    template <typename F>
+    bool measure(F makeResampler, int inputSampleRate, double seconds, FFBenchResult& result)
+    {
+        double frequency = 1000;
+        std::vector<float> input = makeTone(frequency, inputSampleRate, (int64_t)(seconds * inputSampleRate));
+        std::vector<float> output;
+
+        double best = 0;
+        for (int run = 0; run < RUNS; ++run)
+        {
+            std::unique_ptr<FFBenchResampler> resampler(makeResampler());
+            if (!resampler)
+                return false;
+
+            auto start = std::chrono::steady_clock::now();
+            if (runResampler(*resampler, input, output) < 0)
+                return false;
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = (run == 0) ? elapsed : std::min(best, elapsed);
+        }
+
+        result.realtime = seconds / std::max(best, 1e-9);
+        result.snr      = measureSNR(output, frequency, OUTPUT_SAMPLE_RATE);
+        return true;
+    }
+
+    void printResult(const char* engine, const char* profile, int inputSampleRate, const FFBenchResult* result)
+    {
+        if (result)
+            printf("%-6s %-18s %5d -> %d  %8.1fx realtime  SNR %6.1f dB\n", engine, profile, inputSampleRate, OUTPUT_SAMPLE_RATE, result->realtime, result->snr);
+        else
+            printf("%-6s %-18s %5d -> %d  not available\n", engine, profile, inputSampleRate, OUTPUT_SAMPLE_RATE);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 60;
+    if (seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [seconds of audio per case]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%.0f s of stereo audio per case, %d sample frames\n", seconds, FRAME_SAMPLES);
+
+    for (int inputSampleRate : inputSampleRates)
+    {
+        for (const FFNativeProfile& profile : nativeProfiles)
+        {
+            FFBenchResult result;
+            bool available = measure([&]() -> FFBenchResampler*
+                                     {
+                                         return new FFNativeResampler(inputSampleRate, profile.taps);
+                                     }, inputSampleRate, seconds, result);
+            printResult("native", profile.name, inputSampleRate, available ? &result : NULL);
+        }
+
+#if defined(FF_BENCHMARK_SWR)
+        for (const FFSwrProfile& profile : swrProfiles)
+        {
+            FFBenchResult result;
+            bool available = measure([&]() -> FFBenchResampler*
+                                     {
+                                         FFSwrResampler* resampler = new FFSwrResampler(inputSampleRate, profile.options);
+                                         if (resampler->isValid())
+                                             return resampler;
+                                         delete resampler;
+                                         return NULL;
+                                     }, inputSampleRate, seconds, result);
+            printResult("swr", profile.name, inputSampleRate, available ? &result : NULL);
+        }
+#endif
+    }
+
+    return 0;
+}
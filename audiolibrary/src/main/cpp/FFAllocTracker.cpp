@@ -0,0 +1,156 @@
+//
+//  FFAllocTracker.cpp
+//  FFAudioMixing
+//
+//  Optional per-job allocation accounting.
+//
+
+#include "FFAllocTracker.hpp"
+
+#include <atomic>
+#include <mutex>
+
+namespace
+{
+    struct FFAllocCounters
+    {
+        std::mutex      lock;
+        FFAllocStats    stats;
+        int64_t         liveBytes;
+        int64_t         audioSamples;
+        int             sampleRate;
+    };
+
+    FFAllocCounters& counters()
+    {
+        static FFAllocCounters c;
+        return c;
+    }
+
+    // every job gets a new generation, only blocks allocated by the current generation are counted when freed
+    std::atomic<uint32_t> _generation(0);
+    std::atomic<bool>     _tracking(false);
+
+    void updatePeak(FFAllocCounters& c)
+    {
+        if (c.liveBytes > c.stats.peakLiveBytes)
+            c.stats.peakLiveBytes = c.liveBytes;
+    }
+}
+
+FFAllocStats::FFAllocStats()
+: allocCount(0)
+, allocBytes(0)
+, avAllocCount(0)
+, avAllocBytes(0)
+, peakLiveBytes(0)
+, audioSeconds(0)
+{
+
+}
+
+double FFAllocStats::allocsPerSecond() const
+{
+    if (audioSeconds <= 0)
+        return 0;
+    return (allocCount + avAllocCount) / audioSeconds;
+}
+
+namespace FFAllocTracker
+{
+    void begin()
+    {
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        c.stats        = FFAllocStats();
+        c.liveBytes    = 0;
+        c.audioSamples = 0;
+        c.sampleRate   = 0;
+
+        uint32_t generation = _generation.load() + 1;
+        if (!generation)
+            generation = 1;
+        _generation.store(generation);
+        _tracking.store(true);
+    }
+
+    void end(FFAllocStats& stats)
+    {
+        _tracking.store(false);
+
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        stats = c.stats;
+        stats.audioSeconds = c.sampleRate ? (double)c.audioSamples / c.sampleRate : 0;
+    }
+
+    bool isTracking()
+    {
+        return _tracking.load(std::memory_order_relaxed);
+    }
+
+    uint32_t trackAlloc(size_t size)
+    {
+        if (!isTracking())
+            return 0;
+
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        c.stats.allocCount += 1;
+        c.stats.allocBytes += size;
+        c.liveBytes        += size;
+        updatePeak(c);
+        return _generation.load(std::memory_order_relaxed);
+    }
+
+    void trackFree(size_t size, uint32_t tag)
+    {
+        if (!tag || !isTracking() || tag != _generation.load(std::memory_order_relaxed))
+            return;
+
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        c.liveBytes -= size;
+    }
+
+    void trackAVAlloc(size_t size)
+    {
+        if (!isTracking())
+            return;
+
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        c.stats.avAllocCount += 1;
+        c.stats.avAllocBytes += size;
+        c.liveBytes          += size;
+        updatePeak(c);
+    }
+
+    void trackAVFree(size_t size)
+    {
+        if (!isTracking())
+            return;
+
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        c.liveBytes -= size;
+    }
+
+    void trackAudioSamples(int64_t samples, int sampleRate)
+    {
+        if (!isTracking())
+            return;
+
+        FFAllocCounters& c = counters();
+        std::lock_guard<std::mutex> guard(c.lock);
+
+        c.audioSamples += samples;
+        c.sampleRate    = sampleRate;
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  FFAllocTracker.hpp
+//  FFAudioMixing
+//
+//  Optional per-job allocation accounting.
+//
+
+#ifndef FFAllocTracker_hpp
+#define FFAllocTracker_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct FFAllocStats
+{
+    int64_t allocCount;         // heap allocations counted at the library's own sites (release pools, buffer queues, cache)
+    int64_t allocBytes;
+    int64_t avAllocCount;       // av_malloc family allocations that could be intercepted (decoder frame buffers)
+    int64_t avAllocBytes;
+    int64_t peakLiveBytes;      // peak of the tracked live bytes (C++ heap + intercepted FFmpeg buffers)
+    double  audioSeconds;       // seconds of audio produced by the job
+
+    FFAllocStats();
+
+    double allocsPerSecond() const;
+};
+
+/*
+ Only one job can be tracked at a time, the counters are process wide.
+ Nothing replaces the allocator: the library counts its allocations where it makes them, a free is only
+ counted when its tag belongs to the tracked job. FFmpeg allocations are intercepted through AVCodecContext::get_buffer2, buffers allocated inside
+ libavfilter/libavformat can not be hooked with the prebuilt libraries and are not counted.
+ */
+namespace FFAllocTracker
+{
+    void begin();
+    void end(FFAllocStats& stats);
+    bool isTracking();
+
+    // returns the tag to pass to trackFree, 0 if no job is tracked
+    uint32_t trackAlloc(size_t size);
+    void trackFree(size_t size, uint32_t tag);
+    void trackAVAlloc(size_t size);
+    void trackAVFree(size_t size);
+    void trackAudioSamples(int64_t samples, int sampleRate);
+}
+
+#endif /* FFAllocTracker_hpp */
@@ -7,40 +7,161 @@
 //
 
 #include "FFAudioBufferEncoder.hpp"
+#include "FFAllocTracker.hpp"
+#include <algorithm>
 
 using namespace FFAudioHelper;
 
-FFAudioBufferEncoder::FFAudioBufferEncoder(const char* outputFile, const char* outputFileType, const int outputBitRate)
+namespace
+{
+    // native resampler taps of the background, the balanced resample profile of FFAudioMixing
+    const int BACKGROUND_RESAMPLE_TAPS = 32;
+}
+
+FFAudioBufferEncoder::FFAudioBufferEncoder(const char* outputFile, const char* outputFileType, const int outputBitRate, const FFOutputProfile& profile,
+                                           const std::string& codecOptions)
 : _outputFile(outputFile)
 , _outputFileType(outputFileType)
 , _outputBitrate(outputBitRate)
+, _profile(profile)
+, _codecOptions(codecOptions)
+, _inputSampleRate(profile.sampleRate)
+, _inputSampleFormat(AV_SAMPLE_FMT_S16)
+, _inputChannels(profile.channels)
+, _inputFrameBytes(0)
 , _framePts(0)
 , _packetPts(0)
+, _direct(false)
+, _converter(NULL)
+, _fifo(NULL)
+, _backgroundGain(1)
+, _backgroundLoop(false)
+, _voiceFramePts(0)
+, _voicePacketPts(0)
+, _levelSnapshot(NULL)
+, _peaksOfMix(false)
+{
+
+}
+
+void FFAudioBufferEncoder::setBackground(const std::string& file, double gain, bool loop)
+{
+    _backgroundFile = file;
+    _backgroundGain = gain;
+    _backgroundLoop = loop;
+}
+
+void FFAudioBufferEncoder::setVoiceOutput(const std::string& file)
+{
+    _voiceOutputFile = file;
+}
+
+void FFAudioBufferEncoder::setLevelSnapshot(FFLevelSnapshot* snapshot)
 {
+    _levelSnapshot = snapshot;
+}
 
+void FFAudioBufferEncoder::setPeaksOutput(const std::string& peaksFile)
+{
+    _peaksFile = peaksFile;
 }
 
 int FFAudioBufferEncoder::beginInput()
+{
+    return beginInput(_profile.sampleRate, AV_SAMPLE_FMT_S16, _profile.channels);
+}
+
+int FFAudioBufferEncoder::beginInput(int inputSampleRate, AVSampleFormat inputSampleFormat, int inputChannels)
 {
     int err = 0;
     {
+        ERROR_CHECKEX(!av_sample_fmt_is_planar(inputSampleFormat) && inputChannels > 0, err = AVERROR(EINVAL));
+        _inputSampleRate   = inputSampleRate;
+        _inputSampleFormat = inputSampleFormat;
+        _inputChannels     = inputChannels;
+        _inputFrameBytes   = av_get_bytes_per_sample(inputSampleFormat) * inputChannels;
+        
+        if (_levelSnapshot)
+        {
+            _levelSnapshot->publish(FFLevels());
+            _levelMeter = std::make_shared<FFLevelMeter>(_inputSampleRate, _inputChannels, *_levelSnapshot);
+        }
+        
         // open output file
-        err = openOutputFile(_outputFile, _outputContext.format, _outputContext.codec, _outputFileType, _outputBitrate);
-        if (_outputContext.format)
+        err = _openOutput(_outputFile, _outputContext);
+        AV_ERROR_CHECK(err);
+
+        // the output alone holds the background, its peaks are those of the mixed frames
+        _peaksOfMix = _backgroundFile.length() && !_voiceOutputFile.length();
+        if (_peaksFile.length())
         {
-            _pool.autoRelease([=] {
-                if (_outputContext.format->pb)
-                    avio_closep(&_outputContext.format->pb);
-                avformat_free_context(_outputContext.format);
-            });
+            if (_peaksOfMix)
+                _peakBuilder = std::make_shared<FFPeakBuilder>(_outputContext.codec->sample_rate, _outputContext.codec->channels);
+            else
+                _peakBuilder = std::make_shared<FFPeakBuilder>(_inputSampleRate, _inputChannels);
         }
-        if (_outputContext.codec)
+
+        if (_voiceOutputFile.length())
         {
-            _pool.autoRelease([=] {
-                avcodec_close(_outputContext.codec);
-            });
+            err = _openOutput(_voiceOutputFile, _voiceContext);
+            AV_ERROR_CHECK(err);
+        }
+
+        // open background file
+        if (_backgroundFile.length())
+        {
+            err = openInputFile(_backgroundFile, _backgroundContext, AV_SAMPLE_FMT_FLTP);
+            if (_backgroundContext.format)
+            {
+                _pool.autoRelease([=] {
+                    AVFormatContext* f = _backgroundContext.format;
+                    avformat_close_input(&f);
+                });
+            }
+            if (_backgroundContext.codec)
+            {
+                _pool.autoRelease([=] {
+                    AVCodecContext* c = _backgroundContext.codec;
+                    avcodec_free_context(&c);
+                });
+            }
+            AV_ERROR_CHECK(err);
+        }
+
+        // the capture format is the output format, only the sample format may have to be converted
+        _direct = !_backgroundContext.format && !_voiceContext.format &&
+                  (_inputSampleRate == _outputContext.codec->sample_rate) && (_inputChannels == _outputContext.codec->channels);
+        if (_direct)
+        {
+            _fifo = av_audio_fifo_alloc(_inputSampleFormat, _inputChannels, 4096);
+            ERROR_CHECKEX(_fifo, err = AVERROR(ENOMEM));
+            _pool.autoRelease([=]
+                              {
+                                  av_audio_fifo_free(_fifo);
+                              });
+            
+            if (_inputSampleFormat != _outputContext.codec->sample_fmt)
+            {
+                uint64_t layout = _outputContext.codec->channel_layout;
+                _converter = swr_alloc_set_opts(NULL,
+                                                layout, _outputContext.codec->sample_fmt, _inputSampleRate,
+                                                layout, _inputSampleFormat, _inputSampleRate,
+                                                0, NULL);
+                ERROR_CHECKEX(_converter, err = AVERROR(ENOMEM));
+                _pool.autoRelease([=]
+                                  {
+                                      SwrContext* c = _converter;
+                                      swr_free(&c);
+                                  });
+                
+                err = swr_init(_converter);
+                AV_ERROR_CHECK(err);
+            }
+            
+            err = avformat_write_header(_outputContext.format, NULL);
+            AV_ERROR_CHECK(err);
+            QUIT();
         }
-        AV_ERROR_CHECK(err);
 
         // init filter
         AVFilterGraph* graph = avfilter_graph_alloc();
@@ -53,13 +174,66 @@ int FFAudioBufferEncoder::beginInput()
 
         _inputContext.filter = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffer"), NULL);
         ERROR_CHECKEX(_inputContext.filter, err = AVERROR(ENOMEM));
-        err = configInputFilter(_inputContext.filter, AV_SAMPLE_FMT_S16, outputSampleRate, outputAudioChannelNum);
+        err = configInputFilter(_inputContext.filter, _inputSampleFormat, _inputSampleRate, _inputChannels);
         AV_ERROR_CHECK(err);
 
 //        err = makeLoudNorm(graph, _inputContext.filter, _inputContext.lastFilter);
 //        AV_ERROR_CHECK(err);
 
-        err = makeFormatForOutput(graph, _outputContext.codec, _inputContext.filter, _inputContext.lastFilter);
+        _inputContext.lastFilter = _inputContext.filter;
+
+        // the voice alone goes to its own sink
+        if (_voiceContext.format)
+        {
+            std::vector<AVFilterContext*> branches;
+            err = makeSplit(graph, _inputContext.lastFilter, 2, branches);
+            AV_ERROR_CHECK(err);
+            _inputContext.lastFilter = branches[0];
+
+            err = makeFormatForOutput(graph, _voiceContext.codec, branches[1], _voiceContext.lastFilter);
+            AV_ERROR_CHECK(err);
+            err = makeOutput(graph, _voiceContext.codec, _voiceContext.lastFilter, _voiceContext.filter);
+            AV_ERROR_CHECK(err);
+        }
+
+        // voice -> aformat -+
+        //                   +-> amix -> volume
+        // background -> aformat -> [apad] -> [volume] -+
+        if (_backgroundContext.format)
+        {
+            err = makeFormatForAMIX(graph, _profile, _inputContext.lastFilter, _inputContext.lastFilter);
+            AV_ERROR_CHECK(err);
+
+            err = makeInput(graph, _backgroundContext, _profile, BACKGROUND_RESAMPLE_TAPS);
+            AV_ERROR_CHECK(err);
+            err = makeFormatForAMIX(graph, _profile, _backgroundContext.filter, _backgroundContext.lastFilter);
+            AV_ERROR_CHECK(err);
+
+            // silence after the background, so that amix keeps its scale until the voice ends
+            if (!_backgroundLoop)
+            {
+                err = makePad(graph, _backgroundContext.lastFilter, -1, _backgroundContext.lastFilter);
+                AV_ERROR_CHECK(err);
+            }
+
+            if (_backgroundGain != 1)
+            {
+                err = makeVolume(graph, _backgroundContext.lastFilter, _backgroundGain, _backgroundContext.lastFilter);
+                AV_ERROR_CHECK(err);
+            }
+
+            std::vector<AVFilterContext*> inputs;
+            inputs.push_back(_inputContext.lastFilter);
+            inputs.push_back(_backgroundContext.lastFilter);
+            err = makeMix(graph, inputs, _inputContext.lastFilter, true);
+            AV_ERROR_CHECK(err);
+
+            // amix halves both inputs
+            err = makeVolume(graph, _inputContext.lastFilter, 2., _inputContext.lastFilter);
+            AV_ERROR_CHECK(err);
+        }
+
+        err = makeFormatForOutput(graph, _outputContext.codec, _inputContext.lastFilter, _inputContext.lastFilter);
         AV_ERROR_CHECK(err);
         err = makeOutput(graph, _outputContext.codec, _inputContext.lastFilter, _outputContext.filter);
         AV_ERROR_CHECK(err);
@@ -70,26 +244,42 @@ int FFAudioBufferEncoder::beginInput()
         // write output file header
         err = avformat_write_header(_outputContext.format, NULL);
         AV_ERROR_CHECK(err);
+
+        if (_voiceContext.format)
+        {
+            err = avformat_write_header(_voiceContext.format, NULL);
+            AV_ERROR_CHECK(err);
+        }
     }
 
 Exit0:
     return err;
 }
 
+// queued chunks are counted for a tracked job, they are freed by the queue
+static std::shared_ptr<XBuffer> makeQueueBuffer(size_t len)
+{
+    uint32_t tag = FFAllocTracker::trackAlloc(len);
+    return std::shared_ptr<XBuffer>(new XBuffer(len), [tag](XBuffer* buffer)
+                                    {
+                                        FFAllocTracker::trackFree(buffer->size(), tag);
+                                        delete buffer;
+                                    });
+}
+
 void FFAudioBufferEncoder::write_queue(const uint8_t* data, int len)
 {
-    XBuffer *buffer = new XBuffer();
-    buffer->resize(len);
+    std::shared_ptr<XBuffer> buffer = makeQueueBuffer(len);
 
     uint8_t *head = &buffer->front();
     memcpy(head, data, len);
 
-    queue.push_back(std::shared_ptr<XBuffer>(buffer));
+    queue.push_back(buffer);
 }
 
-XBuffer* FFAudioBufferEncoder::read_queue()
+std::shared_ptr<XBuffer> FFAudioBufferEncoder::read_queue()
 {
-    int per_size = 2 * 1024;
+    int per_size = 1024 * _inputFrameBytes;
     int exist_size = 0;
 
     std::deque<std::shared_ptr<XBuffer>>::iterator pos;
@@ -99,12 +289,11 @@ XBuffer* FFAudioBufferEncoder::read_queue()
     }
 
     if (exist_size < per_size)
-        return NULL;
+        return nullptr;
 
     int multi_size = exist_size - (exist_size % per_size);
 
-    XBuffer *buffer = new XBuffer();
-    buffer->resize(multi_size);
+    std::shared_ptr<XBuffer> buffer = makeQueueBuffer(multi_size);
 
     int copy_size = 0;
     while(copy_size < multi_size)
@@ -117,12 +306,11 @@ XBuffer* FFAudioBufferEncoder::read_queue()
 
             int left_size = q_buffer->size() - need_size;
 
-            XBuffer *newBuffer = new XBuffer();
-            newBuffer->resize(left_size);
+            std::shared_ptr<XBuffer> newBuffer = makeQueueBuffer(left_size);
             memcpy(&newBuffer->front(), &q_buffer->front() + need_size, newBuffer->size());
 
             queue.pop_front();
-            queue.push_front(std::shared_ptr<XBuffer>(newBuffer));
+            queue.push_front(newBuffer);
 
             copy_size = multi_size;
         }
@@ -140,10 +328,13 @@ XBuffer* FFAudioBufferEncoder::read_queue()
 
 int FFAudioBufferEncoder::appendData(const uint8_t* data, int len)
 {
+    if (_direct)
+        return _appendDirect(data, len);
+
     write_queue(data, len);
 
-    XBuffer* buffer = read_queue();
-    if (!buffer || buffer->size() <= 0)
+    std::shared_ptr<XBuffer> buffer = read_queue();
+    if (!buffer)
         return 0;
 
     int size = buffer->size();
@@ -151,6 +342,9 @@ int FFAudioBufferEncoder::appendData(const uint8_t* data, int len)
     int err = 0;
     {
         FFAutoReleasePool pool;
+        CHECK(size > 0);
+
+        _measure(&buffer->front(), size / _inputFrameBytes);
 
         // input frame
         AVFrame* frame = av_frame_alloc();
@@ -159,12 +353,11 @@ int FFAudioBufferEncoder::appendData(const uint8_t* data, int len)
                              av_frame_free(&frame);
                          });
 
-        frame->data[0]        = (uint8_t*)av_malloc(size);
-        frame->format         = AV_SAMPLE_FMT_S16;
-        frame->channels       = outputAudioChannelNum;
-        frame->channel_layout = av_get_default_channel_layout(outputAudioChannelNum);
-        frame->nb_samples     = size / (16 / 8 * outputAudioChannelNum);
-        frame->sample_rate    = outputSampleRate;
+        frame->format         = _inputSampleFormat;
+        frame->channels       = _inputChannels;
+        frame->channel_layout = av_get_default_channel_layout(_inputChannels);
+        frame->nb_samples     = size / _inputFrameBytes;
+        frame->sample_rate    = _inputSampleRate;
 
         err = avcodec_fill_audio_frame(frame, frame->channels, (enum AVSampleFormat)frame->format, &buffer->front(), size, true);
         AV_ERROR_CHECK(err);
@@ -173,72 +366,308 @@ int FFAudioBufferEncoder::appendData(const uint8_t* data, int len)
         AV_ERROR_CHECK(err);
 
         // output & encode frame
-        do
+        if (_voiceContext.filter)
+        {
+            err = _encodeFiltered(_voiceContext, _voiceFramePts, _voicePacketPts);
+            AV_ERROR_CHECK(err);
+        }
+
+        err = _encodeFiltered(_outputContext, _framePts, _packetPts);
+        AV_ERROR_CHECK(err);
+    }
+
+Exit0:
+    return err;
+}
+
+int FFAudioBufferEncoder::endInput()
+{
+    int err = 0;
+    {
+        if (_direct)
+        {
+            err = _encodeFifo(true);
+            AV_ERROR_CHECK(err);
+        }
+        else
+        {
+            err = av_buffersrc_add_frame(_inputContext.filter, NULL);
+            AV_ERROR_CHECK(err);
+
+            // output & encode frame
+            if (_voiceContext.filter)
+            {
+                err = _encodeFiltered(_voiceContext, _voiceFramePts, _voicePacketPts);
+                AV_ERROR_CHECK(err);
+            }
+
+            err = _encodeFiltered(_outputContext, _framePts, _packetPts);
+            AV_ERROR_CHECK(err);
+        }
+
+        err = encodeFlush(_outputContext.format, _outputContext.codec, _packetPts);
+        AV_ERROR_CHECK(err);
+
+        // write trailer
+        err = av_write_trailer(_outputContext.format);
+        AV_ERROR_CHECK(err);
+
+        if (_voiceContext.format)
+        {
+            err = encodeFlush(_voiceContext.format, _voiceContext.codec, _voicePacketPts);
+            AV_ERROR_CHECK(err);
+
+            err = av_write_trailer(_voiceContext.format);
+            AV_ERROR_CHECK(err);
+        }
+        
+        // after the trailer, the sidecar records the final size of the file
+        if (_peakBuilder)
+        {
+            FFWaveformPeaks peaks;
+            _peakBuilder->finish(peaks);
+            err = peaks.write(_peaksFile, _voiceContext.format ? _voiceOutputFile : _outputFile);
+            AV_ERROR_CHECK(err);
+        }
+
+        queue.clear();
+    }
+
+Exit0:
+    return err;
+}
+
+void FFAudioBufferEncoder::_measure(const uint8_t* data, int frames)
+{
+    if (_levelMeter)
+        _levelMeter->process(data, frames, _inputSampleFormat);
+    
+    if (_peakBuilder && !_peaksOfMix)
+    {
+        const uint8_t* planes[1] = { data };
+        _peakBuilder->process(planes, frames, _inputSampleFormat);
+    }
+}
+
+int FFAudioBufferEncoder::_appendDirect(const uint8_t* data, int len)
+{
+    int err = 0;
+    {
+        // complete the sample frame split by the previous call
+        if (!_partialFrame.empty())
+        {
+            int needed = std::min(_inputFrameBytes - (int)_partialFrame.size(), len);
+            _partialFrame.insert(_partialFrame.end(), data, data + needed);
+            data += needed;
+            len -= needed;
+            CHECK((int)_partialFrame.size() == _inputFrameBytes);
+
+            _measure(&_partialFrame.front(), 1);
+
+            void* planes[1] = { &_partialFrame.front() };
+            err = av_audio_fifo_write(_fifo, planes, 1);
+            AV_ERROR_CHECK(err);
+            _partialFrame.clear();
+        }
+
+        int samples = len / _inputFrameBytes;
+        if (samples > 0)
+        {
+            _measure(data, samples);
+
+            void* planes[1] = { (void*)data };
+            err = av_audio_fifo_write(_fifo, planes, samples);
+            AV_ERROR_CHECK(err);
+        }
+        _partialFrame.assign(data + samples * _inputFrameBytes, data + len);
+
+        err = _encodeFifo(false);
+        AV_ERROR_CHECK(err);
+    }
+
+Exit0:
+    return err;
+}
+
+int FFAudioBufferEncoder::_encodeFifo(bool flush)
+{
+    int err = 0;
+    {
+        AVCodecContext* codec = _outputContext.codec;
+        int frameSize = (codec->frame_size > 0) ? codec->frame_size : 1024;
+
+        // the last frame may be shorter, the encoder pads it
+        while ((av_audio_fifo_size(_fifo) >= frameSize) || (flush && av_audio_fifo_size(_fifo) > 0))
         {
             FFAutoReleasePool pool;
 
-            AVFrame* filteredFrame = av_frame_alloc();
-            pool.autoRelease([&filteredFrame]
+            AVFrame* frame = av_frame_alloc();
+            ERROR_CHECKEX(frame, err = AVERROR(ENOMEM));
+            pool.autoRelease([&frame]
                              {
-                                 av_frame_free(&filteredFrame);
+                                 av_frame_free(&frame);
                              });
 
-            err = av_buffersink_get_frame(_outputContext.filter, filteredFrame);
-            if (err >= 0)
+            frame->format         = codec->sample_fmt;
+            frame->channels       = codec->channels;
+            frame->channel_layout = codec->channel_layout;
+            frame->sample_rate    = codec->sample_rate;
+            frame->nb_samples     = std::min(frameSize, av_audio_fifo_size(_fifo));
+            err = av_frame_get_buffer(frame, 0);
+            AV_ERROR_CHECK(err);
+
+            if (_converter)
             {
-                filteredFrame->pts = _framePts;
-                _framePts += filteredFrame->nb_samples;
+                _convertBuffer.resize(frame->nb_samples * _inputFrameBytes);
+                void* planes[1] = { &_convertBuffer.front() };
+                err = av_audio_fifo_read(_fifo, planes, frame->nb_samples);
+                AV_ERROR_CHECK(err);
 
-                err = encodeOneFrame(_outputContext.format, _outputContext.codec, filteredFrame, _packetPts);
+                const uint8_t* input = &_convertBuffer.front();
+                err = swr_convert(_converter, frame->extended_data, frame->nb_samples, &input, frame->nb_samples);
+                AV_ERROR_CHECK(err);
+            }
+            else
+            {
+                err = av_audio_fifo_read(_fifo, (void**)frame->extended_data, frame->nb_samples);
                 AV_ERROR_CHECK(err);
             }
+
+            frame->pts = _framePts;
+            _framePts += frame->nb_samples;
+
+            err = encodeOneFrame(_outputContext.format, _outputContext.codec, frame, _packetPts);
+            AV_ERROR_CHECK(err);
         }
-        while (err >= 0);
-        err = 0;
     }
 
 Exit0:
     return err;
 }
 
-int FFAudioBufferEncoder::endInput()
+int FFAudioBufferEncoder::_openOutput(const std::string& file, AVProcessContext& context)
 {
     int err = 0;
     {
-        err = av_buffersrc_add_frame(_inputContext.filter, NULL);
+        err = openOutputFile(file, context.format, context.codec, _outputFileType, _outputBitrate, _profile, AV_CODEC_ID_NONE, _codecOptions);
+        
+        AVFormatContext* format = context.format;
+        AVCodecContext* codec = context.codec;
+        if (format)
+        {
+            _pool.autoRelease([=] {
+                if (format->pb)
+                    avio_closep(&format->pb);
+                avformat_free_context(format);
+            });
+        }
+        if (codec)
+        {
+            _pool.autoRelease([=] {
+                AVCodecContext* c = codec;
+                avcodec_free_context(&c);
+            });
+        }
         AV_ERROR_CHECK(err);
+    }
 
-        // output & encode frame
-        do
+Exit0:
+    return err;
+}
+
+int FFAudioBufferEncoder::_encodeFiltered(AVProcessContext& context, int64_t& framePts, int64_t& packetPts)
+{
+    int err = 0;
+    {
+        while (true)
         {
             FFAutoReleasePool pool;
 
             AVFrame* filteredFrame = av_frame_alloc();
+            ERROR_CHECKEX(filteredFrame, err = AVERROR(ENOMEM));
             pool.autoRelease([&filteredFrame]
                              {
                                  av_frame_free(&filteredFrame);
                              });
 
-            err = av_buffersink_get_frame(_outputContext.filter, filteredFrame);
-            if (err >= 0)
-            {
-                filteredFrame->pts = _framePts;
-                _framePts += filteredFrame->nb_samples;
+            err = av_buffersink_get_frame(context.filter, filteredFrame);
 
-                err = encodeOneFrame(_outputContext.format, _outputContext.codec, filteredFrame, _packetPts);
+            // the mix waits for the background, not for the voice
+            if ((AVERROR(EAGAIN) == err) && _backgroundContext.filter && av_buffersrc_get_nb_failed_requests(_backgroundContext.filter) > 0)
+            {
+                err = _feedBackground();
                 AV_ERROR_CHECK(err);
+                continue;
+            }
+
+            // needs more pcm, or the input ended
+            if ((AVERROR(EAGAIN) == err) || (AVERROR_EOF == err))
+            {
+                err = 0;
+                break;
             }
+            AV_ERROR_CHECK(err);
+
+            filteredFrame->pts = framePts;
+            framePts += filteredFrame->nb_samples;
+
+            if (_peakBuilder && _peaksOfMix && (&context == &_outputContext))
+                _peakBuilder->process(filteredFrame->extended_data, filteredFrame->nb_samples, (AVSampleFormat)filteredFrame->format);
+
+            err = encodeOneFrame(context.format, context.codec, filteredFrame, packetPts);
+            AV_ERROR_CHECK(err);
         }
-        while (err >= 0);
+    }
 
-        err = encodeFlush(_outputContext.format, _outputContext.codec, _packetPts);
-        AV_ERROR_CHECK(err);
+Exit0:
+    return err;
+}
 
-        // write trailer
-        err = av_write_trailer(_outputContext.format);
-        AV_ERROR_CHECK(err);
+int FFAudioBufferEncoder::_feedBackground()
+{
+    int err = 0;
+    {
+        bool rewound = false;
+        for (int i = 0; i < 8;)
+        {
+            FFAutoReleasePool pool;
 
-        queue.clear();
+            AVFrame* frame = av_frame_alloc();
+            ERROR_CHECKEX(frame, err = AVERROR(ENOMEM));
+            pool.autoRelease([&frame]
+                             {
+                                 av_frame_free(&frame);
+                             });
+
+            bool finished = false;
+            err = decodeRangeFrame(_backgroundContext, frame, finished);
+            AV_ERROR_CHECK(err);
+
+            if (!finished)
+            {
+                err = addInputFrame(_backgroundContext, frame);
+                AV_ERROR_CHECK(err);
+
+                rewound = false;
+                ++i;
+                continue;
+            }
+
+            // a background that has nothing after the rewind ends like one that doesn't loop
+            if (_backgroundLoop && !rewound)
+            {
+                err = rewindInput(_backgroundContext);
+                AV_ERROR_CHECK(err);
+
+                rewound = true;
+                continue;
+            }
+
+            // end input
+            err = addInputFrame(_backgroundContext, NULL);
+            AV_ERROR_CHECK(err);
+            break;
+        }
     }
 
 Exit0:
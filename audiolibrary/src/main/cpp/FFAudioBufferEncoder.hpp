@@ -11,6 +11,13 @@
 
 #include <string>
 #include "FFAudioHelper.hpp"
+#include "FFLevelMeter.hpp"
+#include "FFWaveformPeaks.hpp"
+
+extern "C" {
+#include <libavutil/audio_fifo.h>
+}
+
 typedef std::vector<uint8_t> XBuffer;
 typedef std::deque<std::shared_ptr<XBuffer>> XBufferQueue;
 
@@ -20,22 +27,86 @@ private:
     std::string _outputFile;
     std::string _outputFileType;
     int _outputBitrate;
+    FFOutputProfile _profile;               // format of the output
+    std::string _codecOptions;              // see FFAudioHelper::openOutputFile
+    int _inputSampleRate;                   // format of the appended pcm, interleaved
+    AVSampleFormat _inputSampleFormat;
+    int _inputChannels;
+    int _inputFrameBytes;
     FFAudioHelper::AVProcessContext _outputContext;
     FFAudioHelper::AVProcessContext _inputContext;
     int64_t _framePts;
     int64_t _packetPts;
     FFAutoReleasePool _pool;
     XBufferQueue queue;
+    
+    // direct path, the pcm goes to the encoder without a filter graph when it has the output rate and channels
+    bool _direct;
+    SwrContext* _converter;                 // sample format conversion for the encoder, NULL if it takes the input format
+    AVAudioFifo* _fifo;                     // input samples not encoded yet, in the input format
+    XBuffer _partialFrame;                  // bytes of a sample frame split between two appendData calls
+    XBuffer _convertBuffer;
+    
+    // background mixed into the output while the pcm is appended, see setBackground
+    std::string _backgroundFile;
+    double _backgroundGain;
+    bool _backgroundLoop;
+    FFAudioHelper::AVProcessContext _backgroundContext;
+    
+    // second output of the appended pcm without the background, see setVoiceOutput
+    std::string _voiceOutputFile;
+    FFAudioHelper::AVProcessContext _voiceContext;
+    int64_t _voiceFramePts;
+    int64_t _voicePacketPts;
+    
+    // meters the appended pcm when a snapshot is set, see setLevelSnapshot
+    FFLevelSnapshot* _levelSnapshot;
+    std::shared_ptr<FFLevelMeter> _levelMeter;
+    
+    // waveform peaks of the appended pcm, or of the mix, see setPeaksOutput
+    std::string _peaksFile;
+    std::shared_ptr<FFPeakBuilder> _peakBuilder;
+    bool _peaksOfMix;               // the peaks are built from the filtered output frames
 public:
-    FFAudioBufferEncoder(const char* outputFile, const char* outputFileType, const int outputBitRate);
+    FFAudioBufferEncoder(const char* outputFile, const char* outputFileType, const int outputBitRate, const FFOutputProfile& profile = FFOutputProfile(),
+                         const std::string& codecOptions = std::string());
+    
+    /*
+     Mixes the file at gain into the output, it's decoded as far as the appended pcm goes.
+     A looping background restarts when it ends, otherwise silence follows it. Call before beginInput.
+     */
+    void setBackground(const std::string& file, double gain, bool loop);
+    // also encodes the appended pcm alone into the file, with the type and the options of the output. Call before beginInput.
+    void setVoiceOutput(const std::string& file);
+    
+    // publishes the levels of the appended pcm into the snapshot, which must outlive the encoder. Call before beginInput.
+    void setLevelSnapshot(FFLevelSnapshot* snapshot);
+    /*
+     Writes the waveform peaks into the sidecar file when the input ends, of the appended pcm for the voice output
+     if there is one, otherwise of the output as encoded, with the background mixed in. Call before beginInput.
+     */
+    void setPeaksOutput(const std::string& peaksFile);
     
+    // the appended pcm is s16 with the rate and the channels of the profile
     int beginInput();
+    // the appended pcm is captured in this format, packed sample formats only
+    int beginInput(int inputSampleRate, AVSampleFormat inputSampleFormat, int inputChannels);
     int appendData(const uint8_t* data, int size);
     int endInput();
 
     void write_queue(const uint8_t *data, int len);
 
-    XBuffer *read_queue();
+    std::shared_ptr<XBuffer> read_queue();
+
+private:
+    // meters the appended frames and adds them to the peaks
+    void _measure(const uint8_t* data, int frames);
+    int _appendDirect(const uint8_t* data, int len);
+    int _encodeFifo(bool flush);
+    int _openOutput(const std::string& file, FFAudioHelper::AVProcessContext& context);
+    // encodes the frames the sink of the context has, the background is decoded when the mix waits for it
+    int _encodeFiltered(FFAudioHelper::AVProcessContext& context, int64_t& framePts, int64_t& packetPts);
+    int _feedBackground();
 };
 
 #endif /* FFAudioBufferEncoder_hpp */
@@ -7,11 +7,283 @@
 //
 
 #include "FFAudioHelper.hpp"
+#include "FFAllocTracker.hpp"
+#include "FFMemoMap.hpp"
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
 
 namespace
 {
     const char* ID3Magic = "ID3";
+    // SWR_CH_MAX of libswresample, the channels that a pan filter can take
+    const int PAN_MAX_CHANNELS = 32;
+    
+    void trackedBufferFree(void* opaque, uint8_t* data)
+    {
+        AVBufferRef* buffer = (AVBufferRef*)opaque;
+        FFAllocTracker::trackAVFree(buffer->size);
+        av_buffer_unref(&buffer);
+    }
+    
+    int trackBuffer(AVBufferRef*& buffer)
+    {
+        AVBufferRef* wrapper = av_buffer_create(buffer->data, buffer->size, trackedBufferFree, buffer, 0);
+        if (!wrapper)
+            return AVERROR(ENOMEM);
+        
+        FFAllocTracker::trackAVAlloc(buffer->size);
+        buffer = wrapper;
+        return 0;
+    }
+    
+    // wrap the decoder frame buffers, so that the allocation and the release of them can be accounted
+    int trackedGetBuffer2(AVCodecContext* codec, AVFrame* frame, int flags)
+    {
+        int err = avcodec_default_get_buffer2(codec, frame, flags);
+        for (int i = 0; err >= 0 && i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i)
+            err = trackBuffer(frame->buf[i]);
+        for (int i = 0; err >= 0 && i < frame->nb_extended_buf; ++i)
+            err = trackBuffer(frame->extended_buf[i]);
+        return err;
+    }
+    
+    bool isFloatFormat(AVSampleFormat sampleFormat)
+    {
+        AVSampleFormat packed = av_get_packed_sample_fmt(sampleFormat);
+        return (AV_SAMPLE_FMT_FLT == packed) || (AV_SAMPLE_FMT_DBL == packed);
+    }
+    
+    bool supportsSampleFormat(const AVCodec* codec, AVSampleFormat sampleFormat)
+    {
+        for (const AVSampleFormat* format = codec->sample_fmts; format && AV_SAMPLE_FMT_NONE != *format; ++format)
+        {
+            if (*format == sampleFormat)
+                return true;
+        }
+        return false;
+    }
+    
+    // a decoder of the same codec with integer output for an integer request, such as aac_fixed or mp3, the codec itself otherwise
+    AVCodec* findDecoderForFormat(AVCodec* codec, AVSampleFormat requestSampleFormat)
+    {
+        if (!codec || AV_SAMPLE_FMT_NONE == requestSampleFormat || isFloatFormat(requestSampleFormat) || !codec->sample_fmts || !isFloatFormat(codec->sample_fmts[0]))
+            return codec;
+        
+        for (AVCodec* other = av_codec_next(NULL); other; other = av_codec_next(other))
+        {
+            if (other->id != codec->id || !av_codec_is_decoder(other) || (other->capabilities & AV_CODEC_CAP_EXPERIMENTAL))
+                continue;
+            if (other->sample_fmts && !isFloatFormat(other->sample_fmts[0]))
+                return other;
+        }
+        return codec;
+    }
+    
+    // the probes of a file are memoized by its path, size and modification time, a file written again is probed again
+    struct FFProbeCache
+    {
+        std::mutex lock;
+        FFMemoMap<FFAudioHelper::FFStreamInfo> streams;
+        FFMemoMap<int64_t> durations;
+        
+        FFProbeCache()
+        : streams(1024)
+        , durations(1024)
+        {
+            
+        }
+    };
+    
+    FFProbeCache& probeCache()
+    {
+        static FFProbeCache cache;
+        return cache;
+    }
+    
+    std::string getProbeKey(const std::string& file, AVSampleFormat requestSampleFormat)
+    {
+        std::string path;
+        double startTime = 0, endTime = -1;
+        FFAudioHelper::parseClip(file, path, startTime, endTime);
+        
+        struct stat info = {0};
+        if (stat(path.c_str(), &info))
+            return std::string();
+        
+        std::ostringstream key;
+        const char* formatName = av_get_sample_fmt_name(requestSampleFormat);
+        key << file << ':' << (long long)info.st_size << ':' << (long long)info.st_mtime << ':' << (formatName ? formatName : "none");
+        return key.str();
+    }
+    
+    std::string getLayoutName(int channels)
+    {
+        char name[64] = {0};
+        av_get_channel_layout_string(name, sizeof(name), channels, av_get_default_channel_layout(channels));
+        return name;
+    }
+    
+    bool filterIs(const AVFilterContext* filter, const char* name)
+    {
+        return (0 == strcmp(filter->filter->name, name));
+    }
+    
+    bool getFilterOption(AVFilterContext* filter, const char* name, std::string& value)
+    {
+        uint8_t* str = NULL;
+        if (av_opt_get(filter, name, AV_OPT_SEARCH_CHILDREN, &str) < 0 || !str)
+            return false;
+        
+        value = (const char*)str;
+        av_free(str);
+        
+        // a list of formats, can not know which one will be chosen
+        return (value.find('|') == std::string::npos);
+    }
+    
+    /*
+     Get the output format of a filter before the graph is configured, it's known for the sources and the formats,
+     and for the filters which keep the format of their inputs. Returns false if the format can not be known.
+     */
+    bool getKnownOutputFormat(AVFilterContext* filter, AVSampleFormat& sampleFormat, int& sampleRate, uint64_t& channelLayout)
+    {
+        std::string fmt, rate, layout;
+        if (filterIs(filter, "abuffer"))
+        {
+            if (!getFilterOption(filter, "sample_fmt", fmt) || !getFilterOption(filter, "sample_rate", rate) || !getFilterOption(filter, "channel_layout", layout))
+                return false;
+        }
+        else if (filterIs(filter, "aformat"))
+        {
+            if (!getFilterOption(filter, "sample_fmts", fmt) || !getFilterOption(filter, "sample_rates", rate) || !getFilterOption(filter, "channel_layouts", layout))
+                return false;
+        }
+        else
+        {
+            if (!filter->nb_inputs)
+                return false;
+            
+            for (unsigned i = 0; i < filter->nb_inputs; ++i)
+            {
+                AVSampleFormat inputFormat = AV_SAMPLE_FMT_NONE;
+                int inputRate = 0;
+                uint64_t inputLayout = 0;
+                if (!filter->inputs[i] || !getKnownOutputFormat(filter->inputs[i]->src, inputFormat, inputRate, inputLayout))
+                    return false;
+                
+                if (i && ((inputFormat != sampleFormat) || (inputRate != sampleRate) || (inputLayout != channelLayout)))
+                    return false;
+                
+                sampleFormat  = inputFormat;
+                sampleRate    = inputRate;
+                channelLayout = inputLayout;
+            }
+            
+            // filters which pass any format through
+            if (filterIs(filter, "anull") || filterIs(filter, "apad") || filterIs(filter, "atrim") || filterIs(filter, "asplit") || filterIs(filter, "concat"))
+                return true;
+            
+            if (filterIs(filter, "afade"))
+                return (sampleFormat != AV_SAMPLE_FMT_U8) && (sampleFormat != AV_SAMPLE_FMT_U8P);
+            
+            if (filterIs(filter, "adelay"))
+                return av_sample_fmt_is_planar(sampleFormat);
+            
+            if (filterIs(filter, "volume") || filterIs(filter, "amix"))
+                return (sampleFormat == AV_SAMPLE_FMT_FLT) || (sampleFormat == AV_SAMPLE_FMT_FLTP);
+            
+            return false;
+        }
+        
+        sampleFormat  = av_get_sample_fmt(fmt.c_str());
+        sampleRate    = atoi(rate.c_str());
+        channelLayout = av_get_channel_layout(layout.c_str());
+        return (sampleFormat != AV_SAMPLE_FMT_NONE) && sampleRate && channelLayout;
+    }
+    
+    bool isConversionNeeded(AVFilterContext* input, AVSampleFormat sampleFormat, int sampleRate, uint64_t channelLayout)
+    {
+        AVSampleFormat inputFormat = AV_SAMPLE_FMT_NONE;
+        int inputRate = 0;
+        uint64_t inputLayout = 0;
+        if (!getKnownOutputFormat(input, inputFormat, inputRate, inputLayout))
+            return true;
+        
+        return (inputFormat != sampleFormat) || (inputRate != sampleRate) || (inputLayout != channelLayout);
+    }
+    
+    void addRemovedConversion(int* removedConversions)
+    {
+        if (removedConversions)
+            ++*removedConversions;
+    }
+    
+    struct FFEncoderPreset
+    {
+        const char* name;
+        AVCodecID   codecID;
+        const char* options;
+    };
+    
+    /*
+     The options of every preset for the encoder they are meant for, all of them must be taken by it:
+     compression_level is the lame quality (0 slowest and best, 9 fastest) and cutoff its lowpass,
+     aac_coder the quantizer search of the native aac encoder, twoloop is its slowest and its default.
+     */
+    const FFEncoderPreset encoderPresets[] =
+    {
+        { "default",  AV_CODEC_ID_NONE, "" },
+        // voice while recording, lower cutoff and fast quantizers
+        { "realtime", AV_CODEC_ID_MP3,  "compression_level=7:cutoff=15000" },
+        { "realtime", AV_CODEC_ID_AAC,  "aac_coder=fast" },
+        { "export",   AV_CODEC_ID_MP3,  "compression_level=3" },
+        { "export",   AV_CODEC_ID_AAC,  "aac_coder=twoloop" },
+        { "archival", AV_CODEC_ID_MP3,  "compression_level=0:cutoff=20000" },
+        { "archival", AV_CODEC_ID_AAC,  "aac_coder=twoloop" },
+    };
+    
+    // frame or slice threads when the codec has them, most audio codecs run on the calling thread only
+    void configThreads(AVCodecContext* codecContext, const AVCodec* codec)
+    {
+        codecContext->thread_type = 0;
+        if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+            codecContext->thread_type |= FF_THREAD_FRAME;
+        if (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+            codecContext->thread_type |= FF_THREAD_SLICE;
+        
+        // 0 is a thread per core
+        codecContext->thread_count = codecContext->thread_type ? 0 : 1;
+    }
+    
+    // samples the decoder needs before a sample to output it exactly
+    int64_t getDecoderPreroll(const AVCodecContext* codec)
+    {
+        switch (codec->codec_id)
+        {
+            // bit reservoir, the main data of a frame may start in the previous one
+            case AV_CODEC_ID_MP3:
+                return 2 * 1152;
+            // overlapped transform of the previous frame
+            case AV_CODEC_ID_AAC:
+                return 2048;
+            default:
+                break;
+        }
+        
+        if (av_get_exact_bits_per_sample(codec->codec_id) > 0)
+            return 0;
+        
+        return codec->sample_rate / 10;
+    }
 }
 
 namespace FFAudioHelper
@@ -23,6 +295,12 @@ namespace FFAudioHelper
     , streamIndex(0)
     , lastFilter(0)
     , currentPTS(0)
+    , startSample(0)
+    , endSample(-1)
+    , inputPosition(0)
+    , seekTarget(0)
+    , resampledPTS(0)
+    , feedStart(-1)
     {
         
     }
@@ -34,43 +312,84 @@ namespace FFAudioHelper
     , streamIndex(streamIndex_)
     , lastFilter(NULL)
     , currentPTS(0)
+    , startSample(0)
+    , endSample(-1)
+    , inputPosition(0)
+    , seekTarget(0)
+    , resampledPTS(0)
+    , feedStart(-1)
     {
         
     }
     
-    int getFileDuration(const std::string& file, int64_t& duration)
+    FFStreamInfo::FFStreamInfo()
+    : sampleFormat(AV_SAMPLE_FMT_NONE)
+    , sampleRate(0)
+    , channels(0)
+    , channelLayout(0)
+    {
+        
+    }
+    
+    FFStreamInfo::FFStreamInfo(const AVCodecContext* codec)
+    : sampleFormat(codec->sample_fmt)
+    , sampleRate(codec->sample_rate)
+    , channels(codec->channels)
+    , channelLayout(codec->channel_layout)
+    {
+        
+    }
+    
+    bool FFStreamInfo::operator==(const FFStreamInfo& other) const
+    {
+        return (sampleFormat == other.sampleFormat) && (sampleRate == other.sampleRate)
+            && (channels == other.channels) && (channelLayout == other.channelLayout);
+    }
+    
+    FFFeedBudget::FFFeedBudget()
+    : maxFramesPerInput(128)
+    , maxQueuedSamples(0)
+    , sampleRate(0)
+    , frameBytes(0)
+    , sinkPosition(0)
+    , peakQueuedBytes(0)
+    {
+        
+    }
+    
+    static int probeStream(const std::string& file, const FFOutputProfile& profile, FFStreamInfo& stream, int64_t& duration, int64_t maxDuration)
     {
         int err = 0;
         {
             FFAutoReleasePool pool;
             
             // open file
-            AVFormatContext* format = NULL;
-            pool.autoRelease([&format]
-                             {
-                                 if (format)
-                                     avformat_close_input(&format);
-                             });
-            
-            AVCodecContext* codec = NULL;
-            pool.autoRelease([&codec]
+            AVProcessContext context;
+            pool.autoRelease([&context]
                              {
-                                 if (codec)
-                                 {
-                                     avcodec_close(codec);
-                                     codec = NULL;
-                                 }
+                                 closeInput(context);
                              });
             
-            int streamIndex = 0;
-            err = openInputFile(file, format, codec, streamIndex);
+            err = openInputFile(file, context, profile.sampleFormat);
             AV_ERROR_CHECK(err);
             
-            // quick method
-            AVStream* stream = format->streams[streamIndex];
-            if ((codec->sample_rate == outputSampleRate) && codec->frame_size && stream->nb_frames)
+            AVCodecContext* codec = context.codec;
+            stream = FFStreamInfo(codec);
+            
+            // quick method, the stream duration is in the stream time base, the clip in samples of the input rate,
+            // both are converted to samples of the profile rate for any input rate
+            AVStream* avStream = context.format->streams[context.streamIndex];
+            if (avStream->nb_frames && (AV_NOPTS_VALUE != avStream->duration))
             {
-                duration = stream->duration;
+                AVRational sampleTimeBase = {1, codec->sample_rate};
+                AVRational profileTimeBase = {1, profile.sampleRate};
+                int64_t inputDuration = av_rescale_q(avStream->duration, avStream->time_base, sampleTimeBase);
+                if (context.endSample >= 0)
+                    inputDuration = std::min(inputDuration, context.endSample);
+                inputDuration = std::max<int64_t>(inputDuration - context.startSample, 0);
+                duration = av_rescale_q(inputDuration, sampleTimeBase, profileTimeBase);
+                if (maxDuration >= 0)
+                    duration = std::min(duration, maxDuration);
                 QUIT();
             }
             
@@ -92,21 +411,13 @@ namespace FFAudioHelper
             AV_ERROR_CHECK(err);
             
             // input format
-            AVFilterContext* aFormat = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("aformat"), "format1");
-            ERROR_CHECKEX(aFormat, err = AVERROR(ENOMEM));
-            err = configFormatFilterForAmix(aFormat);
+            AVFilterContext* aFormat = NULL;
+            err = makeFormatForAMIX(graph, profile, inputFilter, aFormat);
             AV_ERROR_CHECK(err);
             
             // output sink
-            AVFilterContext* outputFilter = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffersink"), "output");
-            ERROR_CHECKEX(outputFilter, err = AVERROR(ENOMEM));
-            err = avfilter_init_str(outputFilter, NULL);
-            AV_ERROR_CHECK(err);
-            
-            //
-            err = avfilter_link(inputFilter, 0, aFormat, 0);
-            AV_ERROR_CHECK(err);
-            err = avfilter_link(aFormat, 0, outputFilter, 0);
+            AVFilterContext* outputFilter = NULL;
+            err = makeOutput(graph, NULL, aFormat, outputFilter);
             AV_ERROR_CHECK(err);
             
             err = avfilter_graph_config(graph, NULL);
@@ -137,6 +448,14 @@ namespace FFAudioHelper
                 }
                 while (err >= 0);
                 
+                // the caller doesn't care about the rest
+                if ((maxDuration >= 0) && (framePts >= maxDuration))
+                {
+                    err = 0;
+                    duration = maxDuration;
+                    break;
+                }
+                
                 // need more input
                 if (AVERROR(EAGAIN) == err)
                 {
@@ -153,8 +472,7 @@ namespace FFAudioHelper
                                              av_frame_free(&inputFrame);
                                          });
                         
-                        int64_t pts = 0;
-                        err = decodeOneFrame(format, codec, streamIndex, inputFrame, pts, finished);
+                        err = decodeRangeFrame(context, inputFrame, finished);
                         AV_ERROR_CHECK(err);
                         
                         if (!finished)
@@ -187,6 +505,130 @@ namespace FFAudioHelper
         return err;
     }
     
+    int getFileDuration(const std::string& file, const FFOutputProfile& profile, int64_t& duration, int64_t maxDuration)
+    {
+        FFStreamInfo stream;
+        return probeFile(file, profile, stream, duration, maxDuration);
+    }
+    
+    int probeFile(const std::string& file, const FFOutputProfile& profile, FFStreamInfo& stream, int64_t& duration, int64_t maxDuration)
+    {
+        int err = 0;
+        {
+            FFProbeCache& cache = probeCache();
+            std::string key = getProbeKey(file, profile.sampleFormat);
+            std::ostringstream durationKey;
+            durationKey << key << ':' << profile.sampleRate << ':' << maxDuration;
+            if (key.length())
+            {
+                std::lock_guard<std::mutex> guard(cache.lock);
+                FFStreamInfo cachedStream;
+                int64_t cachedDuration = 0;
+                if (cache.streams.find(key, cachedStream) && cache.durations.find(durationKey.str(), cachedDuration))
+                {
+                    stream = cachedStream;
+                    duration = cachedDuration;
+                    QUIT();
+                }
+            }
+            
+            err = probeStream(file, profile, stream, duration, maxDuration);
+            AV_ERROR_CHECK(err);
+            
+            if (key.length())
+            {
+                std::lock_guard<std::mutex> guard(cache.lock);
+                cache.streams.insert(key, stream);
+                cache.durations.insert(durationKey.str(), duration);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int getStreamInfo(const std::string& file, AVSampleFormat requestSampleFormat, FFStreamInfo& stream)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            
+            FFProbeCache& cache = probeCache();
+            std::string key = getProbeKey(file, requestSampleFormat);
+            if (key.length())
+            {
+                std::lock_guard<std::mutex> guard(cache.lock);
+                if (cache.streams.find(key, stream))
+                    QUIT();
+            }
+            
+            // the decoder tells the format when it's opened, nothing is decoded
+            AVProcessContext context;
+            pool.autoRelease([&context]
+                             {
+                                 closeInput(context);
+                             });
+            
+            err = openInputFile(file, context.format, context.codec, context.streamIndex, requestSampleFormat);
+            AV_ERROR_CHECK(err);
+            stream = FFStreamInfo(context.codec);
+            
+            if (key.length())
+            {
+                std::lock_guard<std::mutex> guard(cache.lock);
+                cache.streams.insert(key, stream);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    void runParallel(size_t count, const std::function<void(size_t)>& task)
+    {
+        // a few workers take the next index until none is left, the calling thread is one of them
+        size_t workers = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), MAX_PARALLEL_TASKS);
+        workers = std::min(workers, count);
+        
+        std::atomic<size_t> next(0);
+        auto work = [&next, count, &task]
+        {
+            for (size_t i = next++; i < count; i = next++)
+                task(i);
+        };
+        
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < workers; ++i)
+            threads.push_back(std::thread(work));
+        work();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+    
+    int getFileDurations(const std::vector<std::string>& files, const FFOutputProfile& profile, std::vector<int64_t>& durations)
+    {
+        int err = 0;
+        {
+            durations.assign(files.size(), 0);
+            std::vector<int> errors(files.size(), 0);
+            
+            // every probe opens and decodes its own file, so they run in parallel
+            runParallel(files.size(), [&files, &profile, &durations, &errors](size_t i)
+                        {
+                            errors[i] = getFileDuration(files[i], profile, durations[i]);
+                        });
+            
+            for (int probeErr : errors)
+            {
+                err = probeErr;
+                AV_ERROR_CHECK(err);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
     std::string getErrorText(int err)
     {
         std::vector<char> buffer;
@@ -196,11 +638,49 @@ namespace FFAudioHelper
         return msg;
     }
     
-    int openInputFile(const std::string& inputFile, AVFormatContext*& formatContext, AVCodecContext*& codecContext, int& streamIndex)
+    bool parseClip(const std::string& file, std::string& path, double& startTime, double& endTime)
+    {
+        path = file;
+        startTime = 0;
+        endTime = -1;
+        
+        size_t fragment = file.rfind(CLIP_FRAGMENT);
+        if (std::string::npos == fragment)
+            return false;
+        
+        // "#t=start", "#t=start,end" or "#t=,end"
+        std::string range = file.substr(fragment + strlen(CLIP_FRAGMENT));
+        size_t comma = range.find(',');
+        std::string start = range.substr(0, comma);
+        std::string end = (std::string::npos == comma) ? std::string() : range.substr(comma + 1);
+        
+        char* last = NULL;
+        if (!start.empty())
+        {
+            startTime = strtod(start.c_str(), &last);
+            if (*last || startTime < 0)
+                return false;
+        }
+        if (!end.empty())
+        {
+            endTime = strtod(end.c_str(), &last);
+            if (*last || endTime < startTime)
+                return false;
+        }
+        
+        path = file.substr(0, fragment);
+        return true;
+    }
+    
+    int openInputFile(const std::string& inputFile, AVFormatContext*& formatContext, AVCodecContext*& codecContext, int& streamIndex, AVSampleFormat requestSampleFormat)
     {
         int err = 0;
         {
-            err = avformat_open_input(&formatContext, inputFile.c_str(), NULL, NULL);
+            std::string path;
+            double startTime = 0, endTime = -1;
+            parseClip(inputFile, path, startTime, endTime);
+            
+            err = avformat_open_input(&formatContext, path.c_str(), NULL, NULL);
             AV_ERROR_CHECK(err);
             
             err = avformat_find_stream_info(formatContext, NULL);
@@ -209,11 +689,27 @@ namespace FFAudioHelper
             AVCodec* codec = NULL;
             streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
             ERROR_CHECK(streamIndex >= 0);
+            codec = findDecoderForFormat(codec, requestSampleFormat);
+            
+            AVStream* stream = formatContext->streams[streamIndex];
+            codecContext = avcodec_alloc_context3(codec);
+            ERROR_CHECKEX(codecContext, err = AVERROR(ENOMEM));
+            
+            err = avcodec_parameters_to_context(codecContext, stream->codecpar);
+            AV_ERROR_CHECK(err);
+            codecContext->pkt_timebase = stream->time_base;
+            
+            // ask the decoder for the format wanted by the downstream filters, it saves a conversion if the decoder supports it
+            codecContext->request_sample_fmt = requestSampleFormat;
+            
+            if (FFAllocTracker::isTracking())
+                codecContext->get_buffer2 = trackedGetBuffer2;
+            
+            configThreads(codecContext, codec);
             
-            err = avcodec_open2(formatContext->streams[streamIndex]->codec, codec, NULL);
+            err = avcodec_open2(codecContext, codec, NULL);
             AV_ERROR_CHECK(err);
             
-            codecContext = formatContext->streams[streamIndex]->codec;
             if (!codecContext->channel_layout)
                 codecContext->channel_layout = av_get_default_channel_layout(codecContext->channels);
         }
@@ -222,14 +718,74 @@ namespace FFAudioHelper
         return err;
     }
     
+    int openInputFile(const std::string& inputFile, AVProcessContext& context, AVSampleFormat requestSampleFormat)
+    {
+        int err = 0;
+        {
+            err = openInputFile(inputFile, context.format, context.codec, context.streamIndex, requestSampleFormat);
+            AV_ERROR_CHECK(err);
+            
+            std::string path;
+            double startTime = 0, endTime = -1;
+            CHECK(parseClip(inputFile, path, startTime, endTime));
+            
+            int64_t startSample = llround(startTime * context.codec->sample_rate);
+            int64_t endSample = (endTime < 0) ? -1 : llround(endTime * context.codec->sample_rate);
+            err = setInputRange(context, startSample, endSample);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int makeLazyInput(const std::string& inputFile, AVSampleFormat requestSampleFormat, AVProcessContext& context)
+    {
+        int err = 0;
+        {
+            err = getStreamInfo(inputFile, requestSampleFormat, context.stream);
+            AV_ERROR_CHECK(err);
+            
+            context.opener = [inputFile, requestSampleFormat](AVProcessContext& c)
+            {
+                return openInputFile(inputFile, c, requestSampleFormat);
+            };
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    void closeInput(AVProcessContext& context)
+    {
+        if (context.codec)
+            avcodec_free_context(&context.codec);
+        if (context.format)
+            avformat_close_input(&context.format);
+    }
+    
     int openOutputFile(const std::string& outputFile,
                               AVFormatContext*& formatContext,
                               AVCodecContext*& codecContext,
                               const std::string& fileType,
-                              const int bitrate)
+                              const int bitrate,
+                              const FFOutputProfile& profile,
+                              AVCodecID codecID,
+                              const std::string& codecOptions)
     {
         int err = 0;
         {
+            FFAutoReleasePool pool;
+            
+            AVDictionary* options = NULL;
+            pool.autoRelease([&options]
+                             {
+                                 av_dict_free(&options);
+                             });
+            
+            err = av_dict_parse_string(&options, codecOptions.c_str(), "=", ":", 0);
+            AV_ERROR_CHECK(err);
+            
             AVIOContext* ioContext = NULL;
             err = avio_open(&ioContext, outputFile.c_str(), AVIO_FLAG_WRITE);
             AV_ERROR_CHECK(err);
@@ -243,25 +799,33 @@ namespace FFAudioHelper
             
             av_strlcpy(formatContext->filename, outputFile.c_str(), sizeof((formatContext)->filename));
             
-            AVCodec* codec = avcodec_find_encoder(formatContext->oformat->audio_codec);
+            AVCodec* codec = avcodec_find_encoder((AV_CODEC_ID_NONE != codecID) ? codecID : formatContext->oformat->audio_codec);
             ERROR_CHECKEX(codec, err = AVERROR_ENCODER_NOT_FOUND);
             
-            AVStream *stream = avformat_new_stream(formatContext, codec);
+            AVStream *stream = avformat_new_stream(formatContext, NULL);
             ERROR_CHECKEX(stream, err = AVERROR_UNKNOWN);
             
-            codecContext = stream->codec;
-            codecContext->channels       = outputAudioChannelNum;
-            codecContext->channel_layout = av_get_default_channel_layout(outputAudioChannelNum);
-            codecContext->sample_rate    = outputSampleRate;
+            codecContext = avcodec_alloc_context3(codec);
+            ERROR_CHECKEX(codecContext, err = AVERROR(ENOMEM));
+            codecContext->channels       = profile.channels;
+            codecContext->channel_layout = av_get_default_channel_layout(profile.channels);
+            codecContext->sample_rate    = profile.sampleRate;
             codecContext->sample_fmt     = codec->sample_fmts[0];
             codecContext->bit_rate       = bitrate;
             
+            // the fixed point mix is encoded as it is when the encoder takes it, such as mp3
+            if (profile.isFixedPoint() && supportsSampleFormat(codec, profile.sampleFormat))
+                codecContext->sample_fmt = profile.sampleFormat;
+            
             /** Allow the use of the experimental AAC encoder */
             codecContext->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
             
             /** Set the sample rate for the container. */
-            stream->time_base.den = codecContext->sample_rate;
-            stream->time_base.num = 1;
+            codecContext->time_base.den = codecContext->sample_rate;
+            codecContext->time_base.num = 1;
+            stream->time_base = codecContext->time_base;
+            
+            configThreads(codecContext, codec);
             
             /**
              * Some container formats (like MP4) require global headers to be present
@@ -271,7 +835,16 @@ namespace FFAudioHelper
                 codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
             
             /** Open the encoder for the audio stream to use it later. */
-            err = avcodec_open2(codecContext, codec, NULL);
+            err = avcodec_open2(codecContext, codec, &options);
+            AV_ERROR_CHECK(err);
+            
+            // the options the encoder didn't take are left in the dictionary, a misspelt or foreign option is an error
+            AVDictionaryEntry* unused = av_dict_get(options, "", NULL, AV_DICT_IGNORE_SUFFIX);
+            if (unused)
+                std::cerr << "option " << unused->key << " not found in encoder " << codec->name << std::endl;
+            ERROR_CHECKEX(!unused, err = AVERROR_OPTION_NOT_FOUND);
+            
+            err = avcodec_parameters_from_context(stream->codecpar, codecContext);
             AV_ERROR_CHECK(err);
         }
         
@@ -279,52 +852,100 @@ namespace FFAudioHelper
         return err;
     }
     
-    int configFilterGraphForMixing(const int64_t wholeDuration,
-                                                   const AVCodecContext* inputCodec1, AVFilterContext*& inputFilter1,
-                                                   const AVCodecContext* inputCodec2, AVFilterContext*& inputFilter2,
-                                                   const AVCodecContext* outputCodec, AVFilterContext*& outputFilter,
-                                                   AVFilterGraph*& graph)
+    bool getEncoderPresetOptions(const std::string& preset, const std::string& fileType, std::string& options)
     {
-        int err = 0;
+        AVOutputFormat* format = av_guess_format(NULL, fileType.c_str(), NULL);
+        AVCodecID codecID = format ? format->audio_codec : AV_CODEC_ID_NONE;
+        
+        bool found = false;
+        options.clear();
+        for (const FFEncoderPreset& item : encoderPresets)
         {
-            graph = avfilter_graph_alloc();
-            ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
+            if (preset != item.name)
+                continue;
             
-            // input 1
-            err = makeInput(graph, inputCodec1, inputFilter1);
-            AV_ERROR_CHECK(err);
-            
-            AVFilterContext* aFormat1 = NULL;
-            err = makeFormatForAMIX(graph, inputFilter1, aFormat1);
-            AV_ERROR_CHECK(err);
-            
-            AVFilterContext* aPad1 = NULL;
-            err = makePadWhole(graph, aFormat1, wholeDuration, aPad1);
-            AV_ERROR_CHECK(err);
-            
-            // input2
-            err = makeInput(graph, inputCodec2, inputFilter2);
-            AV_ERROR_CHECK(err);
+            found = true;
+            if (item.codecID == codecID)
+                options = item.options;
+        }
+        return found;
+    }
+    
+    void addEncoderOptions(const std::map<std::string, std::string>& encoderOptions, std::string& options)
+    {
+        std::ostringstream str;
+        str << options;
+        for (const auto& option : encoderOptions)
+            str << (str.tellp() > 0 ? ":" : "") << option.first << '=' << option.second;
+        options = str.str();
+    }
+    
+    AVSampleFormat getOutputSampleFormat(const std::string& fileType)
+    {
+        AVOutputFormat* format = av_guess_format(NULL, fileType.c_str(), NULL);
+        AVCodec* codec = format ? avcodec_find_encoder(format->audio_codec) : NULL;
+        if (!codec || !codec->sample_fmts)
+            return AV_SAMPLE_FMT_NONE;
+        return codec->sample_fmts[0];
+    }
+    
+    int configFilterGraphForMixing(const int64_t wholeDuration,
+                                                   const FFOutputProfile& profile,
+                                                   const std::string& resampleOptions,
+                                                   int resampleTaps,
+                                                   std::vector<AVProcessContext>& inputContexts,
+                                                   const std::vector<double>& inputGains,
+                                                   const AVCodecContext* outputCodec, AVFilterContext*& outputFilter,
+                                                   AVFilterGraph*& graph,
+                                                   int* removedConversions)
+    {
+        int err = 0;
+        {
+            graph = avfilter_graph_alloc();
+            ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
             
-            AVFilterContext* aFormat2 = NULL;
-            err = makeFormatForAMIX(graph, inputFilter2, aFormat2);
+            err = configResampler(graph, resampleOptions);
             AV_ERROR_CHECK(err);
             
-            AVFilterContext* aPad2 = NULL;
-            err = makePadWhole(graph, aFormat2, wholeDuration, aPad2);
-            AV_ERROR_CHECK(err);
+            std::vector<AVFilterContext*> inputs;
+            for (int i = 0; i < inputContexts.size(); ++i)
+            {
+                AVProcessContext& context = inputContexts[i];
+                err = makeInput(graph, context, profile, resampleTaps);
+                AV_ERROR_CHECK(err);
+                
+                err = makeFormatForAMIX(graph, profile, context.filter, context.lastFilter, removedConversions);
+                AV_ERROR_CHECK(err);
+                
+                if (i < inputGains.size() && inputGains[i] != 1 && !profile.isFixedPoint())
+                {
+                    err = makeVolume(graph, context.lastFilter, inputGains[i], context.lastFilter);
+                    AV_ERROR_CHECK(err);
+                }
+                
+                err = makePadWhole(graph, context.lastFilter, wholeDuration, context.lastFilter);
+                AV_ERROR_CHECK(err);
+                
+                inputs.push_back(context.lastFilter);
+            }
             
             // amix filter
             AVFilterContext* mixFilter = NULL;
-            std::vector<AVFilterContext*> inputs;
-            inputs.push_back(aPad1);
-            inputs.push_back(aPad2);
-            err = makeMix(graph, inputs, mixFilter);
+            if (profile.isFixedPoint())
+            {
+                // the gains are folded into the sum, divided by the count of inputs like amix does on the float path
+                std::vector<double> gains;
+                for (int i = 0; i < inputs.size(); ++i)
+                    gains.push_back(((i < inputGains.size()) ? inputGains[i] : 1.) / inputs.size());
+                err = makeMixFixed(graph, profile, inputs, gains, mixFilter);
+            }
+            else
+                err = makeMix(graph, inputs, mixFilter);
             AV_ERROR_CHECK(err);
             
             // output format
             AVFilterContext* aFormatOut = NULL;
-            err = makeFormatForOutput(graph, outputCodec, mixFilter, aFormatOut);
+            err = makeFormatForOutput(graph, outputCodec, mixFilter, aFormatOut, removedConversions);
             AV_ERROR_CHECK(err);
             
             // output sink
@@ -362,6 +983,176 @@ namespace FFAudioHelper
         return err;
     }
     
+    // seeks back to the target sample, the position is read from the first frame, or counted from 0 at the stream start
+    static int seekInput(AVProcessContext& context, int64_t target)
+    {
+        int err = 0;
+        {
+            target = std::max<int64_t>(target, 0);
+            AVStream* stream = context.format->streams[context.streamIndex];
+            AVRational sampleTimeBase = {1, context.codec->sample_rate};
+            int64_t timestamp = av_rescale_q(target, sampleTimeBase, stream->time_base);
+            if (AV_NOPTS_VALUE != stream->start_time)
+                timestamp += stream->start_time;
+            
+            err = av_seek_frame(context.format, context.streamIndex, timestamp, AVSEEK_FLAG_BACKWARD);
+            AV_ERROR_CHECK(err);
+            
+            avcodec_flush_buffers(context.codec);
+            context.seekTarget = target;
+            context.inputPosition = target ? -1 : 0;
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int setInputRange(AVProcessContext& context, int64_t startSample, int64_t endSample)
+    {
+        int err = 0;
+        {
+            context.startSample = std::max<int64_t>(startSample, 0);
+            context.endSample = endSample;
+            CHECK(context.startSample > 0);
+            
+            // start earlier by the pre-roll of the decoder, the frames before the start are decoded and dropped
+            // not seekable, the samples before the start are decoded and dropped
+            CHECK(seekInput(context, context.startSample - getDecoderPreroll(context.codec)) >= 0);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int decodeRangeFrame(AVProcessContext& context, AVFrame* frame, bool& finished)
+    {
+        int err = 0;
+        {
+            finished = false;
+            while (true)
+            {
+                // stop demuxing at the end of the range
+                if ((context.endSample >= 0) && (context.inputPosition >= context.endSample))
+                {
+                    finished = true;
+                    QUIT();
+                }
+                
+                int64_t pts = 0;
+                err = decodeOneFrame(context.format, context.codec, context.streamIndex, frame, pts, finished);
+                AV_ERROR_CHECK(err);
+                CHECK(!finished);
+                
+                // the first frame after a seek tells where the demuxer is
+                if (context.inputPosition < 0)
+                {
+                    AVStream* stream = context.format->streams[context.streamIndex];
+                    AVRational sampleTimeBase = {1, context.codec->sample_rate};
+                    int64_t timestamp = av_frame_get_best_effort_timestamp(frame);
+                    
+                    // the position is unknown, it's counted from the start of the stream instead
+                    if (AV_NOPTS_VALUE == timestamp)
+                    {
+                        err = seekInput(context, 0);
+                        AV_ERROR_CHECK(err);
+                        continue;
+                    }
+                    
+                    if (AV_NOPTS_VALUE != stream->start_time)
+                        timestamp -= stream->start_time;
+                    int64_t position = av_rescale_q(timestamp, stream->time_base, sampleTimeBase);
+                    
+                    // an inexact seek landed after the range start, seek back twice as far, at least a second
+                    if (position > context.startSample)
+                    {
+                        int64_t back = std::max<int64_t>(2 * (context.startSample - context.seekTarget), context.codec->sample_rate);
+                        err = seekInput(context, context.startSample - back);
+                        AV_ERROR_CHECK(err);
+                        continue;
+                    }
+                    context.inputPosition = position;
+                }
+                
+                int64_t position = context.inputPosition;
+                context.inputPosition += frame->nb_samples;
+                
+                if (context.inputPosition <= context.startSample)
+                    continue;
+                
+                if (position < context.startSample)
+                {
+                    err = dropFrameSamples(frame, (int)(context.startSample - position));
+                    AV_ERROR_CHECK(err);
+                }
+                
+                if ((context.endSample >= 0) && (context.inputPosition > context.endSample))
+                    frame->nb_samples -= (int)(context.inputPosition - context.endSample);
+                
+                frame->pts = context.currentPTS;
+                context.currentPTS += frame->nb_samples;
+                break;
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int rewindInput(AVProcessContext& context)
+    {
+        int err = 0;
+        {
+            if (context.startSample > 0)
+            {
+                err = setInputRange(context, context.startSample, context.endSample);
+                AV_ERROR_CHECK(err);
+                QUIT();
+            }
+            
+            // not seekable, the input stays finished
+            // the decoder was drained, the seek flushes it so that it takes packets again
+            CHECK(seekInput(context, 0) >= 0);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int dropFrameSamples(AVFrame* frame, int count)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            
+            AVFrame* kept = av_frame_alloc();
+            ERROR_CHECKEX(kept, err = AVERROR(ENOMEM));
+            pool.autoRelease([&kept]
+                             {
+                                 av_frame_free(&kept);
+                             });
+            
+            kept->format         = frame->format;
+            kept->channels       = frame->channels;
+            kept->channel_layout = frame->channel_layout;
+            kept->sample_rate    = frame->sample_rate;
+            kept->nb_samples     = frame->nb_samples - count;
+            err = av_frame_get_buffer(kept, 0);
+            AV_ERROR_CHECK(err);
+            
+            err = av_frame_copy_props(kept, frame);
+            AV_ERROR_CHECK(err);
+            
+            err = av_samples_copy(kept->extended_data, frame->extended_data, 0, count, kept->nb_samples, kept->channels, (AVSampleFormat)kept->format);
+            AV_ERROR_CHECK(err);
+            
+            av_frame_unref(frame);
+            av_frame_move_ref(frame, kept);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
     int tryDecodeOneFrame(AVFormatContext* inputFormat, AVCodecContext* inputCodec, int inputStream, AVFrame* frame, bool& dataPresent, bool& finished)
     {
         int err = 0;
@@ -371,6 +1162,25 @@ namespace FFAudioHelper
             dataPresent = false;
             finished = false;
             
+            // a packet may hold several frames, all of them are taken before the next packet is sent
+            err = avcodec_receive_frame(inputCodec, frame);
+            if (err >= 0)
+            {
+                dataPresent = true;
+                QUIT();
+            }
+            
+            // drained after the end of the input
+            if (AVERROR_EOF == err)
+            {
+                finished = true;
+                err = 0;
+                QUIT();
+            }
+            
+            if (AVERROR(EAGAIN) != err)
+                AV_ERROR_CHECK(err);
+            
             AVPacket packet = {0};
             av_init_packet(&packet);
             pool.autoRelease([&packet]
@@ -381,91 +1191,288 @@ namespace FFAudioHelper
             err = av_read_frame(inputFormat, &packet);
             if (AVERROR_EOF == err)
             {
-                finished = true;
-                err = 0;
+                // flush decoder
+                err = avcodec_send_packet(inputCodec, NULL);
+                if (AVERROR_EOF == err)
+                    err = 0;
+                AV_ERROR_CHECK(err);
+                QUIT();
             }
             AV_ERROR_CHECK(err);
             
-            if (((packet.stream_index == inputStream) && // skip other streams like artwork picture
-                 ((packet.size < strlen(ID3Magic)) || !packetIsID3(&packet))) // skip ID3 data
-                || finished) // flush decoder
+            if ((packet.stream_index == inputStream) && // skip other streams like artwork picture
+                ((packet.size < strlen(ID3Magic)) || !packetIsID3(&packet))) // skip ID3 data
             {
-                int gotFrame = 0;
-                err = avcodec_decode_audio4(inputCodec, frame, &gotFrame, &packet);
+                err = avcodec_send_packet(inputCodec, &packet);
                 AV_ERROR_CHECK(err);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int encodeOneFrame(AVFormatContext* outputFormat, AVCodecContext* outputCodec, AVFrame* frame, int64_t& packetPts)
+    {
+        int err = 0;
+        {
+            // NULL frame starts draining, the encoder may be draining already
+            err = avcodec_send_frame(outputCodec, frame);
+            if (!frame && (AVERROR_EOF == err))
+                err = 0;
+            AV_ERROR_CHECK(err);
+            
+            // write every packet the frame completes
+            while (true)
+            {
+                FFAutoReleasePool pool;
                 
-                assert(err == packet.size);
-                dataPresent = gotFrame;
+                AVPacket packet = {0};
+                av_init_packet(&packet);
+                pool.autoRelease([&packet]
+                                 {
+                                     av_packet_unref(&packet);
+                                 });
+                
+                err = avcodec_receive_packet(outputCodec, &packet);
+                if ((AVERROR(EAGAIN) == err) || (AVERROR_EOF == err))
+                {
+                    err = 0;
+                    break;
+                }
+                AV_ERROR_CHECK(err);
+                
+                packet.pts = packetPts;
+                packet.dts = packetPts;
+                packetPts += packet.duration;
+                
+                err = av_interleaved_write_frame(outputFormat, &packet);
+                AV_ERROR_CHECK(err);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int encodeFlush(AVFormatContext* outputFormat, AVCodecContext* outputCodec, int64_t& packetPts)
+    {
+        int err = 0;
+        {
+            // the NULL frame drains all the delayed packets
+            err = encodeOneFrame(outputFormat, outputCodec, NULL, packetPts);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // samples of the sink rate fed to the input
+    static int64_t getFedSamples(const AVProcessContext& context, int sampleRate)
+    {
+        if (!sampleRate)
+            return 0;
+        if (context.resampler)
+            return av_rescale(context.resampledPTS, sampleRate, context.resampler->getOutputSampleRate());
+        // a drained lazy input is closed
+        int inputRate = context.codec ? context.codec->sample_rate : context.stream.sampleRate;
+        return inputRate ? av_rescale(context.currentPTS, sampleRate, inputRate) : 0;
+    }
+    
+    static int64_t getQueuedSamples(const std::vector<AVProcessContext>& inputContexts, const FFFeedBudget& feed)
+    {
+        int64_t queued = 0;
+        for (const AVProcessContext& context : inputContexts)
+        {
+            if (context.feedStart >= 0)
+                queued += std::max<int64_t>(context.feedStart + getFedSamples(context, feed.sampleRate) - feed.sinkPosition, 0);
+        }
+        return queued;
+    }
+    
+    int feedInputs(std::vector<AVProcessContext>& inputContexts, FFFeedBudget* budget)
+    {
+        int err = 0;
+        {
+            FFFeedBudget unbounded;
+            FFFeedBudget& feed = budget ? *budget : unbounded;
+            bool bounded = (feed.maxQueuedSamples > 0) && feed.sampleRate;
+            
+            // find lack source inputs
+            std::vector<int> lackSourceInputs;
+            for (int i = 0; i < inputContexts.size(); ++i)
+            {
+                if (av_buffersrc_get_nb_failed_requests(inputContexts[i].filter) > 0)
+                    lackSourceInputs.push_back(i);
             }
             
-            if (finished && dataPresent)
-                finished = false;
+            int64_t queued = getQueuedSamples(inputContexts, feed);
+            
+            // decode frames and fill in to input filter
+            for (int i : lackSourceInputs)
+            {
+                AVProcessContext& inputContext = inputContexts[i];
+                if (inputContext.feedStart < 0)
+                    inputContext.feedStart = feed.sinkPosition;
+                
+                // a lazy input is opened when the graph first asks for it, its source was configured with the probed stream
+                if (inputContext.opener && !inputContext.codec)
+                {
+                    err = inputContext.opener(inputContext);
+                    AV_ERROR_CHECK(err);
+                    CHECKEX(FFStreamInfo(inputContext.codec) == inputContext.stream, err = AVERROR_INVALIDDATA);
+                }
+                
+                bool finished = false;
+                for (int j = 0; j < std::max(feed.maxFramesPerInput, 1) && !finished; ++j)
+                {
+                    // the graph waits for this input, so it gets one frame over the budget
+                    if (j > 0 && bounded && queued >= feed.maxQueuedSamples)
+                        break;
+                    
+                    AVFrame* inputFrame = av_frame_alloc();
+                    ERROR_CHECKEX(inputFrame, err = AVERROR(ENOMEM));
+                    
+                    FFAutoReleasePool pool;
+                    pool.autoRelease([&inputFrame]
+                                     {
+                                         av_frame_free(&inputFrame);
+                                     });
+                    
+                    int64_t fed = getFedSamples(inputContext, feed.sampleRate);
+                    err = decodeRangeFrame(inputContext, inputFrame, finished);
+                    AV_ERROR_CHECK(err);
+                    
+                    if (!finished)
+                    {
+                        err = addInputFrame(inputContext, inputFrame);
+                        AV_ERROR_CHECK(err);
+                        queued += getFedSamples(inputContext, feed.sampleRate) - fed;
+                    }
+                }
+                feed.peakQueuedBytes = std::max(feed.peakQueuedBytes, queued * feed.frameBytes);
+                
+                // end input
+                if (finished)
+                {
+                    err = addInputFrame(inputContext, NULL);
+                    AV_ERROR_CHECK(err);
+                    
+                    // the demuxer and the decoder of a drained input are released now, long jobs have hundreds of inputs,
+                    // an input that isn't lazy belongs to the pool of the caller, the jobs with many inputs open them lazily
+                    if (inputContext.opener)
+                    {
+                        closeInput(inputContext);
+                        inputContext.opener = nullptr;
+                    }
+                }
+            }
         }
         
     Exit0:
         return err;
     }
     
-    int encodeOneFrame(AVFormatContext* outputFormat, AVCodecContext* outputCodec, AVFrame* frame, int64_t& packetPts)
+    int processAll(std::vector<AVProcessContext>& inputContexts, const AVProcessContext& outputContext, FFFeedBudget* budget)
     {
         int err = 0;
+        
         {
             FFAutoReleasePool pool;
-            
-            AVPacket packet = {0};
-            av_init_packet(&packet);
-            pool.autoRelease([&packet]
+            pool.autoRelease([&inputContexts]
                              {
-                                 av_packet_unref(&packet);
+                                 // the lazy inputs that didn't drain
+                                 for (AVProcessContext& context : inputContexts)
+                                 {
+                                     if (context.opener)
+                                         closeInput(context);
+                                 }
                              });
             
-            int gotPacket = 0;
-            err = avcodec_encode_audio2(outputCodec, &packet, frame, &gotPacket);
-            AV_ERROR_CHECK(err);
+            if (budget)
+                budget->sinkPosition = 0;
             
-            if (gotPacket)
+            int64_t framePts = 0;
+            int64_t packetPts = 0;
+            while (true)
             {
-                packet.pts = packetPts;
-                packet.dts = packetPts;
-                packetPts += packet.duration;
+                // encode filterd frames
+                do
+                {
+                    FFAutoReleasePool pool;
+                    
+                    AVFrame* filteredFrame = av_frame_alloc();
+                    pool.autoRelease([&filteredFrame]
+                                     {
+                                         av_frame_free(&filteredFrame);
+                                     });
+                    
+                    err = av_buffersink_get_frame(outputContext.filter, filteredFrame);
+                    if (err >= 0)
+                    {
+                        filteredFrame->pts = framePts;
+                        framePts += filteredFrame->nb_samples;
+                        if (budget)
+                            budget->sinkPosition += filteredFrame->nb_samples;
+                        
+                        err = encodeOneFrame(outputContext.format, outputContext.codec, filteredFrame, packetPts);
+                        AV_ERROR_CHECK(err);
+                    }
+                }
+                while (err >= 0);
+                
+                // need more input
+                if (AVERROR(EAGAIN) == err)
+                {
+                    err = feedInputs(inputContexts, budget);
+                    AV_ERROR_CHECK(err);
+                }
+                // flush encoder
+                else if ((AVERROR(ENOMEM) == err) || AVERROR_EOF == err)
+                {
+                    FFAllocTracker::trackAudioSamples(framePts, outputContext.codec->sample_rate);
+                    err = encodeFlush(outputContext.format, outputContext.codec, packetPts);
+                    break;
+                }
                 
-                err = av_interleaved_write_frame(outputFormat, &packet);
-                AV_ERROR_CHECK(err);
-            }
-        }
-        
-    Exit0:
-        return err;
-    }
-    
-    int encodeFlush(AVFormatContext* outputFormat, AVCodecContext* outputCodec, int64_t& packetPts)
-    {
-        int err = 0;
-        {
-            int64_t oldPts = 0;
-            do
-            {
-                oldPts = packetPts;
-                err = encodeOneFrame(outputFormat, outputCodec, NULL, packetPts);
+                // other errors
                 AV_ERROR_CHECK(err);
             }
-            while (oldPts < packetPts);
         }
         
     Exit0:
         return err;
     }
     
-    int processAll(std::vector<AVProcessContext>& inputContexts, const AVProcessContext& outputContext)
+    int processAll(std::vector<AVProcessContext>& inputContexts, std::vector<AVProcessContext>& outputContexts, const std::vector<int64_t>& outputLengths, FFFeedBudget* budget,
+                   const std::function<int(size_t)>& outputFinished)
     {
         int err = 0;
         
         {
+            FFAutoReleasePool pool;
+            pool.autoRelease([&inputContexts]
+                             {
+                                 // the lazy inputs that didn't drain
+                                 for (AVProcessContext& context : inputContexts)
+                                 {
+                                     if (context.opener)
+                                         closeInput(context);
+                                 }
+                             });
+            
+            if (budget)
+                budget->sinkPosition = 0;
+            
+            AVFilterContext* sink = outputContexts.front().filter;
+            size_t current = 0;
+            int64_t written = 0;
             int64_t framePts = 0;
             int64_t packetPts = 0;
-            while (true)
+            while (current < outputContexts.size())
             {
-                // encode filterd frames
+                // encode filterd samples, the frames are cut at the output boundaries
                 do
                 {
                     FFAutoReleasePool pool;
@@ -476,67 +1483,57 @@ namespace FFAudioHelper
                                          av_frame_free(&filteredFrame);
                                      });
                     
-                    err = av_buffersink_get_frame(outputContext.filter, filteredFrame);
+                    int samples = (int)std::min<int64_t>(outputLengths[current] - written, 4096);
+                    err = av_buffersink_get_samples(sink, filteredFrame, samples);
                     if (err >= 0)
                     {
+                        AVProcessContext& outputContext = outputContexts[current];
                         filteredFrame->pts = framePts;
                         framePts += filteredFrame->nb_samples;
+                        written += filteredFrame->nb_samples;
+                        if (budget)
+                            budget->sinkPosition += filteredFrame->nb_samples;
                         
                         err = encodeOneFrame(outputContext.format, outputContext.codec, filteredFrame, packetPts);
                         AV_ERROR_CHECK(err);
-                    }
-                }
-                while (err >= 0);
-                
-                // need more input
-                if (AVERROR(EAGAIN) == err)
-                {
-                    // find lack source inputs
-                    std::vector<int> lackSourceInputs;
-                    for (int i = 0; i < inputContexts.size(); ++i)
-                    {
-                        if (av_buffersrc_get_nb_failed_requests(inputContexts[i].filter) > 0)
-                            lackSourceInputs.push_back(i);
-                    }
-                    
-                    // decode frames and fill in to input filter
-                    for (int i : lackSourceInputs)
-                    {
-                        AVProcessContext& inputContext = inputContexts[i];
-                        bool finished = false;
-                        for (int j = 0; j < 128 && !finished; ++j)
+                        
+                        if (written >= outputLengths[current])
                         {
-                            AVFrame* inputFrame = av_frame_alloc();
-                            ERROR_CHECKEX(inputFrame, err = AVERROR(ENOMEM));
-                            
-                            FFAutoReleasePool pool;
-                            pool.autoRelease([&inputFrame]
-                                             {
-                                                 av_frame_free(&inputFrame);
-                                             });
-                            
-                            err = decodeOneFrame(inputContext.format, inputContext.codec, inputContext.streamIndex, inputFrame, inputContext.currentPTS, finished);
+                            err = encodeFlush(outputContext.format, outputContext.codec, packetPts);
                             AV_ERROR_CHECK(err);
                             
-                            if (!finished)
+                            if (outputFinished)
                             {
-                                err = av_buffersrc_add_frame(inputContext.filter, inputFrame);
+                                err = outputFinished(current);
                                 AV_ERROR_CHECK(err);
                             }
-                        }
-                        
-                        // end input
-                        if (finished)
-                        {
-                            err = av_buffersrc_add_frame(inputContext.filter, NULL);
-                            AV_ERROR_CHECK(err);
+                            
+                            FFAllocTracker::trackAudioSamples(written, outputContext.codec->sample_rate);
+                            written = 0;
+                            framePts = 0;
+                            packetPts = 0;
+                            if (++current == outputContexts.size())
+                                break;
                         }
                     }
                 }
-                // flush encoder
+                while (err >= 0);
+                
+                // need more input
+                if (AVERROR(EAGAIN) == err)
+                {
+                    err = feedInputs(inputContexts, budget);
+                    AV_ERROR_CHECK(err);
+                }
+                // the graph ends before the last output is full
                 else if ((AVERROR(ENOMEM) == err) || AVERROR_EOF == err)
                 {
-                    err = encodeFlush(outputContext.format, outputContext.codec, packetPts);
+                    err = 0;
+                    if (current < outputContexts.size())
+                    {
+                        FFAllocTracker::trackAudioSamples(written, outputContexts[current].codec->sample_rate);
+                        err = encodeFlush(outputContexts[current].format, outputContexts[current].codec, packetPts);
+                    }
                     break;
                 }
                 
@@ -549,6 +1546,26 @@ namespace FFAudioHelper
         return err;
     }
     
+    int configResampler(AVFilterGraph* graph, const std::string& swrOptions)
+    {
+        int err = 0;
+        {
+            if (swrOptions.empty())
+                QUIT();
+            
+            err = av_opt_set(graph, "aresample_swr_opts", swrOptions.c_str(), 0);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    bool isSoxrAvailable()
+    {
+        return (NULL != strstr(swresample_configuration(), "--enable-libsoxr"));
+    }
+    
     int makeInput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext*& input)
     {
         int err = 0;
@@ -563,6 +1580,91 @@ namespace FFAudioHelper
         return err;
     }
     
+    int makeInput(AVFilterGraph* graph, AVProcessContext& context, const FFOutputProfile& profile, int resampleTaps)
+    {
+        int err = 0;
+        {
+            FFStreamInfo stream = context.codec ? FFStreamInfo(context.codec) : context.stream;
+            
+            context.filter = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffer"), NULL);
+            ERROR_CHECKEX(context.filter, err = AVERROR(ENOMEM));
+            
+            // the native resampler is float, the fixed point pipeline resamples s16 in swresample
+            if (resampleTaps <= 0 || profile.isFixedPoint() || stream.sampleFormat != AV_SAMPLE_FMT_FLTP || !FFPolyphaseResampler::isSupported(stream.sampleRate, profile.sampleRate))
+            {
+                err = configInputFilter(context.filter, stream);
+                AV_ERROR_CHECK(err);
+                QUIT();
+            }
+            
+            context.resampler = std::make_shared<FFPolyphaseResampler>(stream.sampleRate, profile.sampleRate, stream.channels, resampleTaps);
+            context.resampledPTS = 0;
+            
+            err = configInputFilter(context.filter, AV_SAMPLE_FMT_FLTP, profile.sampleRate, stream.channels);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int addInputFrame(AVProcessContext& context, AVFrame* frame)
+    {
+        int err = 0;
+        {
+            if (!context.resampler)
+            {
+                err = av_buffersrc_add_frame(context.filter, frame);
+                AV_ERROR_CHECK(err);
+                QUIT();
+            }
+            
+            FFAutoReleasePool pool;
+            
+            AVFrame* resampledFrame = av_frame_alloc();
+            ERROR_CHECKEX(resampledFrame, err = AVERROR(ENOMEM));
+            pool.autoRelease([&resampledFrame]
+                             {
+                                 av_frame_free(&resampledFrame);
+                             });
+            
+            int channels = context.codec->channels;
+            int inputSamples = frame ? frame->nb_samples : 0;
+            resampledFrame->format         = AV_SAMPLE_FMT_FLTP;
+            resampledFrame->channel_layout = av_get_default_channel_layout(channels);
+            resampledFrame->channels       = channels;
+            resampledFrame->sample_rate    = context.resampler->getOutputSampleRate();
+            resampledFrame->nb_samples     = context.resampler->getOutputCapacity(frame ? inputSamples : 4096);
+            err = av_frame_get_buffer(resampledFrame, 0);
+            AV_ERROR_CHECK(err);
+            
+            float* const* output = (float* const*)resampledFrame->extended_data;
+            if (frame)
+                resampledFrame->nb_samples = context.resampler->process((const float* const*)frame->extended_data, inputSamples, output, resampledFrame->nb_samples);
+            else
+                resampledFrame->nb_samples = context.resampler->flush(output, resampledFrame->nb_samples);
+            
+            if (resampledFrame->nb_samples > 0)
+            {
+                resampledFrame->pts = context.resampledPTS;
+                context.resampledPTS += resampledFrame->nb_samples;
+                
+                err = av_buffersrc_add_frame(context.filter, resampledFrame);
+                AV_ERROR_CHECK(err);
+            }
+            
+            // end input
+            if (!frame)
+            {
+                err = av_buffersrc_add_frame(context.filter, NULL);
+                AV_ERROR_CHECK(err);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
     int makeOutput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext* input, AVFilterContext*& output)
     {
         int err = 0;
@@ -585,13 +1687,20 @@ namespace FFAudioHelper
         return err;
     }
     
-    int makeFormatForAMIX(AVFilterGraph* graph, AVFilterContext* input, AVFilterContext*& output)
+    int makeFormatForAMIX(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, AVFilterContext*& output, int* removedConversions)
     {
         int err = 0;
         {
+            if (!isConversionNeeded(input, profile.sampleFormat, profile.sampleRate, av_get_default_channel_layout(profile.channels)))
+            {
+                addRemovedConversion(removedConversions);
+                output = input;
+                QUIT();
+            }
+            
             AVFilterContext* format = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("aformat"), NULL);
             ERROR_CHECKEX(format, err = AVERROR(ENOMEM));
-            err = configFormatFilterForAmix(format);
+            err = configFormatFilterForAmix(format, profile);
             AV_ERROR_CHECK(err);
             
             output = format;
@@ -603,10 +1712,17 @@ namespace FFAudioHelper
         return err;
     }
     
-    int makeFormatForOutput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext* input, AVFilterContext*& output)
+    int makeFormatForOutput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext* input, AVFilterContext*& output, int* removedConversions)
     {
         int err = 0;
         {
+            if (!isConversionNeeded(input, codec->sample_fmt, codec->sample_rate, codec->channel_layout))
+            {
+                addRemovedConversion(removedConversions);
+                output = input;
+                QUIT();
+            }
+            
             AVFilterContext* format = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("aformat"), NULL);
             ERROR_CHECKEX(format, err = AVERROR(ENOMEM));
             err = configFormatFilter(format, codec);
@@ -688,10 +1804,79 @@ namespace FFAudioHelper
         return err;
     }
     
-    int makeFade(AVFilterGraph* graph, AVFilterContext* input, bool fadeOut, int64_t start, int64_t nb, AVFilterContext*& output)
+    int makeTrimRange(AVFilterGraph* graph, AVFilterContext* input, int64_t start, int64_t end, AVFilterContext*& output)
+    {
+        int err = 0;
+        {
+            AVFilterContext* trim = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("atrim"), NULL);
+            ERROR_CHECKEX(trim, err = AVERROR(ENOMEM));
+            
+            char options[128] = {0};
+            snprintf(options, sizeof(options), "start_sample=%lld:end_sample=%lld", start, end);
+            err = avfilter_init_str(trim, options);
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_link(input, 0, trim, 0);
+            AV_ERROR_CHECK(err);
+            
+            // the window starts at 0 in the output
+            AVFilterContext* setpts = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("asetpts"), NULL);
+            ERROR_CHECKEX(setpts, err = AVERROR(ENOMEM));
+            
+            err = avfilter_init_str(setpts, "PTS-STARTPTS");
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_link(trim, 0, setpts, 0);
+            AV_ERROR_CHECK(err);
+            
+            output = setpts;
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int makeSilenceForAMIX(AVFilterGraph* graph, const FFOutputProfile& profile, int64_t duration, AVFilterContext*& output, int* removedConversions)
+    {
+        int err = 0;
+        {
+            AVFilterContext* source = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("anullsrc"), NULL);
+            ERROR_CHECKEX(source, err = AVERROR(ENOMEM));
+            
+            char options[128] = {0};
+            snprintf(options, sizeof(options), "channel_layout=0x%x:sample_rate=%d:nb_samples=%d",
+                     (int)av_get_default_channel_layout(profile.channels), profile.sampleRate, 4096);
+            err = avfilter_init_str(source, options);
+            AV_ERROR_CHECK(err);
+            
+            err = makeTrim(graph, source, duration, output);
+            AV_ERROR_CHECK(err);
+            
+            err = makeFormatForAMIX(graph, profile, output, output, removedConversions);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int makeFade(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, bool fadeOut, int64_t start, int64_t nb, AVFilterContext*& output)
     {
         int err = 0;
         {
+            // the linear ramp of afade as an 8.8 volume, every frame gets the gain of its first sample,
+            // nb_samples isn't set yet when the expression is evaluated
+            if (profile.isFixedPoint())
+            {
+                std::ostringstream ramp;
+                ramp << "(t*sample_rate-" << start << ")/" << std::max<int64_t>(nb, 1);
+                std::string expression = fadeOut ? "clip(1-" + ramp.str() + ",0,1)" : "clip(" + ramp.str() + ",0,1)";
+                
+                err = makeVolumeExpression(graph, profile, input, expression, output);
+                AV_ERROR_CHECK(err);
+                QUIT();
+            }
+            
             AVFilterContext* afade = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("afade"), NULL);
             ERROR_CHECKEX(afade, err = AVERROR(ENOMEM));
             
@@ -710,7 +1895,7 @@ namespace FFAudioHelper
         return err;
     }
     
-    int makeDelay(AVFilterGraph* graph, AVFilterContext* input, int64_t delayDuration, AVFilterContext*& output)
+    int makeDelay(AVFilterGraph* graph, AVFilterContext* input, int64_t delayDuration, int sampleRate, AVFilterContext*& output)
     {
         int err = 0;
         {
@@ -718,7 +1903,7 @@ namespace FFAudioHelper
             ERROR_CHECKEX(delay, err = AVERROR(ENOMEM));
             
             char options[128] = {0};
-            snprintf(options, sizeof(options), "delays=%d", (int)((double)delayDuration / outputSampleRate * 1000.0));
+            snprintf(options, sizeof(options), "delays=%d", (int)((double)delayDuration / sampleRate * 1000.0));
             err = avfilter_init_str(delay, options);
             AV_ERROR_CHECK(err);
             
@@ -754,6 +1939,128 @@ namespace FFAudioHelper
         return err;
     }
     
+    int makeVolumeExpression(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, const std::string& expression, AVFilterContext*& output)
+    {
+        int err = 0;
+        {
+            AVFilterContext* volumeFilter = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("volume"), NULL);
+            ERROR_CHECKEX(volumeFilter, err = AVERROR(ENOMEM));
+            
+            // set apart from the other options, the expression may be long and has commas
+            err = av_opt_set(volumeFilter, "volume", expression.c_str(), AV_OPT_SEARCH_CHILDREN);
+            AV_ERROR_CHECK(err);
+            
+            // the fixed precision scales s16 by the gain in 8.8 fixed point
+            err = avfilter_init_str(volumeFilter, profile.isFixedPoint() ? "eval=frame:precision=fixed" : "eval=frame");
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_link(input, 0, volumeFilter, 0);
+            AV_ERROR_CHECK(err);
+            
+            output = volumeFilter;
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // mixes the channels of the inputs into the layout of the profile, swresample rematrixes s16 with Q15 coefficients
+    static int makePan(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, int inputCount, const std::vector<double>& gains, AVFilterContext*& output)
+    {
+        int err = 0;
+        {
+            AVFilterContext* pan = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("pan"), NULL);
+            ERROR_CHECKEX(pan, err = AVERROR(ENOMEM));
+            
+            std::ostringstream args;
+            args << getLayoutName(profile.channels) << std::fixed << std::setprecision(6);
+            for (int c = 0; c < profile.channels; ++c)
+            {
+                args << "|c" << c << '=';
+                for (int i = 0; i < inputCount; ++i)
+                    args << ((i > 0) ? "+" : "") << ((i < gains.size()) ? gains[i] : 1.) << "*c" << (i * profile.channels + c);
+            }
+            
+            err = av_opt_set(pan, "args", args.str().c_str(), AV_OPT_SEARCH_CHILDREN);
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_init_str(pan, NULL);
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_link(input, 0, pan, 0);
+            AV_ERROR_CHECK(err);
+            
+            output = pan;
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int makeGain(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, double gain, AVFilterContext*& output)
+    {
+        if (!profile.isFixedPoint())
+            return makeVolume(graph, input, gain, output);
+        
+        return makePan(graph, profile, input, 1, std::vector<double>(1, gain), output);
+    }
+    
+    int makeMixFixed(AVFilterGraph* graph, const FFOutputProfile& profile, const std::vector<AVFilterContext*>& inputs, const std::vector<double>& gains, AVFilterContext*& output)
+    {
+        int err = 0;
+        {
+            CHECKEX(inputs.size(), err = AVERROR(EINVAL));
+            
+            // pan takes up to SWR_CH_MAX channels, larger mixes are summed in groups and the groups summed again
+            int groupSize = std::max(PAN_MAX_CHANNELS / std::max(profile.channels, 1), 2);
+            if (inputs.size() > groupSize)
+            {
+                std::vector<AVFilterContext*> groups;
+                for (int start = 0; start < inputs.size(); start += groupSize)
+                {
+                    int end = std::min<int>(start + groupSize, (int)inputs.size());
+                    std::vector<AVFilterContext*> groupInputs(inputs.begin() + start, inputs.begin() + end);
+                    std::vector<double> groupGains;
+                    for (int i = start; i < end; ++i)
+                        groupGains.push_back((i < gains.size()) ? gains[i] : 1.);
+                    
+                    AVFilterContext* group = NULL;
+                    err = makeMixFixed(graph, profile, groupInputs, groupGains, group);
+                    AV_ERROR_CHECK(err);
+                    groups.push_back(group);
+                }
+                
+                err = makeMixFixed(graph, profile, groups, std::vector<double>(groups.size(), 1.), output);
+                AV_ERROR_CHECK(err);
+                QUIT();
+            }
+            
+            AVFilterContext* merge = inputs[0];
+            if (inputs.size() > 1)
+            {
+                merge = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("amerge"), NULL);
+                ERROR_CHECKEX(merge, err = AVERROR(ENOMEM));
+                
+                char options[128] = {0};
+                snprintf(options, sizeof(options), "inputs=%d", (int)inputs.size());
+                err = avfilter_init_str(merge, options);
+                AV_ERROR_CHECK(err);
+                
+                for (int i = 0; i < inputs.size(); ++i)
+                {
+                    err = avfilter_link(inputs[i], 0, merge, i);
+                    AV_ERROR_CHECK(err);
+                }
+            }
+            
+            err = makePan(graph, profile, merge, (int)inputs.size(), gains, output);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
     int makeSplit(AVFilterGraph* graph, AVFilterContext* input, int count, std::vector<AVFilterContext*>& outputs)
     {
         int err = 0;
@@ -785,7 +2092,7 @@ namespace FFAudioHelper
         return err;
     }
     
-    int makeMix(AVFilterGraph* graph, const std::vector<AVFilterContext*>& inputs, AVFilterContext*& output)
+    int makeMix(AVFilterGraph* graph, const std::vector<AVFilterContext*>& inputs, AVFilterContext*& output, bool untilFirstEnds)
     {
         int err = 0;
         {
@@ -793,7 +2100,7 @@ namespace FFAudioHelper
             ERROR_CHECKEX(mixFilter, err = AVERROR(ENOMEM));
             
             char options[128] = {0};
-            snprintf(options, sizeof(options), "inputs=%d", (int)inputs.size());
+            snprintf(options, sizeof(options), "inputs=%d:duration=%s", (int)inputs.size(), untilFirstEnds ? "first" : "longest");
             err = avfilter_init_str(mixFilter, options);
             AV_ERROR_CHECK(err);
             
@@ -858,16 +2165,21 @@ namespace FFAudioHelper
     }
     
     int configInputFilter(AVFilterContext* filter, const AVCodecContext* codec)
+    {
+        return configInputFilter(filter, FFStreamInfo(codec));
+    }
+    
+    int configInputFilter(AVFilterContext* filter, const FFStreamInfo& stream)
     {
         int err = 0;
         {
             char options[128] = {0};
             snprintf(options, sizeof(options),
                      "sample_fmt=%s:sample_rate=%d:channel_layout=0x%x:time_base=1/%d",
-                     av_get_sample_fmt_name(codec->sample_fmt),
-                     codec->sample_rate,
-                     (int)codec->channel_layout,
-                     codec->sample_rate);
+                     av_get_sample_fmt_name(stream.sampleFormat),
+                     stream.sampleRate,
+                     (int)stream.channelLayout,
+                     stream.sampleRate);
             err = avfilter_init_str(filter, options);
             AV_ERROR_CHECK(err);
         }
@@ -895,17 +2207,17 @@ namespace FFAudioHelper
         return err;
     }
     
-    int configInputFilterForAmix(AVFilterContext* filter)
+    int configInputFilterForAmix(AVFilterContext* filter, const FFOutputProfile& profile)
     {
         int err = 0;
         {
             char options[128] = {0};
             snprintf(options, sizeof(options),
                      "sample_fmt=%s:sample_rate=%d:channel_layout=0x%x:time_base=1/%d",
-                     av_get_sample_fmt_name(AV_SAMPLE_FMT_FLTP),
-                     outputSampleRate,
-                     (int)av_get_default_channel_layout(1),
-                     outputSampleRate);
+                     av_get_sample_fmt_name(profile.sampleFormat),
+                     profile.sampleRate,
+                     (int)av_get_default_channel_layout(profile.channels),
+                     profile.sampleRate);
             err = avfilter_init_str(filter, options);
             AV_ERROR_CHECK(err);
         }
@@ -933,20 +2245,21 @@ namespace FFAudioHelper
     }
     
     /*
-     The amix filter can only accept sample format: [44100Hz/fltp/mono], 
+     The amix filter can only accept sample format: [profile rate/fltp/profile channels], 
+     s16p for the fixed point mix of makeMixFixed,
      the frames decoded from diffrent file formats have to resample to this format by aformat filter,
      otherwise the filterd output voice should be wrong !!!
      */
-    int configFormatFilterForAmix(AVFilterContext* filter)
+    int configFormatFilterForAmix(AVFilterContext* filter, const FFOutputProfile& profile)
     {
         int err = 0;
         {
             char options[128] = {0};
             snprintf(options, sizeof(options),
                      "sample_fmts=%s:sample_rates=%d:channel_layouts=0x%x",
-                     av_get_sample_fmt_name(AV_SAMPLE_FMT_FLTP),
-                     outputSampleRate,
-                     (int)av_get_default_channel_layout(1));
+                     av_get_sample_fmt_name(profile.sampleFormat),
+                     profile.sampleRate,
+                     (int)av_get_default_channel_layout(profile.channels));
             
             err = avfilter_init_str(filter, options);
             AV_ERROR_CHECK(err);
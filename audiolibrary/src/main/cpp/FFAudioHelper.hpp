@@ -17,14 +17,19 @@ extern "C" {
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavutil/opt.h>
+#include <libswresample/swresample.h>
 }
 
 #include <iostream>
+#include <map>
 #include <vector>
 #include <memory>
+#include <functional>
 
 #include "ErrorCheck.h"
 #include "FFAutoReleasePool.hpp"
+#include "FFPolyphaseResampler.hpp"
+#include "FFOutputProfile.hpp"
 
 #define AV_ERROR_CHECK(err)												\
 do {																	\
@@ -47,12 +52,26 @@ do {																	\
 
 namespace
 {
-    const int outputAudioChannelNum = 1;
-    const int outputSampleRate      = 44100;
+    // media fragment suffix of an input file, which selects a clip of it
+    const char* CLIP_FRAGMENT       = "#t=";
 }
 
 namespace FFAudioHelper
 {
+    // the format a file decodes to, enough to configure its filter source before the file is opened
+    struct FFStreamInfo
+    {
+        AVSampleFormat      sampleFormat;
+        int                 sampleRate;
+        int                 channels;
+        uint64_t            channelLayout;
+        
+        FFStreamInfo();
+        explicit FFStreamInfo(const AVCodecContext* codec);
+        
+        bool operator==(const FFStreamInfo& other) const;
+    };
+    
     typedef struct AVProcessContext
     {
         AVFormatContext*    format;
@@ -62,6 +81,23 @@ namespace FFAudioHelper
         AVFilterContext*    lastFilter;
         int64_t             currentPTS;
         
+        // decoded range in samples of the input rate, see setInputRange
+        int64_t             startSample;
+        int64_t             endSample;          // -1 decodes to the end
+        int64_t             inputPosition;      // input sample of the next decoded frame, -1 until it's known after a seek
+        int64_t             seekTarget;         // input sample the last seek went back to
+        
+        // native resampler for the common input rates, see makeInput
+        std::shared_ptr<FFPolyphaseResampler> resampler;
+        int64_t             resampledPTS;
+        
+        int64_t             feedStart;          // sink position when the input was first fed, -1 before, see FFFeedBudget
+        
+        // a lazy input is opened by feedInputs when the graph first asks for it and closed as soon as it's drained,
+        // its source is configured from the stream, see makeLazyInput
+        FFStreamInfo        stream;
+        std::function<int(AVProcessContext&)> opener;
+        
         FFAutoReleasePool pool;
         
         AVProcessContext();
@@ -69,52 +105,157 @@ namespace FFAudioHelper
     }
     AVProcessContext;
     
-    typedef struct AVCombineQueueContext
-    {
-        std::vector<std::shared_ptr<AVProcessContext>> inputQueue;
-        AVFilterContext*                destFilter;
-    }
-    AVCombineQueueContext;
-    
-    int getFileDuration(const std::string& file, int64_t& duration);
+    /*
+     Duration in samples of the profile rate. Stops decoding at maxDuration when it's not negative,
+     the duration is at most maxDuration then.
+     */
+    int getFileDuration(const std::string& file, const FFOutputProfile& profile, int64_t& duration, int64_t maxDuration = -1);
+    /*
+     getFileDuration and the stream decoded with the format of the profile. Both are memoized by the path, the size and
+     the modification time of the file, so planning a job again doesn't open the files again.
+     */
+    int probeFile(const std::string& file, const FFOutputProfile& profile, FFStreamInfo& stream, int64_t& duration, int64_t maxDuration = -1);
+    // the memoized stream of a probe, the file is opened without decoding when it wasn't probed with the format
+    int getStreamInfo(const std::string& file, AVSampleFormat requestSampleFormat, FFStreamInfo& stream);
+    // runs the task for every index on at most MAX_PARALLEL_TASKS threads, returns when all of them ran
+    const int MAX_PARALLEL_TASKS = 4;
+    void runParallel(size_t count, const std::function<void(size_t)>& task);
+    // getFileDuration of every file, the files are probed in parallel
+    int getFileDurations(const std::vector<std::string>& files, const FFOutputProfile& profile, std::vector<int64_t>& durations);
     std::string getErrorText(int err);
-    int openInputFile(const std::string& inputFile, AVFormatContext*& formatContext, AVCodecContext*& codecContext, int& streamIndex);
+    /*
+     An input file may select a clip with a media fragment, "file#t=start,end" in seconds, either bound is optional.
+     Returns false if the file has no valid fragment, the path is the file without it.
+     */
+    bool parseClip(const std::string& file, std::string& path, double& startTime, double& endTime);
+    // ignores the clip of the file, the whole file is decoded, an integer request picks an integer decoder of the codec if there is one
+    int openInputFile(const std::string& inputFile, AVFormatContext*& formatContext, AVCodecContext*& codecContext, int& streamIndex, AVSampleFormat requestSampleFormat = AV_SAMPLE_FMT_NONE);
+    // opens the file into the context, and sets the input range to the clip of the file
+    int openInputFile(const std::string& inputFile, AVProcessContext& context, AVSampleFormat requestSampleFormat = AV_SAMPLE_FMT_NONE);
+    // the input is opened with openInputFile by feedInputs when the graph first pulls it, the opener may be replaced
+    int makeLazyInput(const std::string& inputFile, AVSampleFormat requestSampleFormat, AVProcessContext& context);
+    // frees the codec and the format of the context
+    void closeInput(AVProcessContext& context);
     int openOutputFile(const std::string& outputFile,
                               AVFormatContext*& formatContext,
                               AVCodecContext*& codecContext,
                               const std::string& fileType,
-                              const int bitrate);
+                              const int bitrate,
+                              const FFOutputProfile& profile,
+                              AVCodecID codecID = AV_CODEC_ID_NONE,
+                              const std::string& codecOptions = std::string());
+    /*
+     Encoder options of "default", "realtime", "export" and "archival" for openOutputFile, for the encoder of the
+     file type, false for other names. Encoders without options for the preset get none.
+     */
+    bool getEncoderPresetOptions(const std::string& preset, const std::string& fileType, std::string& options);
+    // appends the avcodec options to the options of a preset, the later value of an option wins in openOutputFile
+    void addEncoderOptions(const std::map<std::string, std::string>& encoderOptions, std::string& options);
+    AVSampleFormat getOutputSampleFormat(const std::string& fileType);
     int configFilterGraphForMixing(const int64_t wholeDuration,
-                                           const AVCodecContext* inputCodec1, AVFilterContext*& inputFilter1,
-                                           const AVCodecContext* inputCodec2, AVFilterContext*& inputFilter2,
+                                           const FFOutputProfile& profile,
+                                           const std::string& resampleOptions,
+                                           int resampleTaps,
+                                           std::vector<AVProcessContext>& inputContexts,
+                                           const std::vector<double>& inputGains,
                                            const AVCodecContext* outputCodec, AVFilterContext*& outputFilter,
-                                           AVFilterGraph*& graph);
+                                           AVFilterGraph*& graph,
+                                           int* removedConversions = NULL);
     int decodeOneFrame(AVFormatContext* inputFormat, AVCodecContext* inputCodec, int inputStream, AVFrame* frame, int64_t& globalPTS, bool& finished);
     int tryDecodeOneFrame(AVFormatContext* inputFormat, AVCodecContext* inputCodec, int inputStream, AVFrame* frame, bool& dataPresent, bool& finished);
+    /*
+     Limits the decoding of the context to [startSample, endSample) of the input, in samples of the input rate.
+     The input is seeked when the range starts later, the samples before the start are dropped by decodeRangeFrame.
+     */
+    int setInputRange(AVProcessContext& context, int64_t startSample, int64_t endSample);
+    // decodeOneFrame within the range of the context, the pts counts from the range start
+    int decodeRangeFrame(AVProcessContext& context, AVFrame* frame, bool& finished);
+    // decodes the range of the context again after it finished, the pts keeps counting
+    int rewindInput(AVProcessContext& context);
+    // the kept samples are copied into new buffers, the filters need the planes aligned
+    int dropFrameSamples(AVFrame* frame, int count);
     int encodeOneFrame(AVFormatContext* outputFormat, AVCodecContext* outputCodec, AVFrame* frame, int64_t& packetPts);
     int encodeFlush(AVFormatContext* outputFormat, AVCodecContext* outputCodec, int64_t& packetPts);
-    int processAll(std::vector<AVProcessContext>& inputContexts, const AVProcessContext& outputContext);
+    /*
+     Back-pressure of feedInputs. A starved input gets at most maxFramesPerInput decoded frames at a time, and only one
+     once the audio queued in the graph reaches maxQueuedSamples, so that the graph still moves on.
+     The queued audio of an input is what was fed to it minus what the sink put out since it was first fed,
+     which holds for inputs that are mixed or concatenated.
+     */
+    struct FFFeedBudget
+    {
+        int     maxFramesPerInput;
+        int64_t maxQueuedSamples;       // samples of the sink rate summed over the inputs, <= 0 for no limit
+        int     sampleRate;             // of the sink, 0 doesn't measure the queue
+        int     frameBytes;             // bytes of a sample of all the channels, for peakQueuedBytes
+        int64_t sinkPosition;           // samples put out by the sink, counted by processAll
+        int64_t peakQueuedBytes;
+        
+        FFFeedBudget();
+    };
+    
+    // without a budget every starved input gets up to 128 frames, a bounded budget also closes drained decoders.
+    // Lazy inputs are opened here, and the ones left open are closed when processAll returns.
+    int feedInputs(std::vector<AVProcessContext>& inputContexts, FFFeedBudget* budget = NULL);
+    int processAll(std::vector<AVProcessContext>& inputContexts, const AVProcessContext& outputContext, FFFeedBudget* budget = NULL);
+    /*
+     Writes the output of the graph into the outputs in turn, outputLengths[i] samples into outputContexts[i].
+     The sink is outputContexts[0].filter, the last output gets what is left when the graph ends earlier.
+     outputFinished is called with the index of every output that is full and flushed, the later ones are still being written.
+     */
+    int processAll(std::vector<AVProcessContext>& inputContexts, std::vector<AVProcessContext>& outputContexts, const std::vector<int64_t>& outputLengths, FFFeedBudget* budget = NULL,
+                   const std::function<int(size_t)>& outputFinished = nullptr);
+    
+    // options for the resamplers that libavfilter inserts to satisfy the aformat filters of the graph
+    int configResampler(AVFilterGraph* graph, const std::string& swrOptions);
+    bool isSoxrAvailable();
     
     int makeInput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext*& input);
+    /*
+     If the decoder outputs fltp at a rate FFPolyphaseResampler supports for the profile rate and resampleTaps > 0,
+     the frames are resampled to the profile rate by it before they are added to the graph, see addInputFrame.
+     The source of a lazy input that isn't opened is configured from its stream.
+     */
+    int makeInput(AVFilterGraph* graph, AVProcessContext& context, const FFOutputProfile& profile, int resampleTaps);
+    int addInputFrame(AVProcessContext& context, AVFrame* frame);
     int makeOutput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext* input, AVFilterContext*& output);
-    int makeFormatForAMIX(AVFilterGraph* graph, AVFilterContext* input, AVFilterContext*& output);
-    int makeFormatForOutput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext* input, AVFilterContext*& output);
+    // the format helpers return the input as output when it's already in the wanted format and count it in removedConversions
+    int makeFormatForAMIX(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, AVFilterContext*& output, int* removedConversions = NULL);
+    int makeFormatForOutput(AVFilterGraph* graph, const AVCodecContext* codec, AVFilterContext* input, AVFilterContext*& output, int* removedConversions = NULL);
     int makePad(AVFilterGraph* graph, AVFilterContext* input, int64_t padDuration, AVFilterContext*& output);
     int makePadWhole(AVFilterGraph* graph, AVFilterContext* input, int64_t wholeDuration, AVFilterContext*& output);
     int makeTrim(AVFilterGraph* graph, AVFilterContext* input, int64_t wholeDuration, AVFilterContext*& output);
-    int makeFade(AVFilterGraph* graph, AVFilterContext* input, bool fadeOut, int64_t start, int64_t nb, AVFilterContext*& output);
-    int makeDelay(AVFilterGraph* graph, AVFilterContext* input, int64_t delayDuration, AVFilterContext*& output);
+    // keeps the samples [start, end) and moves them to 0
+    int makeTrimRange(AVFilterGraph* graph, AVFilterContext* input, int64_t start, int64_t end, AVFilterContext*& output);
+    // silent source of the given samples, in the format of makeFormatForAMIX
+    int makeSilenceForAMIX(AVFilterGraph* graph, const FFOutputProfile& profile, int64_t duration, AVFilterContext*& output, int* removedConversions = NULL);
+    // a linear fade from start over nb samples, an 8.8 volume ramp stepped per frame for the fixed point profile
+    int makeFade(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, bool fadeOut, int64_t start, int64_t nb, AVFilterContext*& output);
+    int makeDelay(AVFilterGraph* graph, AVFilterContext* input, int64_t delayDuration, int sampleRate, AVFilterContext*& output);
     int makeVolume(AVFilterGraph* graph, AVFilterContext* input, double volume, AVFilterContext*& output);
+    // the volume expression is evaluated for every frame, t is the time of the frame in seconds
+    int makeVolumeExpression(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, const std::string& expression, AVFilterContext*& output);
+    /*
+     The fixed point profile has no kernels of its own, it uses the integer code of the filters: pan is rematrixed
+     by swresample in Q15 with saturation, the volume expressions and the fades run in 8.8.
+     benchmark/FFFixedPointBenchmark.cpp measures the error against the float path and the speed of that arithmetic.
+     */
+    // a volume filter, or a Q15 pan of the channels for the fixed point profile which saturates instead of wrapping
+    int makeGain(AVFilterGraph* graph, const FFOutputProfile& profile, AVFilterContext* input, double gain, AVFilterContext*& output);
+    // sums gains[i] times input i in Q15 for the fixed point profile, the inputs must be equally long, see makePadWhole
+    int makeMixFixed(AVFilterGraph* graph, const FFOutputProfile& profile, const std::vector<AVFilterContext*>& inputs, const std::vector<double>& gains, AVFilterContext*& output);
     int makeSplit(AVFilterGraph* graph, AVFilterContext* input, int count, std::vector<AVFilterContext*>& outputs);
-    int makeMix(AVFilterGraph* graph, const std::vector<AVFilterContext*>& inputs, AVFilterContext*& output);
+    // the mix lasts as long as the longest input, or as the first input with untilFirstEnds
+    int makeMix(AVFilterGraph* graph, const std::vector<AVFilterContext*>& inputs, AVFilterContext*& output, bool untilFirstEnds = false);
     int makeConcat(AVFilterGraph* graph, const std::vector<AVFilterContext*>& inputs, AVFilterContext*& output);
     int makeLoudNorm(AVFilterGraph* graph, AVFilterContext* input, AVFilterContext*& output);
     
     int configInputFilter(AVFilterContext* filter, const AVCodecContext* codec);
+    int configInputFilter(AVFilterContext* filter, const FFStreamInfo& stream);
     int configInputFilter(AVFilterContext* filter, AVSampleFormat sampleFormat, int sampleRate, int  channels);
-    int configInputFilterForAmix(AVFilterContext* filter);
+    int configInputFilterForAmix(AVFilterContext* filter, const FFOutputProfile& profile);
     int configFormatFilter(AVFilterContext* filter, const AVCodecContext* codec);
-    int configFormatFilterForAmix(AVFilterContext* filter);
+    int configFormatFilterForAmix(AVFilterContext* filter, const FFOutputProfile& profile);
     
     bool packetIsID3(const AVPacket* packet);
 }
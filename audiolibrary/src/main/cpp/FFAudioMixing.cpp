@@ -11,18 +11,75 @@
 #include <vector>
 #include <tuple>
 #include <sstream>
+#include <iomanip>
 #include <cassert>
 #include <memory>
 #include <algorithm>
 
 #include "FFAudioMixing.hpp"
 #include "FFAudioHelper.hpp"
+#include "FFMediaCache.hpp"
+#include "FFSilenceDetector.hpp"
+
 
 using namespace FFAudioHelper;
 
 namespace
 {
-    const int64_t MAX_EFFECT_DURATION = (15 * outputSampleRate);
+    const double MAX_EFFECT_DURATION_SEC = 15;
+    const double EFFECT_FADE_DURATION_SEC = 5;
+    
+    // decoded around the part of a clip that is heard, the resamplers see the same neighbour samples as in a whole render
+    const double RANGE_MARGIN_SEC = 0.1;
+    
+    // content hash of the file, with the clip of it, empty if it can't be read
+    std::string getClipHash(const std::string& file)
+    {
+        std::string path;
+        double startTime = 0, endTime = -1;
+        if (!parseClip(file, path, startTime, endTime))
+            return FFMediaCache::hashFile(file);
+        
+        std::string hash = FFMediaCache::hashFile(path);
+        if (hash.empty())
+            return hash;
+        
+        std::ostringstream clip;
+        clip << hash << CLIP_FRAGMENT << std::setprecision(17) << startTime << ',' << endTime;
+        return clip.str();
+    }
+    
+    // libswresample options of the resamplers auto inserted for the aformat filters, src/benchmark measures them
+    std::string getResampleOptions(FFResampleProfile profile)
+    {
+        switch (profile)
+        {
+            case FF_RESAMPLE_FAST:
+                return "filter_size=8:phase_shift=5:linear_interp=0:cutoff=0.9";
+            case FF_RESAMPLE_HIGH_QUALITY:
+                if (isSoxrAvailable())
+                    return "resampler=soxr:precision=28";
+                return "filter_size=64:phase_shift=12:linear_interp=1:cutoff=0.97";
+            case FF_RESAMPLE_BALANCED:
+            default:
+                return "filter_size=32:phase_shift=10:linear_interp=0";
+        }
+    }
+    
+    // taps of the native resampler for the common input rates, 0 leaves these rates to libswresample too
+    int getResampleTaps(FFResampleProfile profile)
+    {
+        switch (profile)
+        {
+            case FF_RESAMPLE_FAST:
+                return 16;
+            case FF_RESAMPLE_HIGH_QUALITY:
+                return 0;
+            case FF_RESAMPLE_BALANCED:
+            default:
+                return 32;
+        }
+    }
 }
 
 namespace
@@ -41,15 +98,81 @@ namespace
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+FFAudioMixingOptions::FFAudioMixingOptions()
+: outputProfile()
+, trackAllocations(false)
+, resampleProfile(FF_RESAMPLE_BALANCED)
+, cacheMaxBytes(256 * 1024 * 1024)
+, encoderPreset("default")
+, trimSilence(false)
+, silenceThresholdDb(-45)
+, silenceMarginSec(0.2)
+, backgroundSwellGain(1)
+, backgroundRampSec(0.8)
+, maxFramesPerInput(128)
+, maxQueuedMs(0)
+, checkpointMaxBytes(1024 * 1024 * 1024)
+, keepCheckpoints(false)
+{
+    
+}
+
+FFJobStats::FFJobStats()
+: conversionsRemoved(0)
+, segmentsRendered(0)
+, segmentsReused(0)
+, peakQueuedBytes(0)
+{
+    
+}
+
+FFTimelineClip::FFTimelineClip()
+: offsetSec(0)
+, startSec(0)
+, durationSec(-1)
+, gain(1)
+, fadeInSec(0)
+, fadeOutSec(0)
+, loop(false)
+{
+    
+}
+
+FFTimelineTrack::FFTimelineTrack()
+: gain(1)
+{
+    
+}
+
+FFTimeline::FFTimeline()
+: durationSec(-1)
+{
+    
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------------------
+
 class FFAudioMixing : virtual public IFFAudioMixing
 {
 public:
     std::string _outputFileType;
     int _outputBitRate;
+    FFAudioMixingOptions _options;
+    FFJobStats _jobStats;
+    std::string _codecOptions;      // preset and encoder options for openOutputFile
+    FFFeedBudget _feedBudget;       // of the memory options, it keeps the peak queue of the job
+    
+    // in samples of the profile rate
+    int64_t _maxEffectDuration;
+    int64_t _effectFadeDuration;
+    int64_t _rangeMargin;
     
 public:
     FFAudioMixing()
     : _outputBitRate(0)
+    , _maxEffectDuration(0)
+    , _effectFadeDuration(0)
+    , _rangeMargin(0)
     {
         
     }
@@ -59,74 +182,73 @@ public:
         
     }
     
-    virtual void init(const char* outputFileType, const int outputBitRate)
+    virtual int init(const char* outputFileType, const int outputBitRate, const FFAudioMixingOptions& options)
     {
+        int err = 0;
         _outputFileType = outputFileType;
         _outputBitRate = outputBitRate;
+        _options = options;
+        
+        const FFOutputProfile& profile = _options.outputProfile;
+        _maxEffectDuration  = profile.samples(MAX_EFFECT_DURATION_SEC);
+        _effectFadeDuration = profile.samples(EFFECT_FADE_DURATION_SEC);
+        _rangeMargin        = profile.samples(RANGE_MARGIN_SEC);
+        
+        _feedBudget = FFFeedBudget();
+        _feedBudget.maxFramesPerInput = std::max(_options.maxFramesPerInput, 1);
+        _feedBudget.maxQueuedSamples  = profile.samples(std::max(_options.maxQueuedMs, 0) / 1000.0);
+        _feedBudget.sampleRate        = profile.sampleRate;
+        _feedBudget.frameBytes        = profile.channels * av_get_bytes_per_sample(profile.sampleFormat);
+        
+        ERROR_CHECKEX(getEncoderPresetOptions(_options.encoderPreset, _outputFileType, _codecOptions), err = AVERROR(EINVAL));
+        addEncoderOptions(_options.encoderOptions, _codecOptions);
+        
+    Exit0:
+        return err;
     }
     
     virtual void destroy()
     {
         delete this;
     }
+    
+    virtual const FFJobStats& jobStats() const
+    {
+        return _jobStats;
+    }
 
     virtual int mixAudio(const std::string& inputFile1, const std::string inputFile2, const std::string& outputFile)
+    {
+        std::vector<std::string> inputFiles;
+        inputFiles.push_back(inputFile1);
+        inputFiles.push_back(inputFile2);
+        return mixAudios(inputFiles, std::vector<double>(), outputFile);
+    }
+    
+    virtual int mixAudios(const std::vector<std::string>& inputFiles, const std::vector<double>& inputGains, const std::string& outputFile)
     {
         int err = 0;
         {
             FFAutoReleasePool pool;
+            _beginJob(pool);
             
-            // open input file 1
-            int64_t duration1 = 0;
-            err = getFileDuration(inputFile1, duration1);
-            AV_ERROR_CHECK(err);
-            
-            AVFormatContext* inputFormat1 = NULL;
-            pool.autoRelease([&inputFormat1]
-                             {
-                                 if (inputFormat1)
-                                     avformat_close_input(&inputFormat1);
-                             });
-            
-            AVCodecContext* inputCodec1 = NULL;
-            pool.autoRelease([&inputCodec1]
-                             {
-                                 if (inputCodec1)
-                                 {
-                                     avcodec_close(inputCodec1);
-                                     inputCodec1 = NULL;
-                                 }
-                             });
-            
-            int inputStream1 = 0;
-            err = openInputFile(inputFile1, inputFormat1, inputCodec1, inputStream1);
-            AV_ERROR_CHECK(err);
+            ERROR_CHECKEX(inputFiles.size(), err = AVERROR(EINVAL));
             
-            // open input file 2
-            int64_t duration2 = 0;
-            err = getFileDuration(inputFile2, duration2);
+            // probe all inputs
+            std::vector<int64_t> durations;
+            err = getFileDurations(inputFiles, _options.outputProfile, durations);
             AV_ERROR_CHECK(err);
             
-            AVFormatContext* inputFormat2 = NULL;
-            pool.autoRelease([&inputFormat2]
-                             {
-                                 if (inputFormat2)
-                                     avformat_close_input(&inputFormat2);
-                             });
-            
-            AVCodecContext* inputCodec2 = NULL;
-            pool.autoRelease([&inputCodec2]
-                             {
-                                 if (inputCodec2)
-                                 {
-                                     avcodec_close(inputCodec2);
-                                     inputCodec2 = NULL;
-                                 }
-                             });
-            
-            int inputStream2 = 0;
-            err = openInputFile(inputFile2, inputFormat2, inputCodec2, inputStream2);
-            AV_ERROR_CHECK(err);
+            // every input is opened when amix first asks for it, and closed by feedInputs as soon as it's drained
+            std::vector<AVProcessContext> inputContexts;
+            for (const std::string& file : inputFiles)
+            {
+                AVProcessContext context;
+                err = makeLazyInput(file, _options.outputProfile.sampleFormat, context);
+                AV_ERROR_CHECK(err);
+                
+                inputContexts.push_back(context);
+            }
             
             // open output file
             AVFormatContext* outputFormat = NULL;
@@ -146,17 +268,14 @@ public:
                              {
                                  if (outputCodec)
                                  {
-                                     avcodec_close(outputCodec);
-                                     outputCodec = NULL;
+                                     avcodec_free_context(&outputCodec);
                                  }
                              });
             
-            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate);
+            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate, _options.outputProfile, AV_CODEC_ID_NONE, _codecOptions);
             AV_ERROR_CHECK(err);
             
             // init filter
-            AVFilterContext* inputFilter1 = NULL;
-            AVFilterContext* inputFilter2 = NULL;
             AVFilterContext* outputFilter = NULL;
             AVFilterGraph* graph = NULL;
             pool.autoRelease([&graph]
@@ -165,8 +284,9 @@ public:
                                      avfilter_graph_free(&graph);
                              });
             
-            int64_t wholeDuration = std::max(duration1, duration2) + 2 * outputSampleRate;
-            err = configFilterGraphForMixing(wholeDuration, inputCodec1, inputFilter1, inputCodec2, inputFilter2, outputCodec, outputFilter, graph);
+            int64_t wholeDuration = *std::max_element(durations.begin(), durations.end()) + _options.outputProfile.samples(2);
+            err = configFilterGraphForMixing(wholeDuration, _options.outputProfile, getResampleOptions(_options.resampleProfile), getResampleTaps(_options.resampleProfile),
+                                             inputContexts, inputGains, outputCodec, outputFilter, graph, &_jobStats.conversionsRemoved);
             AV_ERROR_CHECK(err);
             
             // write output file header
@@ -174,11 +294,7 @@ public:
             AV_ERROR_CHECK(err);
             
             // process all data
-            std::vector<AVProcessContext> inputContexts;
-            inputContexts.push_back(AVProcessContext(inputFormat1, inputCodec1, inputFilter1, inputStream1));
-            inputContexts.push_back(AVProcessContext(inputFormat2, inputCodec2, inputFilter2, inputStream2));
-            
-            err = processAll(inputContexts, AVProcessContext(outputFormat, outputCodec, outputFilter, 0));
+            err = processAll(inputContexts, AVProcessContext(outputFormat, outputCodec, outputFilter, 0), &_feedBudget);
             AV_ERROR_CHECK(err);
             
             // write trailer
@@ -190,6 +306,33 @@ public:
         return err;
     }
     
+    virtual int renderTimeline(const FFTimeline& timeline, const std::string& outputFile)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            _beginJob(pool);
+            
+            FFMediaCache assetCache(_options.cacheDir, _options.cacheMaxBytes, _jobStats.cache);
+            if (_options.cacheDir.length())
+            {
+                err = assetCache.open();
+                AV_ERROR_CHECK(err);
+            }
+            
+            TimelineLayout layout;
+            err = _makeTimelineLayout(timeline, _options.cacheDir.length() ? &assetCache : NULL, layout);
+            AV_ERROR_CHECK(err);
+            
+            err = _renderTimeline(layout, 0, -1, std::vector<std::string>(1, outputFile), std::vector<int64_t>(),
+                                  _outputFileType, _outputBitRate, AV_CODEC_ID_NONE, _options.resampleProfile);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
     virtual int combineAudios(const std::string&                beginEffect,
                               const std::string&                endEffect,
                               bool                              haveIntroPage,
@@ -201,166 +344,200 @@ public:
                               const std::string&                outputFile)
     
     {
+        // a checkpointed export keeps every mixed page in the checkpoint directory, a restarted job resumes after them
+        if (_options.checkpointDir.length())
+            return combineAudiosIncremental(beginEffect, endEffect, haveIntroPage, haveEndingPage, voicePages, timeSpanSec,
+                                            bkgMusicFile, bkgVolume, _options.checkpointDir, outputFile);
+        
         int err = 0;
         {
             FFAutoReleasePool pool;
+            _beginJob(pool);
             
-            // calculate background time range
-            int64_t timeSpan = timeSpanSec * outputSampleRate;
-            int64_t wholeDuration = 0;
-            int64_t backgroundDelayStart = 0;
-            int64_t backgroundPadEnd = 0;
-            
-            std::vector<std::string> foregroundPages;
-            
-            if (beginEffect.length())
+            FFMediaCache assetCache(_options.cacheDir, _options.cacheMaxBytes, _jobStats.cache);
+            if (_options.cacheDir.length())
             {
-                foregroundPages.push_back(beginEffect);
-                
-                int64_t duration = 0;
-                err = getFileDuration(beginEffect, duration);
+                err = assetCache.open();
                 AV_ERROR_CHECK(err);
-                duration = std::min(duration, MAX_EFFECT_DURATION);
-                
-                backgroundDelayStart += duration;
-                backgroundDelayStart += timeSpan;
             }
             
-            if (haveIntroPage)
+            CombineLayout layout;
+            err = _makeCombineLayout(beginEffect, endEffect, haveIntroPage, haveEndingPage, voicePages, timeSpanSec, bkgMusicFile, bkgVolume,
+                                     _options.cacheDir.length() ? &assetCache : NULL, layout);
+            AV_ERROR_CHECK(err);
+            
+            TimelineLayout timeline;
+            _makeCombineTimeline(layout, timeline);
+            
+            err = _renderTimeline(timeline, 0, -1, std::vector<std::string>(1, outputFile), std::vector<int64_t>(),
+                                  _outputFileType, _outputBitRate, AV_CODEC_ID_NONE, _options.resampleProfile);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    virtual int previewCombineAudios(const std::string&                beginEffect,
+                                     const std::string&                endEffect,
+                                     bool                              haveIntroPage,
+                                     bool                              haveEndingPage,
+                                     const std::vector<std::string>&   voicePages,
+                                     double                            timeSpanSec,
+                                     const std::string&                bkgMusicFile,
+                                     double                            bkgVolume,
+                                     double                            previewStartSec,
+                                     double                            previewDurationSec,
+                                     const std::string&                outputFile)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            _beginJob(pool);
+            
+            FFMediaCache assetCache(_options.cacheDir, _options.cacheMaxBytes, _jobStats.cache);
+            if (_options.cacheDir.length())
             {
-                std::string introPage = *voicePages.begin();
-                int64_t duration = 0;
-                err = getFileDuration(introPage, duration);
+                err = assetCache.open();
                 AV_ERROR_CHECK(err);
-                backgroundDelayStart += duration;
-                backgroundDelayStart += timeSpan;
             }
             
-            if (haveEndingPage)
+            CombineLayout layout;
+            err = _makeCombineLayout(beginEffect, endEffect, haveIntroPage, haveEndingPage, voicePages, timeSpanSec, bkgMusicFile, bkgVolume,
+                                     _options.cacheDir.length() ? &assetCache : NULL, layout);
+            AV_ERROR_CHECK(err);
+            
+            TimelineLayout timeline;
+            _makeCombineTimeline(layout, timeline);
+            
+            int64_t windowStart = _options.outputProfile.samples(std::max(previewStartSec, 0.));
+            int64_t windowEnd = windowStart + _options.outputProfile.samples(std::max(previewDurationSec, 0.));
+            err = _renderTimeline(timeline, windowStart, windowEnd, std::vector<std::string>(1, outputFile), std::vector<int64_t>(),
+                                  PREVIEW_FILE_TYPE, 0, AV_CODEC_ID_NONE, FF_RESAMPLE_FAST);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    virtual int combineAudiosIncremental(const std::string&                beginEffect,
+                                         const std::string&                endEffect,
+                                         bool                              haveIntroPage,
+                                         bool                              haveEndingPage,
+                                         const std::vector<std::string>&   voicePages,
+                                         double                            timeSpanSec,
+                                         const std::string&                bkgMusicFile,
+                                         double                            bkgVolume,
+                                         const std::string&                segmentCacheDir,
+                                         const std::string&                outputFile)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            _beginJob(pool);
+            
+            FFMediaCache assetCache(_options.cacheDir, _options.cacheMaxBytes, _jobStats.cache);
+            if (_options.cacheDir.length())
             {
-                std::string endingPage = *voicePages.rbegin();
-                int64_t duration = 0;
-                err = getFileDuration(endingPage, duration);
+                err = assetCache.open();
                 AV_ERROR_CHECK(err);
-                backgroundPadEnd += duration;
             }
             
-            foregroundPages.insert(foregroundPages.end(), voicePages.begin(), voicePages.end());
+            CombineLayout layout;
+            err = _makeCombineLayout(beginEffect, endEffect, haveIntroPage, haveEndingPage, voicePages, timeSpanSec, bkgMusicFile, bkgVolume,
+                                     _options.cacheDir.length() ? &assetCache : NULL, layout);
+            AV_ERROR_CHECK(err);
+            
+            TimelineLayout timeline;
+            _makeCombineTimeline(layout, timeline);
             
-            if (endEffect.length())
+            // the segments of an export are not evicted by the assets of the next job
+            FFMediaCache segmentCache(segmentCacheDir, _options.checkpointMaxBytes, _jobStats.cache);
+            err = segmentCache.open();
+            AV_ERROR_CHECK(err);
+            
+            // every page span is a segment, keyed by everything that is mixed into it
+            std::vector<std::string> segmentKeys;
+            std::vector<std::string> segmentFiles;
+            std::vector<int64_t> segmentPositions;
+            std::vector<bool> segmentReady;
+            int64_t position = 0;
+            for (int i = 0; i < layout.foregroundPages.size(); ++i)
             {
-                foregroundPages.push_back(endEffect);
-                
-                int64_t duration = 0;
-                err = getFileDuration(endEffect, duration);
-                AV_ERROR_CHECK(err);
-                duration = std::min(duration, MAX_EFFECT_DURATION);
+                std::string key = _makeSegmentKey(layout, i, position);
+                std::string file;
+                bool ready = segmentCache.lookup(key, file);
                 
-                backgroundPadEnd += timeSpan;
-                backgroundPadEnd += duration;
+                segmentKeys.push_back(key);
+                segmentFiles.push_back(file);
+                segmentPositions.push_back(position);
+                segmentReady.push_back(ready);
+                position += layout.foregroundLengths[i];
             }
             
-            // open input file
-            AVCombineQueueContext foregroundQueue;
-            for (std::string file : foregroundPages)
+            // render every run of missing segments with one window, the background before the run is decoded
+            // again so that the loop and the fades are the same as in a whole render
+            for (int i = 0; i < segmentFiles.size();)
             {
-                int64_t duration = 0;
-                err = getFileDuration(file, duration);
-                AV_ERROR_CHECK(err);
-                
-                wholeDuration += duration;
-                wholeDuration += timeSpan;
-                
-                AVFormatContext* format = NULL;
-                AVCodecContext* codec = NULL;
-                int streamIndex = 0;
-                err = openInputFile(file, format, codec, streamIndex);
-                if (format)
+                if (segmentReady[i])
                 {
-                    pool.autoRelease([=] {
-                        AVFormatContext* f = format;
-                        avformat_close_input(&f);
-                    });
+                    ++_jobStats.segmentsReused;
+                    ++i;
+                    continue;
                 }
-                if (codec)
+                
+                std::vector<std::string> partFiles;
+                std::vector<int64_t> partLengths;
+                int end = i;
+                for (; end < segmentFiles.size() && !segmentReady[end]; ++end)
                 {
-                    pool.autoRelease([=]{
-                        avcodec_close(codec);
-                    });
+                    partFiles.push_back(segmentCache.getTempPath(segmentKeys[end]));
+                    partLengths.push_back(layout.foregroundLengths[end]);
                 }
-                AV_ERROR_CHECK(err);
                 
-                foregroundQueue.inputQueue.push_back(std::make_shared<AVProcessContext>(format, codec, (AVFilterContext*)NULL, streamIndex));
-            }
-            wholeDuration -= timeSpan;
-            
-            AVCombineQueueContext backgroundQueue;
-            int64_t backgroundDuration = 0;
-            int64_t backgroundTrimEnd = 0;
-            if (bkgMusicFile.length())
-            {
-                err = getFileDuration(bkgMusicFile, backgroundDuration);
-                AV_ERROR_CHECK(err);
+                // every segment is committed as soon as it's written, a job that is killed resumes after the last one
+                int committed = i;
+                auto commitSegment = [this, &segmentCache, &segmentKeys, &segmentFiles, &committed, i](size_t index)
+                {
+                    int j = i + (int)index;
+                    int err = segmentCache.commit(segmentKeys[j], segmentFiles[j]);
+                    if (err >= 0)
+                    {
+                        committed = j + 1;
+                        ++_jobStats.segmentsRendered;
+                    }
+                    return err;
+                };
                 
-                int64_t backgroundWholeDuration = wholeDuration - backgroundDelayStart - backgroundPadEnd;
-                backgroundTrimEnd = backgroundDuration - backgroundWholeDuration % backgroundDuration;
+                int64_t windowStart = segmentPositions[i];
+                int64_t windowEnd = segmentPositions[end - 1] + layout.foregroundLengths[end - 1];
+                err = _renderTimeline(timeline, windowStart, windowEnd, partFiles, partLengths,
+                                      FFMediaCache::ENTRY_FILE_TYPE, 0, _getCacheCodec(), _options.resampleProfile, commitSegment);
                 
-                int backgroundSegments = ceil((double)backgroundWholeDuration / backgroundDuration);
-                for (int i = 0; i < backgroundSegments; ++i)
+                // the last segment is closed with the render
+                for (int j = committed; err >= 0 && j < end; ++j)
+                    err = commitSegment(j - i);
+                // the partial segment of the failed render is removed with the ones not started
+                if (err < 0)
                 {
-                    AVFormatContext* backgroundFormat = NULL;
-                    AVCodecContext* backgroundCodec = NULL;
-                    int backgroundStreamIndex = 0;
-                    err = openInputFile(bkgMusicFile, backgroundFormat, backgroundCodec, backgroundStreamIndex);
-                    AV_ERROR_CHECK(err);
-                    
-                    backgroundQueue.inputQueue.push_back(std::make_shared<AVProcessContext>(backgroundFormat, backgroundCodec, (AVFilterContext*)NULL, backgroundStreamIndex));
+                    for (int j = committed; j < end; ++j)
+                        segmentCache.discard(segmentKeys[j]);
                 }
+                AV_ERROR_CHECK(err);
+                
+                i = end;
             }
             
-            // open output file
-            AVFormatContext* outputFormat = NULL;
-            AVCodecContext* outputCodec = NULL;
-            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate);
-            if (outputFormat)
-            {
-                pool.autoRelease([=] {
-                    if (outputFormat->pb)
-                        avio_closep(&outputFormat->pb);
-                    avformat_free_context(outputFormat);
-                });
-            }
-            if (outputCodec)
-            {
-                pool.autoRelease([=] {
-                    avcodec_close(outputCodec);
-                });
-            }
-            AV_ERROR_CHECK(err);
-            AVProcessContext outputContext(outputFormat, outputCodec, NULL, 0);
-            
-            // init filter
-            err = _configFilterGraphForCombineQueues(pool, foregroundQueue, beginEffect.length(), endEffect.length(), timeSpan,
-                                                    backgroundQueue, backgroundDuration, backgroundDelayStart, backgroundTrimEnd, backgroundPadEnd, bkgVolume,
-                                                    outputContext);
-            AV_ERROR_CHECK(err);
-            
-            // write output file header
-            err = avformat_write_header(outputFormat, NULL);
-            AV_ERROR_CHECK(err);
-            
-            // process all data
-            std::vector<AVCombineQueueContext> inputQueues;
-            inputQueues.push_back(foregroundQueue);
-            if (backgroundQueue.inputQueue.size())
-                inputQueues.push_back(backgroundQueue);
-            
-            err = _processAllCombineQueues(inputQueues, outputContext);
+            err = _encodeSegments(segmentFiles, outputFile);
             AV_ERROR_CHECK(err);
             
-            // write trailer
-            err = av_write_trailer(outputFormat);
-            AV_ERROR_CHECK(err);
+            // a finished export isn't resumed, its segments only matter to a caller that edits and exports again
+            if (!_options.keepCheckpoints)
+            {
+                for (const std::string& key : segmentKeys)
+                    segmentCache.remove(key);
+            }
         }
         
     Exit0:
@@ -372,39 +549,30 @@ public:
         int err = 0;
         {
             FFAutoReleasePool pool;
+            _beginJob(pool);
             
-            int64_t timeSpan = timeSpanSec * outputSampleRate;
+            int64_t timeSpan = _options.outputProfile.samples(timeSpanSec);
+            
+            std::vector<std::string> pages;
+            err = _trimPages(audios, pages);
+            AV_ERROR_CHECK(err);
             
             // open input file
             std::vector<AVProcessContext> inputContexts;
-            for (std::string file : audios)
+            for (std::string file : pages)
             {
-                AVFormatContext* format = NULL;
-                AVCodecContext* codec = NULL;
-                int streamIndex = 0;
-                err = openInputFile(file, format, codec, streamIndex);
-                if (format)
-                {
-                    pool.autoRelease([=] {
-                        AVFormatContext* f = format;
-                        avformat_close_input(&f);
-                    });
-                }
-                if (codec)
-                {
-                    pool.autoRelease([=]{
-                        avcodec_close(codec);
-                    });
-                }
+                // every page is opened when the concat reaches it and closed when it ends
+                AVProcessContext context;
+                err = makeLazyInput(file, getOutputSampleFormat(_outputFileType), context);
                 AV_ERROR_CHECK(err);
                 
-                inputContexts.push_back(AVProcessContext(format, codec, NULL, streamIndex));
+                inputContexts.push_back(context);
             }
             
             // open output file
             AVFormatContext* outputFormat = NULL;
             AVCodecContext* outputCodec = NULL;
-            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate);
+            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate, _options.outputProfile, AV_CODEC_ID_NONE, _codecOptions);
             if (outputFormat)
             {
                 pool.autoRelease([=] {
@@ -416,7 +584,8 @@ public:
             if (outputCodec)
             {
                 pool.autoRelease([=] {
-                    avcodec_close(outputCodec);
+                    AVCodecContext* c = outputCodec;
+                    avcodec_free_context(&c);
                 });
             }
             AV_ERROR_CHECK(err);
@@ -431,14 +600,17 @@ public:
                                  avfilter_graph_free(&g);
                              });
             
+            err = configResampler(graph, getResampleOptions(_options.resampleProfile));
+            AV_ERROR_CHECK(err);
+            
             std::vector<AVFilterContext*> filtersForConcat;
             for (auto it = inputContexts.begin(); it != inputContexts.end(); ++it)
             {
                 AVProcessContext& context = *it;
-                err = makeInput(graph, context.codec, context.filter);
+                err = makeInput(graph, context, _options.outputProfile, getResampleTaps(_options.resampleProfile));
                 AV_ERROR_CHECK(err);
                 
-                err = makeFormatForOutput(graph, outputContext.codec, context.filter, context.lastFilter);
+                err = makeFormatForOutput(graph, outputContext.codec, context.filter, context.lastFilter, &_jobStats.conversionsRemoved);
                 AV_ERROR_CHECK(err);
                 
                 // pad blank span
@@ -453,7 +625,7 @@ public:
             
             err = makeConcat(graph, filtersForConcat, outputContext.filter);
             AV_ERROR_CHECK(err);
-            err = makeFormatForOutput(graph, outputContext.codec, outputContext.filter, outputContext.filter);
+            err = makeFormatForOutput(graph, outputContext.codec, outputContext.filter, outputContext.filter, &_jobStats.conversionsRemoved);
             AV_ERROR_CHECK(err);
             err = makeOutput(graph, outputContext.codec, outputContext.filter, outputContext.filter);
             AV_ERROR_CHECK(err);
@@ -466,7 +638,7 @@ public:
             AV_ERROR_CHECK(err);
             
             // process all data
-            err = processAll(inputContexts, outputContext);
+            err = processAll(inputContexts, outputContext, &_feedBudget);
             AV_ERROR_CHECK(err);
             
             // write trailer
@@ -483,32 +655,17 @@ public:
         int err = 0;
         {
             FFAutoReleasePool pool;
+            _beginJob(pool);
             
             // open input file
-            AVFormatContext* format = NULL;
-            AVCodecContext* codec   = NULL;
-            int streamIndex         = 0;
-            err = openInputFile(inputFile, format, codec, streamIndex);
-            if (format)
-            {
-                pool.autoRelease([=] {
-                    AVFormatContext* f = format;
-                    avformat_close_input(&f);
-                });
-            }
-            if (codec)
-            {
-                pool.autoRelease([=]{
-                    avcodec_close(codec);
-                });
-            }
+            AVProcessContext inputContext;
+            err = _openInput(pool, inputFile, inputContext, AV_SAMPLE_FMT_NONE);
             AV_ERROR_CHECK(err);
-            AVProcessContext inputContext(format, codec, NULL, streamIndex);
             
             // open output file
             AVFormatContext* outputFormat = NULL;
             AVCodecContext* outputCodec = NULL;
-            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate);
+            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate, _options.outputProfile, AV_CODEC_ID_NONE, _codecOptions);
             if (outputFormat)
             {
                 pool.autoRelease([=] {
@@ -520,7 +677,8 @@ public:
             if (outputCodec)
             {
                 pool.autoRelease([=] {
-                    avcodec_close(outputCodec);
+                    AVCodecContext* c = outputCodec;
+                    avcodec_free_context(&c);
                 });
             }
             AV_ERROR_CHECK(err);
@@ -535,13 +693,16 @@ public:
                                  avfilter_graph_free(&g);
                              });
             
-            err = makeInput(graph, inputContext.codec, inputContext.filter);
+            err = configResampler(graph, getResampleOptions(_options.resampleProfile));
+            AV_ERROR_CHECK(err);
+            
+            err = makeInput(graph, inputContext, _options.outputProfile, getResampleTaps(_options.resampleProfile));
             AV_ERROR_CHECK(err);
             
             err = makeLoudNorm(graph, inputContext.filter, inputContext.lastFilter);
             AV_ERROR_CHECK(err);
             
-            err = makeFormatForOutput(graph, outputContext.codec, inputContext.lastFilter, inputContext.lastFilter);
+            err = makeFormatForOutput(graph, outputContext.codec, inputContext.lastFilter, inputContext.lastFilter, &_jobStats.conversionsRemoved);
             AV_ERROR_CHECK(err);
             
             err = makeOutput(graph, outputContext.codec, inputContext.lastFilter, outputContext.filter);
@@ -557,7 +718,7 @@ public:
             // process all data
             std::vector<AVProcessContext> inputs;
             inputs.push_back(inputContext);
-            err = processAll(inputs, outputContext);
+            err = processAll(inputs, outputContext, &_feedBudget);
             AV_ERROR_CHECK(err);
             
             // write trailer
@@ -574,32 +735,17 @@ public:
         int err = 0;
         {
             FFAutoReleasePool pool;
+            _beginJob(pool);
             
             // open input file
-            AVFormatContext* format = NULL;
-            AVCodecContext* codec   = NULL;
-            int streamIndex         = 0;
-            err = openInputFile(inputFile, format, codec, streamIndex);
-            if (format)
-            {
-                pool.autoRelease([=] {
-                    AVFormatContext* f = format;
-                    avformat_close_input(&f);
-                });
-            }
-            if (codec)
-            {
-                pool.autoRelease([=]{
-                    avcodec_close(codec);
-                });
-            }
+            AVProcessContext inputContext;
+            err = _openInput(pool, inputFile, inputContext, getOutputSampleFormat(_outputFileType));
             AV_ERROR_CHECK(err);
-            AVProcessContext inputContext(format, codec, NULL, streamIndex);
             
             // open output file
             AVFormatContext* outputFormat = NULL;
             AVCodecContext* outputCodec = NULL;
-            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate);
+            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate, _options.outputProfile, AV_CODEC_ID_NONE, _codecOptions);
             if (outputFormat)
             {
                 pool.autoRelease([=] {
@@ -611,7 +757,8 @@ public:
             if (outputCodec)
             {
                 pool.autoRelease([=] {
-                    avcodec_close(outputCodec);
+                    AVCodecContext* c = outputCodec;
+                    avcodec_free_context(&c);
                 });
             }
             AV_ERROR_CHECK(err);
@@ -626,10 +773,13 @@ public:
                                  avfilter_graph_free(&g);
                              });
             
-            err = makeInput(graph, inputContext.codec, inputContext.filter);
+            err = configResampler(graph, getResampleOptions(_options.resampleProfile));
+            AV_ERROR_CHECK(err);
+            
+            err = makeInput(graph, inputContext, _options.outputProfile, getResampleTaps(_options.resampleProfile));
             AV_ERROR_CHECK(err);
             
-            err = makeFormatForOutput(graph, outputContext.codec, inputContext.filter, inputContext.lastFilter);
+            err = makeFormatForOutput(graph, outputContext.codec, inputContext.filter, inputContext.lastFilter, &_jobStats.conversionsRemoved);
             AV_ERROR_CHECK(err);
             
             err = makeOutput(graph, outputContext.codec, inputContext.lastFilter, outputContext.filter);
@@ -645,7 +795,7 @@ public:
             // process all data
             std::vector<AVProcessContext> inputs;
             inputs.push_back(inputContext);
-            err = processAll(inputs, outputContext);
+            err = processAll(inputs, outputContext, &_feedBudget);
             AV_ERROR_CHECK(err);
             
             // write trailer
@@ -658,121 +808,501 @@ public:
     }
     
 private:
-    int _configFilterGraphForCombineQueues(FFAutoReleasePool& pool,
-                                           AVCombineQueueContext& forcegroundQueue,
-                                           bool haveBeginEffect,
-                                           bool haveEndEffect,
-                                           int64_t timeSpan,
-                                           AVCombineQueueContext& backgroundQueue,
-                                           int64_t backgroundDuration,
-                                           int64_t backgroundDelayStart,
-                                           int64_t backgroundTrimEnd,
-                                           int64_t backgroundPadEnd,
-                                           double backgroundvolume,
-                                           AVProcessContext& outputContext)
+    // where the pages and the background copies are on the timeline, in samples
+    struct CombineLayout
     {
-        int err = 0;
+        std::vector<std::string>    foregroundPages;
+        std::vector<int64_t>        foregroundLengths;      // page and the time span behind it
+        bool                        haveBeginEffect;
+        int64_t                     timeSpan;
+        std::string                 backgroundFile;
+        std::vector<int64_t>        backgroundLengths;      // every background copy, with the delay and the pad
+        int64_t                     backgroundDuration;
+        int64_t                     backgroundDelayStart;
+        int64_t                     backgroundTrimEnd;
+        int64_t                     backgroundPadEnd;
+        double                      backgroundVolume;
+        
+        CombineLayout()
+        : haveBeginEffect(false)
+        , timeSpan(0)
+        , backgroundDuration(0)
+        , backgroundDelayStart(0)
+        , backgroundTrimEnd(0)
+        , backgroundPadEnd(0)
+        , backgroundVolume(0)
         {
-            // config forceground input queue
-            for (auto it = forcegroundQueue.inputQueue.begin(); it != forcegroundQueue.inputQueue.end(); ++it)
-            {
-                std::shared_ptr<AVProcessContext> context = *it;
-                
-                AVFilterGraph* graph = avfilter_graph_alloc();
-                ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
-                context->pool.autoRelease([=]
-                                          {
-                                              AVFilterGraph* g = graph;
-                                              avfilter_graph_free(&g);
-                                          });
-                
-                err = makeInput(graph, context->codec, context->filter);
-                AV_ERROR_CHECK(err);
-                
-                err = makeFormatForAMIX(graph, context->filter, context->lastFilter);
-                AV_ERROR_CHECK(err);
-                
-                // trim begin effect
-                if (haveBeginEffect && (it == forcegroundQueue.inputQueue.begin()))
-                {
-                    err = makeTrim(graph, context->lastFilter, MAX_EFFECT_DURATION, context->lastFilter);
-                    AV_ERROR_CHECK(err);
-                    
-                    uint64_t fadeDuration = 5 * outputSampleRate;
-                    err = makeFade(graph, context->lastFilter, true, MAX_EFFECT_DURATION - fadeDuration, fadeDuration, context->lastFilter);
-                    AV_ERROR_CHECK(err);
-                }
-                
-                // pad blank span
-                if (it != forcegroundQueue.inputQueue.end())
-                {
-                    err = makePad(graph, context->lastFilter, timeSpan, context->lastFilter);
-                    AV_ERROR_CHECK(err);
-                }
-                
-                err = makeOutput(graph, NULL, context->lastFilter, context->lastFilter);
+            
+        }
+    };
+    
+    // a part of a track that is decoded from one file, in samples of the profile rate
+    struct TimelinePiece
+    {
+        std::string     file;
+        int64_t         position;       // on the timeline
+        int64_t         mediaStart;     // in the file, or in the clip of it
+        int64_t         length;
+        bool            padded;         // the file ends before the piece, the rest is silence
+        double          gain;
+        int64_t         fadeIn;
+        int64_t         fadeOutStart;   // from the start of the piece
+        int64_t         fadeOut;        // 0 without a fade out
+        
+        TimelinePiece()
+        : position(0)
+        , mediaStart(0)
+        , length(0)
+        , padded(false)
+        , gain(1)
+        , fadeIn(0)
+        , fadeOutStart(0)
+        , fadeOut(0)
+        {
+            
+        }
+    };
+    
+    // every track is a list of pieces in timeline order, the gaps between them are silence
+    struct TimelineLayout
+    {
+        std::vector<std::vector<TimelinePiece>> tracks;
+        std::vector<std::vector<TimelinePiece>> trackSwells;    // the voice pieces a track swells between, see _makeSwellGain
+        int64_t                                 duration;
+        
+        TimelineLayout()
+        : duration(0)
+        {
+            
+        }
+    };
+    
+    // reset the job statistics, they are collected when the job pool is released
+    void _beginJob(FFAutoReleasePool& pool)
+    {
+        _jobStats = FFJobStats();
+        
+        _feedBudget.peakQueuedBytes = 0;
+        pool.autoRelease([this]
+                         {
+                             _jobStats.peakQueuedBytes = _feedBudget.peakQueuedBytes;
+                         });
+        
+        if (_options.trackAllocations)
+        {
+            FFAllocTracker::begin();
+            pool.autoRelease([this]
+                             {
+                                 FFAllocTracker::end(_jobStats.alloc);
+                             });
+        }
+    }
+    
+    int _makeCombineLayout(const std::string&                beginEffect,
+                           const std::string&                endEffect,
+                           bool                              haveIntroPage,
+                           bool                              haveEndingPage,
+                           const std::vector<std::string>&   voicePages,
+                           double                            timeSpanSec,
+                           const std::string&                bkgMusicFile,
+                           double                            bkgVolume,
+                           FFMediaCache*                     assetCache,
+                           CombineLayout&                    layout)
+    {
+        int err = 0;
+        {
+            // the effects and the background are shared by many jobs, they are decoded once into the asset cache
+            std::string beginEffectFile;
+            err = _resolveAsset(assetCache, beginEffect, beginEffectFile);
+            AV_ERROR_CHECK(err);
+            
+            std::string endEffectFile;
+            err = _resolveAsset(assetCache, endEffect, endEffectFile);
+            AV_ERROR_CHECK(err);
+            
+            err = _resolveAsset(assetCache, bkgMusicFile, layout.backgroundFile);
+            AV_ERROR_CHECK(err);
+            
+            layout.haveBeginEffect = beginEffect.length();
+            layout.timeSpan = _options.outputProfile.samples(timeSpanSec);
+            layout.backgroundVolume = bkgVolume;
+            
+            int64_t timeSpan = layout.timeSpan;
+            int64_t wholeDuration = 0;
+            
+            std::vector<std::string> pages;
+            err = _trimPages(voicePages, pages);
+            AV_ERROR_CHECK(err);
+            
+            // calculate foreground layout
+            std::vector<std::string>& foregroundPages = layout.foregroundPages;
+            if (beginEffect.length())
+                foregroundPages.push_back(beginEffectFile);
+            foregroundPages.insert(foregroundPages.end(), pages.begin(), pages.end());
+            if (endEffect.length())
+                foregroundPages.push_back(endEffectFile);
+            
+            std::vector<int64_t> foregroundDurations;
+            for (int i = 0; i < foregroundPages.size(); ++i)
+            {
+                // only the start of the begin effect is used
+                int64_t duration = 0;
+                err = getFileDuration(foregroundPages[i], _options.outputProfile, duration, (beginEffect.length() && !i) ? _maxEffectDuration : -1);
                 AV_ERROR_CHECK(err);
                 
-                err = avfilter_graph_config(graph, NULL);
-                AV_ERROR_CHECK(err);
+                foregroundDurations.push_back(duration);
+                wholeDuration += duration;
+                wholeDuration += timeSpan;
+            }
+            wholeDuration -= timeSpan;
+            
+            // length of every page on the timeline, the begin effect is trimmed
+            for (int i = 0; i < foregroundDurations.size(); ++i)
+            {
+                int64_t duration = foregroundDurations[i];
+                if (beginEffect.length() && !i)
+                    duration = std::min(duration, _maxEffectDuration);
+                layout.foregroundLengths.push_back(duration + timeSpan);
             }
             
-            // config background input queue
-            for (auto it = backgroundQueue.inputQueue.begin(); it != backgroundQueue.inputQueue.end(); ++it)
+            // calculate background time range
+            if (beginEffect.length())
+                layout.backgroundDelayStart += std::min(foregroundDurations.front(), _maxEffectDuration) + timeSpan;
+            
+            int introIndex = beginEffect.length() ? 1 : 0;
+            int endingIndex = (int)foregroundPages.size() - (endEffect.length() ? 2 : 1);
+            
+            if (haveIntroPage)
+                layout.backgroundDelayStart += foregroundDurations[introIndex] + timeSpan;
+            
+            if (haveEndingPage)
+                layout.backgroundPadEnd += foregroundDurations[endingIndex];
+            
+            if (endEffect.length())
+                layout.backgroundPadEnd += timeSpan + std::min(foregroundDurations.back(), _maxEffectDuration);
+            
+            if (bkgMusicFile.length())
             {
-                std::shared_ptr<AVProcessContext> context = *it;
-                AVFilterGraph* graph = avfilter_graph_alloc();
-                ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
-                context->pool.autoRelease([=]
-                                          {
-                                              AVFilterGraph* g = graph;
-                                              avfilter_graph_free(&g);
-                                          });
-                
-                err = makeInput(graph, context->codec, context->filter);
+                err = getFileDuration(layout.backgroundFile, _options.outputProfile, layout.backgroundDuration);
                 AV_ERROR_CHECK(err);
                 
-                err = makeFormatForAMIX(graph, context->filter, context->lastFilter);
-                AV_ERROR_CHECK(err);
+                int64_t backgroundDuration = layout.backgroundDuration;
+                int64_t backgroundWholeDuration = wholeDuration - layout.backgroundDelayStart - layout.backgroundPadEnd;
+                layout.backgroundTrimEnd = backgroundDuration - backgroundWholeDuration % backgroundDuration;
                 
-                if (it == backgroundQueue.inputQueue.begin() && backgroundDelayStart)
+                int backgroundSegments = ceil((double)backgroundWholeDuration / backgroundDuration);
+                for (int i = 0; i < backgroundSegments; ++i)
                 {
-                    err = makeDelay(graph, context->lastFilter, backgroundDelayStart, context->lastFilter);
-                    AV_ERROR_CHECK(err);
+                    int64_t length = backgroundDuration;
+                    if (!i)
+                        length += layout.backgroundDelayStart;
+                    if (i == backgroundSegments - 1)
+                        length += layout.backgroundPadEnd - layout.backgroundTrimEnd;
+                    
+                    layout.backgroundLengths.push_back(length);
                 }
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    /*
+     Places the clips of the timeline in samples, a looping clip is a piece for every copy of the file.
+     The clips are cut at the end of the timeline.
+     */
+    int _makeTimelineLayout(const FFTimeline& timeline, FFMediaCache* assetCache, TimelineLayout& layout)
+    {
+        int err = 0;
+        {
+            const FFOutputProfile& profile = _options.outputProfile;
+            
+            // a clip as one piece, the length of a clip that loops to the end is known with the timeline duration
+            struct ClipPlacement
+            {
+                TimelinePiece   piece;
+                int64_t         available;  // samples of the file behind the clip start
+                bool            loop;
+            };
+            
+            std::vector<std::vector<ClipPlacement>> tracks;
+            int64_t lastClipEnd = 0;
+            for (const FFTimelineTrack& track : timeline.tracks)
+            {
+                std::vector<const FFTimelineClip*> clips;
+                for (const FFTimelineClip& clip : track.clips)
+                    clips.push_back(&clip);
+                std::stable_sort(clips.begin(), clips.end(), [](const FFTimelineClip* a, const FFTimelineClip* b)
+                                 {
+                                     return a->offsetSec < b->offsetSec;
+                                 });
                 
-                if (it == --backgroundQueue.inputQueue.end())
+                std::vector<ClipPlacement> placements;
+                int64_t trackEnd = 0;
+                for (const FFTimelineClip* clip : clips)
                 {
-                    int64_t lastDuration = backgroundDuration;
-                    if (backgroundTrimEnd)
+                    ClipPlacement placement;
+                    TimelinePiece& piece = placement.piece;
+                    placement.loop = clip->loop;
+                    piece.position = profile.samples(std::max(clip->offsetSec, 0.));
+                    piece.mediaStart = profile.samples(std::max(clip->startSec, 0.));
+                    piece.length = (clip->durationSec >= 0) ? profile.samples(clip->durationSec) : -1;
+                    piece.gain = clip->gain * track.gain;
+                    piece.fadeIn = profile.samples(std::max(clip->fadeInSec, 0.));
+                    piece.fadeOut = profile.samples(std::max(clip->fadeOutSec, 0.));
+                    
+                    // clips of a track can't overlap, nothing follows a clip that loops to the end
+                    ERROR_CHECKEX(piece.position >= trackEnd, err = AVERROR(EINVAL));
+                    
+                    // a looping clip is decoded for every copy, so it's decoded into the asset cache once
+                    piece.file = clip->file;
+                    if (clip->loop)
                     {
-                        lastDuration = backgroundDuration - backgroundTrimEnd;
-                        if (it == backgroundQueue.inputQueue.begin())
-                            lastDuration += backgroundDelayStart;
-                        
-                        err = makeTrim(graph, context->lastFilter, lastDuration, context->lastFilter);
+                        err = _resolveAsset(assetCache, clip->file, piece.file);
                         AV_ERROR_CHECK(err);
                     }
                     
-                    int64_t fadeDuration = 5 * outputSampleRate;
-                    err = makeFade(graph, context->lastFilter, true, std::max<int64_t>(lastDuration - fadeDuration, 0), fadeDuration, context->lastFilter);
+                    // only the used part of a clip that doesn't loop is measured
+                    int64_t maxDuration = (!clip->loop && piece.length >= 0) ? piece.mediaStart + piece.length : -1;
+                    int64_t mediaDuration = 0;
+                    err = getFileDuration(piece.file, profile, mediaDuration, maxDuration);
                     AV_ERROR_CHECK(err);
                     
-                    if (backgroundPadEnd)
+                    placement.available = std::max<int64_t>(mediaDuration - piece.mediaStart, 0);
+                    ERROR_CHECKEX(!clip->loop || placement.available, err = AVERROR(EINVAL));
+                    
+                    if (piece.length < 0 && !clip->loop)
+                        piece.length = placement.available;
+                    
+                    if (piece.length >= 0)
+                    {
+                        trackEnd = piece.position + piece.length;
+                        lastClipEnd = std::max(lastClipEnd, trackEnd);
+                    }
+                    else
+                        trackEnd = INT64_MAX;
+                    
+                    placements.push_back(placement);
+                }
+                tracks.push_back(placements);
+            }
+            
+            layout.duration = (timeline.durationSec >= 0) ? profile.samples(timeline.durationSec) : lastClipEnd;
+            ERROR_CHECKEX(layout.duration > 0, err = AVERROR(EINVAL));
+            
+            for (const std::vector<ClipPlacement>& placements : tracks)
+            {
+                std::vector<TimelinePiece> pieces;
+                for (const ClipPlacement& placement : placements)
+                {
+                    const TimelinePiece& clip = placement.piece;
+                    int64_t end = (clip.length < 0) ? layout.duration : std::min(clip.position + clip.length, layout.duration);
+                    int64_t copyLength = placement.loop ? placement.available : end - clip.position;
+                    
+                    for (int64_t position = clip.position; position < end; position += copyLength)
                     {
-                        err = makePad(graph, context->lastFilter, backgroundPadEnd, context->lastFilter);
+                        TimelinePiece piece = clip;
+                        piece.position = position;
+                        piece.length = std::min(copyLength, end - position);
+                        piece.padded = !placement.loop && placement.available < piece.length;
+                        
+                        // the fades are on the first and the last copy
+                        piece.fadeIn = (position == clip.position) ? std::min(clip.fadeIn, piece.length) : 0;
+                        piece.fadeOut = (position + piece.length == end) ? std::min(clip.fadeOut, piece.length) : 0;
+                        piece.fadeOutStart = piece.length - piece.fadeOut;
+                        
+                        pieces.push_back(piece);
+                    }
+                }
+                layout.tracks.push_back(pieces);
+            }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // the pages on the first track, the background copies on the second
+    void _makeCombineTimeline(const CombineLayout& combine, TimelineLayout& layout)
+    {
+        std::vector<TimelinePiece> pages;
+        int64_t position = 0;
+        for (int i = 0; i < combine.foregroundPages.size(); ++i)
+        {
+            TimelinePiece piece;
+            piece.file = combine.foregroundPages[i];
+            piece.position = position;
+            piece.length = combine.foregroundLengths[i] - combine.timeSpan;
+            
+            // the begin effect fades out before the longest effect ends, even when it's shorter
+            if (combine.haveBeginEffect && !i)
+            {
+                piece.fadeOutStart = _maxEffectDuration - _effectFadeDuration;
+                piece.fadeOut = _effectFadeDuration;
+            }
+            
+            pages.push_back(piece);
+            position += combine.foregroundLengths[i];
+        }
+        layout.duration = position;
+        layout.tracks.push_back(pages);
+        
+        std::vector<TimelinePiece> copies;
+        position = 0;
+        for (int i = 0; i < combine.backgroundLengths.size(); ++i)
+        {
+            bool first = (0 == i);
+            bool last = (i == combine.backgroundLengths.size() - 1);
+            
+            TimelinePiece piece;
+            piece.file = combine.backgroundFile;
+            piece.position = position + (first ? combine.backgroundDelayStart : 0);
+            piece.length = (last && combine.backgroundTrimEnd) ? combine.backgroundDuration - combine.backgroundTrimEnd : combine.backgroundDuration;
+            piece.gain = combine.backgroundVolume;
+            if (last)
+            {
+                piece.fadeOutStart = std::max<int64_t>(piece.length - _effectFadeDuration, 0);
+                piece.fadeOut = _effectFadeDuration;
+            }
+            
+            if (piece.length > 0)
+                copies.push_back(piece);
+            position += combine.backgroundLengths[i];
+        }
+        if (copies.size())
+        {
+            layout.tracks.push_back(copies);
+            layout.trackSwells.resize(layout.tracks.size());
+            layout.trackSwells.back() = pages;
+        }
+    }
+    
+    /*
+     The gain of the background that swells between the voice pieces, from their places on the timeline.
+     It's 1 under the voice and rises linearly to backgroundSwellGain over backgroundRampSec after a piece,
+     and falls back before the next one. A gap shorter than two ramps doesn't swell fully.
+     The expression is a function of t in seconds from origin, the timeline position of the graph start.
+     */
+    std::string _makeSwellGain(const std::vector<TimelinePiece>& voices, int64_t origin)
+    {
+        double gain = _options.backgroundSwellGain;
+        double ramp = _options.backgroundRampSec;
+        if (gain == 1 || voices.empty() || ramp <= 0)
+            return std::string();
+        
+        const FFOutputProfile& profile = _options.outputProfile;
+        std::ostringstream expression;
+        expression << std::fixed << std::setprecision(6);
+        
+        // before the first piece and after the last one, then every gap
+        expression << "1+" << gain - 1 << "*(clip((" << profile.seconds(voices.front().position - origin) << "-t)/" << ramp << ",0,1)"
+                   << "+clip((t-" << profile.seconds(voices.back().position + voices.back().length - origin) << ")/" << ramp << ",0,1)";
+        for (int i = 0; i + 1 < voices.size(); ++i)
+        {
+            int64_t gapStart = voices[i].position + voices[i].length;
+            int64_t gapEnd = voices[i + 1].position;
+            if (gapEnd <= gapStart)
+                continue;
+            
+            expression << "+clip(min(t-" << profile.seconds(gapStart - origin) << "," << profile.seconds(gapEnd - origin) << "-t)/" << ramp << ",0,1)";
+        }
+        expression << ")";
+        return expression.str();
+    }
+    
+    /*
+     Renders the time window [windowStart, windowEnd) of the timeline, the whole timeline if windowEnd < 0.
+     The pieces out of the window are not opened, they are replaced by silence as long as they are needed
+     to keep the others at their position.
+     With outputLengths the window is split into outputFiles, otherwise it's written to outputFiles[0].
+     outputFinished is called with the index of every split output when its file is complete and closed.
+     */
+    int _renderTimeline(const TimelineLayout&             layout,
+                        int64_t                           windowStart,
+                        int64_t                           windowEnd,
+                        const std::vector<std::string>&   outputFiles,
+                        const std::vector<int64_t>&       outputLengths,
+                        const std::string&                outputFileType,
+                        int                               outputBitRate,
+                        AVCodecID                         outputCodecID,
+                        FFResampleProfile                 resampleProfile,
+                        const std::function<int(size_t)>& outputFinished = nullptr)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            
+            bool windowed = (windowEnd >= 0);
+            
+            // plan the pieces in the window, they are opened just before they play and closed when they end,
+            // only the part of a piece that is heard in the window is decoded.
+            // The offset is the part skipped at the start. It's kept out of the fades, they are applied to
+            // the decoded part, so a little may be decoded before the window, see _configFilterGraphForTimeline.
+            std::vector<std::vector<AVProcessContext>> trackContexts;
+            std::vector<std::vector<int64_t>> trackOffsets;
+            for (const std::vector<TimelinePiece>& pieces : layout.tracks)
+            {
+                std::vector<AVProcessContext> contexts;
+                std::vector<int64_t> offsets;
+                for (const TimelinePiece& piece : pieces)
+                {
+                    AVProcessContext context;
+                    bool opened = !windowed || (piece.position < windowEnd && piece.position + piece.length > windowStart);
+                    int64_t offset = 0;
+                    int64_t end = piece.length + _rangeMargin;
+                    if (windowed)
+                    {
+                        offset = std::max<int64_t>(windowStart - piece.position - _rangeMargin, 0);
+                        if (offset < piece.fadeIn)
+                            offset = 0;
+                        if (piece.fadeOut)
+                            offset = std::min(offset, piece.fadeOutStart);
+                        end = std::min(piece.length, windowEnd - piece.position) + _rangeMargin;
+                    }
+                    
+                    if (opened)
+                    {
+                        err = _makeLazyClip(piece.file, piece.mediaStart + offset, piece.mediaStart + end, context);
                         AV_ERROR_CHECK(err);
                     }
+                    
+                    contexts.push_back(context);
+                    offsets.push_back(opened ? offset : 0);
+                }
+                trackContexts.push_back(contexts);
+                trackOffsets.push_back(offsets);
+            }
+            
+            // open output files
+            std::vector<AVProcessContext> outputContexts;
+            for (const std::string& outputFile : outputFiles)
+            {
+                AVFormatContext* outputFormat = NULL;
+                AVCodecContext* outputCodec = NULL;
+                err = openOutputFile(outputFile, outputFormat, outputCodec, outputFileType, outputBitRate, _options.outputProfile, outputCodecID,
+                                     _getCodecOptions(outputFileType, outputCodecID));
+                if (outputFormat)
+                {
+                    pool.autoRelease([=] {
+                        if (outputFormat->pb)
+                            avio_closep(&outputFormat->pb);
+                        avformat_free_context(outputFormat);
+                    });
+                }
+                if (outputCodec)
+                {
+                    pool.autoRelease([=] {
+                        AVCodecContext* c = outputCodec;
+                        avcodec_free_context(&c);
+                    });
                 }
-                
-                err = makeOutput(graph, NULL, context->lastFilter, context->lastFilter);
-                AV_ERROR_CHECK(err);
-                
-                err = avfilter_graph_config(graph, NULL);
                 AV_ERROR_CHECK(err);
+                outputContexts.push_back(AVProcessContext(outputFormat, outputCodec, NULL, 0));
             }
+            AVProcessContext& outputContext = outputContexts.front();
             
-            // config mix filter graph
+            // init filter, the whole job is rendered by one filter graph
             AVFilterGraph* graph = avfilter_graph_alloc();
             ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
             pool.autoRelease([=]
@@ -781,191 +1311,575 @@ private:
                                  avfilter_graph_free(&g);
                              });
             
-            AVFilterContext* forcegroundInputFilter = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffer"), NULL);
-            ERROR_CHECKEX(forcegroundInputFilter, err = AVERROR(ENOMEM));
-            err = configInputFilterForAmix(forcegroundInputFilter);
+            err = configResampler(graph, getResampleOptions(resampleProfile));
             AV_ERROR_CHECK(err);
-            forcegroundQueue.destFilter = forcegroundInputFilter;
             
-            AVFilterContext* outputFilter = NULL;
-            if (!backgroundQueue.inputQueue.size())
+            err = _configFilterGraphForTimeline(graph, getResampleTaps(resampleProfile), layout, trackContexts, trackOffsets,
+                                                windowStart, windowEnd, outputContext);
+            AV_ERROR_CHECK(err);
+            
+            // write output file header
+            for (AVProcessContext& context : outputContexts)
             {
-                outputFilter = forcegroundInputFilter;
+                err = avformat_write_header(context.format, NULL);
+                AV_ERROR_CHECK(err);
             }
+            
+            // process all data, decoded frames are fed into the piece sources of the graph directly
+            std::vector<AVProcessContext> inputContexts;
+            for (std::vector<AVProcessContext>& contexts : trackContexts)
+            {
+                for (AVProcessContext& context : contexts)
+                {
+                    if (context.filter)
+                        inputContexts.push_back(context);
+                }
+            }
+            
+            // a full split output is closed right away, so that it survives the job being killed later
+            std::vector<bool> closed(outputContexts.size(), false);
+            auto closeOutput = [&outputContexts, &closed, &outputFinished](size_t index)
+            {
+                AVFormatContext* format = outputContexts[index].format;
+                int err = av_write_trailer(format);
+                if (err >= 0)
+                    err = avio_closep(&format->pb);
+                closed[index] = true;
+                if (err >= 0 && outputFinished)
+                    err = outputFinished(index);
+                return err;
+            };
+            
+            if (outputLengths.size())
+                err = processAll(inputContexts, outputContexts, outputLengths, &_feedBudget, closeOutput);
             else
+                err = processAll(inputContexts, outputContext, &_feedBudget);
+            AV_ERROR_CHECK(err);
+            
+            // write trailer
+            for (int i = 0; i < outputContexts.size(); ++i)
             {
-                AVFilterContext* backgroundInputFilter = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffer"), NULL);
-                ERROR_CHECKEX(backgroundInputFilter, err = AVERROR(ENOMEM));
-                err = configInputFilterForAmix(backgroundInputFilter);
-                AV_ERROR_CHECK(err);
-                
-                AVFilterContext* backgroundOuputFilter = NULL;
-                err = makeVolume(graph, backgroundInputFilter, backgroundvolume, backgroundOuputFilter);
-                backgroundQueue.destFilter = backgroundInputFilter;
-                
-                std::vector<AVFilterContext*> inputFilters;
-                inputFilters.push_back(forcegroundInputFilter);
-                inputFilters.push_back(backgroundOuputFilter);
-                
-                
-                err = makeMix(graph, inputFilters, outputFilter);
+                if (closed[i])
+                    continue;
+                err = av_write_trailer(outputContexts[i].format);
                 AV_ERROR_CHECK(err);
             }
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // the clips of the pages without their leading and trailing silence when the options ask for it
+    int _trimPages(const std::vector<std::string>& pages, std::vector<std::string>& trimmedPages)
+    {
+        int err = 0;
+        {
+            trimmedPages = pages;
+            CHECK(_options.trimSilence);
             
-            // adjust global volume, if multi tracks mix together, the output volume will reduced to prevent overflow.
-            if (backgroundQueue.inputQueue.size())
+            // the pages are decoded in parallel, unless their boundaries are known already
+            std::vector<int> errors(pages.size(), 0);
+            runParallel(pages.size(), [this, &pages, &trimmedPages, &errors](size_t i)
+                        {
+                            errors[i] = FFSilenceDetector::trimFile(pages[i], _options.silenceThresholdDb,
+                                                                    _options.silenceMarginSec, trimmedPages[i]);
+                        });
+            
+            for (int detectErr : errors)
             {
-                err = makeVolume(graph, outputFilter, 2., outputFilter);
+                err = detectErr;
                 AV_ERROR_CHECK(err);
             }
+        }
+        
+    Exit0:
+        return err;
+    }
+
+    // decoded fltp pcm of the file at the mixing rate and layout, the file itself without a cache
+    // decoded assets and rendered segments are kept in the format of the mix
+    // the encoder options are meant for the encoder of the output file type, previews and segments get none
+    std::string _getCodecOptions(const std::string& fileType, AVCodecID codecID) const
+    {
+        return ((fileType == _outputFileType) && (AV_CODEC_ID_NONE == codecID)) ? _codecOptions : std::string();
+    }
+    
+    AVCodecID _getCacheCodec() const
+    {
+        return _options.outputProfile.isFixedPoint() ? AV_CODEC_ID_PCM_S16LE : AV_CODEC_ID_PCM_F32LE;
+    }
+    
+    int _resolveAsset(FFMediaCache* cache, const std::string& file, std::string& resolvedFile)
+    {
+        int err = 0;
+        {
+            resolvedFile = file;
+            CHECK(cache && file.length());
             
-            // output format
-            err = makeFormatForOutput(graph, outputContext.codec, outputFilter, outputFilter);
+            std::string hash = getClipHash(file);
+            CHECK(hash.length());
+            
+            std::ostringstream description;
+            description << "asset|" << hash << '|' << av_get_sample_fmt_name(_options.outputProfile.sampleFormat) << '|'
+                        << _options.outputProfile.sampleRate << '|' << _options.outputProfile.channels << '|' << _options.resampleProfile;
+            std::string key = FFMediaCache::makeKey(description.str());
+            
+            CHECK(!cache->lookup(key, resolvedFile));
+            
+            err = _decodeAsset(file, cache->getTempPath(key));
+            if (err < 0)
+                cache->discard(key);
             AV_ERROR_CHECK(err);
             
-            // output sink
-            err = makeOutput(graph, outputContext.codec, outputFilter, outputFilter);
+            err = cache->commit(key, resolvedFile);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    int _decodeAsset(const std::string& inputFile, const std::string& outputFile)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
+            
+            AVProcessContext inputContext;
+            err = _openInput(pool, inputFile, inputContext);
+            AV_ERROR_CHECK(err);
+            
+            AVFormatContext* outputFormat = NULL;
+            AVCodecContext* outputCodec = NULL;
+            err = openOutputFile(outputFile, outputFormat, outputCodec, FFMediaCache::ENTRY_FILE_TYPE, 0, _options.outputProfile, _getCacheCodec());
+            if (outputFormat)
+            {
+                pool.autoRelease([=] {
+                    if (outputFormat->pb)
+                        avio_closep(&outputFormat->pb);
+                    avformat_free_context(outputFormat);
+                });
+            }
+            if (outputCodec)
+            {
+                pool.autoRelease([=] {
+                    AVCodecContext* c = outputCodec;
+                    avcodec_free_context(&c);
+                });
+            }
+            AV_ERROR_CHECK(err);
+            AVProcessContext outputContext(outputFormat, outputCodec, NULL, 0);
+            
+            AVFilterGraph* graph = avfilter_graph_alloc();
+            ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
+            pool.autoRelease([=]
+                             {
+                                 AVFilterGraph* g = graph;
+                                 avfilter_graph_free(&g);
+                             });
+            
+            err = configResampler(graph, getResampleOptions(_options.resampleProfile));
+            AV_ERROR_CHECK(err);
+            
+            err = makeInput(graph, inputContext, _options.outputProfile, getResampleTaps(_options.resampleProfile));
+            AV_ERROR_CHECK(err);
+            
+            AVFilterContext* outputFilter = NULL;
+            err = makeFormatForAMIX(graph, _options.outputProfile, inputContext.filter, outputFilter, &_jobStats.conversionsRemoved);
+            AV_ERROR_CHECK(err);
+            
+            err = makeFormatForOutput(graph, outputCodec, outputFilter, outputFilter, &_jobStats.conversionsRemoved);
+            AV_ERROR_CHECK(err);
+            
+            err = makeOutput(graph, outputCodec, outputFilter, outputFilter);
             AV_ERROR_CHECK(err);
             
             err = avfilter_graph_config(graph, NULL);
             AV_ERROR_CHECK(err);
+            outputContext.filter = outputFilter;
+            
+            err = avformat_write_header(outputFormat, NULL);
+            AV_ERROR_CHECK(err);
+            
+            std::vector<AVProcessContext> inputContexts(1, inputContext);
+            err = processAll(inputContexts, outputContext, &_feedBudget);
+            AV_ERROR_CHECK(err);
+            
+            err = av_write_trailer(outputFormat);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // the segment depends on the page, its place on the timeline, and the background under it
+    std::string _makeSegmentKey(const CombineLayout& layout, int page, int64_t position)
+    {
+        std::ostringstream description;
+        description << "segment|" << getClipHash(layout.foregroundPages[page]) << '|'
+                    << (layout.haveBeginEffect && !page) << '|'
+                    << position << '|' << layout.foregroundLengths[page] << '|' << layout.timeSpan << '|'
+                    << getClipHash(layout.backgroundFile) << '|' << layout.backgroundVolume << '|'
+                    << layout.backgroundDuration << '|' << layout.backgroundDelayStart << '|'
+                    << layout.backgroundTrimEnd << '|' << layout.backgroundPadEnd << '|'
+                    << _options.backgroundSwellGain << '|' << _options.backgroundRampSec << '|'
+                    << _options.resampleProfile << '|' << _options.outputProfile.sampleRate << '|' << _options.outputProfile.channels << '|'
+                    << av_get_sample_fmt_name(_options.outputProfile.sampleFormat);
+        
+        return FFMediaCache::makeKey(description.str());
+    }
+    
+    // encodes the segments in order into one output file
+    int _encodeSegments(const std::vector<std::string>& segmentFiles, const std::string& outputFile)
+    {
+        int err = 0;
+        {
+            FFAutoReleasePool pool;
             
+            // a long export has a segment for every page, each one is opened when the concat reaches it
+            std::vector<AVProcessContext> inputContexts;
+            for (const std::string& file : segmentFiles)
+            {
+                AVProcessContext context;
+                err = makeLazyInput(file, _options.outputProfile.sampleFormat, context);
+                AV_ERROR_CHECK(err);
+                inputContexts.push_back(context);
+            }
+            
+            AVFormatContext* outputFormat = NULL;
+            AVCodecContext* outputCodec = NULL;
+            err = openOutputFile(outputFile, outputFormat, outputCodec, _outputFileType, _outputBitRate, _options.outputProfile, AV_CODEC_ID_NONE, _codecOptions);
+            if (outputFormat)
+            {
+                pool.autoRelease([=] {
+                    if (outputFormat->pb)
+                        avio_closep(&outputFormat->pb);
+                    avformat_free_context(outputFormat);
+                });
+            }
+            if (outputCodec)
+            {
+                pool.autoRelease([=] {
+                    AVCodecContext* c = outputCodec;
+                    avcodec_free_context(&c);
+                });
+            }
+            AV_ERROR_CHECK(err);
+            AVProcessContext outputContext(outputFormat, outputCodec, NULL, 0);
+            
+            AVFilterGraph* graph = avfilter_graph_alloc();
+            ERROR_CHECKEX(graph, err = AVERROR(ENOMEM));
+            pool.autoRelease([=]
+                             {
+                                 AVFilterGraph* g = graph;
+                                 avfilter_graph_free(&g);
+                             });
+            
+            err = configResampler(graph, getResampleOptions(_options.resampleProfile));
+            AV_ERROR_CHECK(err);
+            
+            std::vector<AVFilterContext*> inputFilters;
+            for (AVProcessContext& context : inputContexts)
+            {
+                err = makeInput(graph, context, _options.outputProfile, 0);
+                AV_ERROR_CHECK(err);
+                inputFilters.push_back(context.filter);
+            }
+            
+            AVFilterContext* outputFilter = NULL;
+            err = makeConcat(graph, inputFilters, outputFilter);
+            AV_ERROR_CHECK(err);
+            
+            err = makeFormatForOutput(graph, outputCodec, outputFilter, outputFilter, &_jobStats.conversionsRemoved);
+            AV_ERROR_CHECK(err);
+            
+            err = makeOutput(graph, outputCodec, outputFilter, outputFilter);
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_graph_config(graph, NULL);
+            AV_ERROR_CHECK(err);
             outputContext.filter = outputFilter;
+            
+            err = avformat_write_header(outputFormat, NULL);
+            AV_ERROR_CHECK(err);
+            
+            err = processAll(inputContexts, outputContext, &_feedBudget);
+            AV_ERROR_CHECK(err);
+            
+            err = av_write_trailer(outputFormat);
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // opens the file, or the clip of it, the format and the codec are released with the pool
+    int _openInput(FFAutoReleasePool& pool, const std::string& file, AVProcessContext& context, AVSampleFormat requestSampleFormat = AV_SAMPLE_FMT_NB)
+    {
+        int err = 0;
+        {
+            // the format of the mix by default
+            if (AV_SAMPLE_FMT_NB == requestSampleFormat)
+                requestSampleFormat = _options.outputProfile.sampleFormat;
+            
+            context = AVProcessContext();
+            err = openInputFile(file, context, requestSampleFormat);
+            
+            AVFormatContext* format = context.format;
+            AVCodecContext* codec = context.codec;
+            if (format)
+            {
+                pool.autoRelease([=] {
+                    AVFormatContext* f = format;
+                    avformat_close_input(&f);
+                });
+            }
+            if (codec)
+            {
+                pool.autoRelease([=]{
+                    AVCodecContext* c = codec;
+                    avcodec_free_context(&c);
+                });
+            }
+            AV_ERROR_CHECK(err);
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    // the clip is opened by feedInputs when the graph first pulls it, the source is configured from the probed stream
+    int _makeLazyClip(const std::string& file, int64_t offset, int64_t end, AVProcessContext& context)
+    {
+        int err = 0;
+        {
+            err = makeLazyInput(file, _options.outputProfile.sampleFormat, context);
+            AV_ERROR_CHECK(err);
+            
+            context.opener = [this, file, offset, end](AVProcessContext& c)
+            {
+                return _openClip(file, offset, end, c);
+            };
+        }
+        
+    Exit0:
+        return err;
+    }
+    
+    /*
+     Opens the file to decode [offset, end) of it, in samples of the mixing rate, end < 0 decodes to the end.
+     The range is within the clip of the file when it has one. The caller closes the context, see closeInput.
+     */
+    int _openClip(const std::string& file, int64_t offset, int64_t end, AVProcessContext& context)
+    {
+        int err = 0;
+        {
+            err = openInputFile(file, context, _options.outputProfile.sampleFormat);
+            AV_ERROR_CHECK(err);
+            
+            int sampleRate = context.codec->sample_rate;
+            int64_t clipStart = context.startSample;
+            int64_t clipEnd = context.endSample;
+            
+            int64_t startSample = clipStart + av_rescale(offset, sampleRate, _options.outputProfile.sampleRate);
+            int64_t endSample = clipEnd;
+            if (end >= 0)
+            {
+                endSample = clipStart + av_rescale(end, sampleRate, _options.outputProfile.sampleRate);
+                if (clipEnd >= 0)
+                    endSample = std::min(endSample, clipEnd);
+            }
+            
+            if (startSample == clipStart)
+                context.endSample = endSample;
+            else
+            {
+                err = setInputRange(context, startSample, endSample);
+                AV_ERROR_CHECK(err);
+            }
         }
         
     Exit0:
         return err;
     }
     
-    int _processAllCombineQueues(std::vector<AVCombineQueueContext>& inputQueues, const AVProcessContext& outputContext)
+    /*
+     All pieces of the timeline are sources of one filter graph, the pieces of a track are concatenated
+     with silence in the gaps, and the tracks are mixed:
+     
+     silence ------------------------------------------------------------+
+     piece 0 -> aformat -> [apad] -> atrim -> [afade] -> [volume] -------+-> concat -+
+     ...                                                                 |           |
+     piece n -> aformat -> [apad] -> atrim -> [afade] -> [volume] -------+           +-> amix -> volume -> [atrim] -> aformat -> sink
+                                                                                     |
+     track 1 ... -> concat ----------------------------------------------------------+
+     
+     The fixed point profile scales the pieces with pan and sums the tracks with amerge -> pan instead of amix -> volume.
+     
+     concat only pulls from the piece it is playing, so only that piece's source will ask for more frames.
+     The graph starts at windowStart, the pieces which are not opened (out of the render window) are dropped,
+     and the gaps are filled with silence from there, a track without an opened piece is left out of the mix.
+     The part of a piece decoded before the window (the seek margin, or a fade that needs the piece start)
+     is cut by an atrim of the piece after its fades, the end of the window by the atrim before the output.
+     */
+    int _configFilterGraphForTimeline(AVFilterGraph* graph,
+                                      int resampleTaps,
+                                      const TimelineLayout& layout,
+                                      std::vector<std::vector<AVProcessContext>>& trackContexts,
+                                      const std::vector<std::vector<int64_t>>& trackOffsets,
+                                      int64_t windowStart,
+                                      int64_t windowEnd,
+                                      AVProcessContext& outputContext)
     {
         int err = 0;
         {
-            int64_t framePts = 0;
-            int64_t packetPts = 0;
+            int64_t renderEnd = (windowEnd >= 0) ? std::min(windowEnd, layout.duration) : layout.duration;
+            int64_t graphStart = (windowEnd >= 0) ? windowStart : 0;
             
-            while (true)
+            std::vector<AVFilterContext*> trackFilters;
+            for (int t = 0; t < layout.tracks.size(); ++t)
             {
-                // encode filterd frames
-                do
+                const std::vector<TimelinePiece>& pieces = layout.tracks[t];
+                std::vector<AVFilterContext*> pieceFilters;
+                int64_t position = graphStart;  // where the filters of the track end on the timeline
+                for (int i = 0; i < pieces.size(); ++i)
                 {
-                    AVFrame* filteredFrame = av_frame_alloc();
+                    const TimelinePiece& piece = pieces[i];
+                    AVProcessContext& context = trackContexts[t][i];
+                    if (!context.format && !context.opener)
+                        continue;
                     
-                    FFAutoReleasePool pool;
-                    pool.autoRelease([&filteredFrame]
-                                     {
-                                         av_frame_free(&filteredFrame);
-                                     });
+                    // the decoded part starts at the offset of the piece, what of it lies before the graph start is cut
+                    int64_t offset = trackOffsets[t][i];
+                    int64_t lead = std::max<int64_t>(graphStart - piece.position - offset, 0);
                     
-                    err = av_buffersink_get_frame(outputContext.filter, filteredFrame);
-                    if (err >= 0)
+                    // the gap before the piece
+                    int64_t silence = piece.position + offset + lead - position;
+                    if (silence > 0)
                     {
-                        filteredFrame->pts = framePts;
-                        framePts += filteredFrame->nb_samples;
-                        
-                        err = encodeOneFrame(outputContext.format, outputContext.codec, filteredFrame, packetPts);
+                        AVFilterContext* silenceFilter = NULL;
+                        err = makeSilenceForAMIX(graph, _options.outputProfile, silence, silenceFilter, &_jobStats.conversionsRemoved);
                         AV_ERROR_CHECK(err);
+                        pieceFilters.push_back(silenceFilter);
                     }
-                }
-                while (err >= 0);
-                
-                // need more input
-                if (AVERROR(EAGAIN) == err)
-                {
-                    // find lack source inputs
-                    std::vector<int> lackSourceInputs;
-                    for (int i = 0; i < inputQueues.size(); ++i)
+                    
+                    err = makeInput(graph, context, _options.outputProfile, resampleTaps);
+                    AV_ERROR_CHECK(err);
+                    
+                    err = makeFormatForAMIX(graph, _options.outputProfile, context.filter, context.lastFilter, &_jobStats.conversionsRemoved);
+                    AV_ERROR_CHECK(err);
+                    
+                    if (piece.padded)
                     {
-                        if (av_buffersrc_get_nb_failed_requests(inputQueues[i].destFilter) > 0)
-                            lackSourceInputs.push_back(i);
+                        err = makePad(graph, context.lastFilter, piece.length - offset, context.lastFilter);
+                        AV_ERROR_CHECK(err);
                     }
                     
-                    // decode frames and fill in to input filter
-                    for (int i : lackSourceInputs)
+                    err = makeTrim(graph, context.lastFilter, piece.length - offset, context.lastFilter);
+                    AV_ERROR_CHECK(err);
+                    
+                    if (piece.fadeIn && !offset)
                     {
-                        AVCombineQueueContext& queue = inputQueues[i];
-                        assert(queue.inputQueue.size());
-                        std::shared_ptr<AVProcessContext> inputContext = queue.inputQueue.front();
-                        
-                        bool finished = false;
-                        for (int j = 0; j < 128 && !finished; ++j)
-                        {
-                            AVFrame* inputFrame = av_frame_alloc();
-                            ERROR_CHECKEX(inputFrame, err = AVERROR(ENOMEM));
-                            
-                            FFAutoReleasePool pool;
-                            pool.autoRelease([&inputFrame]
-                                             {
-                                                 av_frame_free(&inputFrame);
-                                             });
-                            
-                            err = decodeOneFrame(inputContext->format,
-                                                 inputContext->codec,
-                                                 inputContext->streamIndex,
-                                                 inputFrame,
-                                                 inputContext->currentPTS,
-                                                 finished);
-                            AV_ERROR_CHECK(err);
-                            
-                            if (!finished)
-                            {
-                                err = av_buffersrc_add_frame(inputContext->filter, inputFrame);
-                                AV_ERROR_CHECK(err);
-                            }
-                        }
-                        
-                        // end input
-                        if (finished)
-                        {
-                            err = av_buffersrc_add_frame(inputContext->filter, NULL);
-                            AV_ERROR_CHECK(err);
-                        }
-                        
-                        {
-                            do
-                            {
-                                FFAutoReleasePool pool;
-                                AVFrame* queueFrame = av_frame_alloc();
-                                pool.autoRelease([&queueFrame]
-                                                 {
-                                                     av_frame_free(&queueFrame);
-                                                 });
-                                
-                                err = av_buffersink_get_frame(inputContext->lastFilter, queueFrame);
-                                if (err >= 0)
-                                {
-                                    err = av_buffersrc_add_frame(queue.destFilter, queueFrame);
-                                    AV_ERROR_CHECK(err);
-                                }
-                                
-                            } while (err >= 0);
-                            err = 0;
-                        }
-                        
-                        
-                        if (finished)
-                        {
-                            queue.inputQueue.erase(queue.inputQueue.begin());
-                            
-                            if (!queue.inputQueue.size())
-                            {
-                                err = av_buffersrc_add_frame(queue.destFilter, NULL);
-                                AV_ERROR_CHECK(err);
-                            }
-                        }
+                        err = makeFade(graph, _options.outputProfile, context.lastFilter, false, 0, piece.fadeIn, context.lastFilter);
+                        AV_ERROR_CHECK(err);
+                    }
+                    
+                    if (piece.fadeOut)
+                    {
+                        err = makeFade(graph, _options.outputProfile, context.lastFilter, true, piece.fadeOutStart - offset, piece.fadeOut, context.lastFilter);
+                        AV_ERROR_CHECK(err);
                     }
+                    
+                    if (piece.gain != 1)
+                    {
+                        err = makeGain(graph, _options.outputProfile, context.lastFilter, piece.gain, context.lastFilter);
+                        AV_ERROR_CHECK(err);
+                    }
+                    
+                    if (lead > 0)
+                    {
+                        err = makeTrimRange(graph, context.lastFilter, lead, piece.length - offset, context.lastFilter);
+                        AV_ERROR_CHECK(err);
+                    }
+                    
+                    pieceFilters.push_back(context.lastFilter);
+                    position = piece.position + piece.length;
                 }
-                // flush encoder
-                else if ((AVERROR(ENOMEM) == err) || AVERROR_EOF == err)
+                
+                if (pieceFilters.empty())
+                    continue;
+                
+                // every track lasts to the end, so that amix keeps the same scale
+                if (position < renderEnd)
                 {
-                    err = encodeFlush(outputContext.format, outputContext.codec, packetPts);
+                    AVFilterContext* silenceFilter = NULL;
+                    err = makeSilenceForAMIX(graph, _options.outputProfile, renderEnd - position, silenceFilter, &_jobStats.conversionsRemoved);
                     AV_ERROR_CHECK(err);
-                    break;
+                    pieceFilters.push_back(silenceFilter);
                 }
                 
-                // other errors
+                AVFilterContext* trackFilter = NULL;
+                err = makeConcat(graph, pieceFilters, trackFilter);
                 AV_ERROR_CHECK(err);
+                
+                // the track starts at the graph start, the time of its frames is from there
+                std::string gain = (t < layout.trackSwells.size()) ? _makeSwellGain(layout.trackSwells[t], graphStart) : std::string();
+                if (gain.length())
+                {
+                    err = makeVolumeExpression(graph, _options.outputProfile, trackFilter, gain, trackFilter);
+                    AV_ERROR_CHECK(err);
+                }
+                trackFilters.push_back(trackFilter);
             }
+            
+            // nothing is heard in the window
+            if (trackFilters.empty())
+            {
+                AVFilterContext* silenceFilter = NULL;
+                err = makeSilenceForAMIX(graph, _options.outputProfile, renderEnd - graphStart, silenceFilter, &_jobStats.conversionsRemoved);
+                AV_ERROR_CHECK(err);
+                trackFilters.push_back(silenceFilter);
+            }
+            
+            AVFilterContext* outputFilter = trackFilters.front();
+            if (trackFilters.size() > 1 && _options.outputProfile.isFixedPoint())
+            {
+                // the tracks are summed at unity like amix and the volume of the count below, the sum saturates where the float output clips
+                err = makeMixFixed(graph, _options.outputProfile, trackFilters, std::vector<double>(trackFilters.size(), 1.), outputFilter);
+                AV_ERROR_CHECK(err);
+            }
+            else if (trackFilters.size() > 1)
+            {
+                err = makeMix(graph, trackFilters, outputFilter);
+                AV_ERROR_CHECK(err);
+                
+                // adjust global volume, amix divides every input by the number of inputs to prevent overflow.
+                err = makeVolume(graph, outputFilter, (double)trackFilters.size(), outputFilter);
+                AV_ERROR_CHECK(err);
+            }
+            
+            // end of the render window, a piece may be decoded a little behind it
+            if (windowEnd >= 0)
+            {
+                err = makeTrim(graph, outputFilter, renderEnd - graphStart, outputFilter);
+                AV_ERROR_CHECK(err);
+            }
+            
+            // output format
+            err = makeFormatForOutput(graph, outputContext.codec, outputFilter, outputFilter, &_jobStats.conversionsRemoved);
+            AV_ERROR_CHECK(err);
+            
+            // output sink
+            err = makeOutput(graph, outputContext.codec, outputFilter, outputFilter);
+            AV_ERROR_CHECK(err);
+            
+            err = avfilter_graph_config(graph, NULL);
+            AV_ERROR_CHECK(err);
+            
+            outputContext.filter = outputFilter;
         }
         
     Exit0:
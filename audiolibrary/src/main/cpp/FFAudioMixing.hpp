@@ -11,21 +11,117 @@
 
 #include <string>
 #include <vector>
+#include <map>
+
+#include "FFAllocTracker.hpp"
+#include "FFMediaCache.hpp"
+#include "FFOutputProfile.hpp"
 
 namespace
 {
     const char* OUTPUT_FILE_TYPE = ".mp3";
     const int OUTPUT_BIT_RATE    = 160000;
+    const char* PREVIEW_FILE_TYPE = ".wav";
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+// quality/speed trade-off of the sample rate and format conversions
+enum FFResampleProfile
+{
+    FF_RESAMPLE_FAST,           // short filter, few phases, for previews and low-end devices
+    FF_RESAMPLE_BALANCED,       // 32 taps and 1024 phases without interpolation, pinned so it doesn't follow the defaults of the swr build
+    FF_RESAMPLE_HIGH_QUALITY,   // soxr when libswresample is built with it, otherwise a long swr filter
+};
+
+struct FFAudioMixingOptions
+{
+    FFOutputProfile     outputProfile;      // mixing format and output format of every job
+    bool                trackAllocations;   // account the allocations of every job, see FFJobStats::alloc
+    FFResampleProfile   resampleProfile;
+    std::string         cacheDir;           // decoded effects and background music are kept here when it's set
+    int64_t             cacheMaxBytes;      // size limit of a cache directory, the least recently used entries are removed
+    std::string         encoderPreset;      // "default", "realtime", "export" or "archival", trades encode speed for quality
+    std::map<std::string, std::string> encoderOptions;  // avcodec options of the output encoder, they override the preset
+    bool                trimSilence;        // combine and concat play only the speech of every voice page, see FFSilenceDetector
+    double              silenceThresholdDb; // 10 ms blocks below it are silence
+    double              silenceMarginSec;   // silence kept before and after the speech
+    double              backgroundSwellGain;    // combine: gain of the background between the pages relative to under them, 1 keeps it even
+    double              backgroundRampSec;      // combine: the background swells for this long after a page and ducks this long before the next
+    int                 maxFramesPerInput;  // decoded frames fed to a waiting input at a time
+    int                 maxQueuedMs;        // bounds the audio queued in the filter graph over all inputs and closes drained decoders, 0 for no bound
+    std::string         checkpointDir;      // combineAudios keeps every mixed page here and a restarted export resumes after the last one
+    int64_t             checkpointMaxBytes; // size limit of the checkpoint directory apart from the cache, the pages of the running job are kept over it
+    bool                keepCheckpoints;    // the pages of a finished export stay in the checkpoint directory for the next one, otherwise they're removed
+    
+    FFAudioMixingOptions();
+};
+
+// statistics of the last finished job
+struct FFJobStats
+{
+    FFAllocStats alloc;
+    int          conversionsRemoved;    // format conversion stages skipped because the input already had the wanted format
+    int          segmentsRendered;      // combineAudiosIncremental segments mixed by this job
+    int          segmentsReused;        // combineAudiosIncremental segments taken from the segment cache
+    FFCacheStats cache;                 // asset and segment cache lookups of the job
+    int64_t      peakQueuedBytes;       // most decoded audio fed to the filter graph and not yet out of it, estimated from the sample counts
+    
+    FFJobStats();
+};
+
+// a file placed on a track, the times are in seconds
+struct FFTimelineClip
+{
+    std::string file;           // may be a clip of the file, "file#t=start,end"
+    double      offsetSec;      // position on the timeline
+    double      startSec;       // position in the file where the clip starts
+    double      durationSec;    // length on the timeline, < 0 to the end of the file, a clip longer than the file is padded with silence
+    double      gain;
+    double      fadeInSec;
+    double      fadeOutSec;     // the fade ends with the clip
+    bool        loop;           // repeats the file from startSec for durationSec, to the end of the timeline if durationSec < 0
+    
+    FFTimelineClip();
+};
+
+struct FFTimelineTrack
+{
+    std::vector<FFTimelineClip> clips;      // the clips of a track must not overlap
+    double                      gain;
+    
+    FFTimelineTrack();
+};
+
+// the tracks are mixed at the same volume, silence where a track has no clip
+struct FFTimeline
+{
+    std::vector<FFTimelineTrack>    tracks;
+    double                          durationSec;    // < 0 ends with the last clip that doesn't loop to the end
+    
+    FFTimeline();
+};
+
 struct IFFAudioMixing
 {
-    virtual void init(const char* outputFileType = OUTPUT_FILE_TYPE, const int outputBitRate = OUTPUT_BIT_RATE) = 0;
+    // fails with an unknown encoder preset, the encoder options are checked when an output is opened
+    virtual int init(const char* outputFileType = OUTPUT_FILE_TYPE,
+                     const int outputBitRate = OUTPUT_BIT_RATE,
+                     const FFAudioMixingOptions& options = FFAudioMixingOptions()) = 0;
     virtual void destroy() = 0;
+    virtual const FFJobStats& jobStats() const = 0;
     
+    // every input file may be a clip of a file, "file#t=start,end" in seconds, only the clip is decoded
     virtual int mixAudio(const std::string& inputFile1, const std::string inputFile2, const std::string& outputFile) = 0;
+    /*
+     Mixes all inputs with one amix and encodes the mix once, the output is as long as the longest input plus 2 s.
+     inputGains[i] scales input i before amix averages the inputs, a missing gain is 1.
+     */
+    virtual int mixAudios(const std::vector<std::string>& inputFiles, const std::vector<double>& inputGains, const std::string& outputFile) = 0;
+    // decodes every clip once and encodes the mix of all tracks once, with one filter graph
+    virtual int renderTimeline(const FFTimeline& timeline, const std::string& outputFile) = 0;
+    // a timeline of the pages on one track and the looping background on another,
+    // combineAudiosIncremental into FFAudioMixingOptions::checkpointDir when it's set
     virtual int combineAudios(const std::string&                beginEffect,
                               const std::string&                endEffect,
                               bool                              haveIntroPage,
@@ -35,6 +131,40 @@ struct IFFAudioMixing
                               const std::string&                bkgMusicFile,
                               double                            bkgVolume,
                               const std::string&                outputFile) = 0;
+    /*
+     Renders [previewStartSec, previewStartSec + previewDurationSec) of what combineAudios would produce
+     into a pcm wav file. Only the pages and background copies in the window are decoded, and the fast
+     resample profile is used.
+     */
+    virtual int previewCombineAudios(const std::string&                beginEffect,
+                                     const std::string&                endEffect,
+                                     bool                              haveIntroPage,
+                                     bool                              haveEndingPage,
+                                     const std::vector<std::string>&   voicePages,
+                                     double                            timeSpanSec,
+                                     const std::string&                bkgMusicFile,
+                                     double                            bkgVolume,
+                                     double                            previewStartSec,
+                                     double                            previewDurationSec,
+                                     const std::string&                outputFile) = 0;
+    /*
+     Same result as combineAudios. The mixed pcm of every page (with the time span behind it) is kept in
+     segmentCacheDir, keyed by the page content, its place on the timeline and the background under it.
+     Only the segments without an artifact are mixed again, then all segments are encoded into outputFile.
+     When a page changes its length the pages behind it move, so they are mixed again too.
+     A segment is kept as soon as it's written, so a job that fails resumes after the last finished page.
+     When outputFile is written the segments of the job are removed, unless FFAudioMixingOptions::keepCheckpoints is set.
+     */
+    virtual int combineAudiosIncremental(const std::string&                beginEffect,
+                                         const std::string&                endEffect,
+                                         bool                              haveIntroPage,
+                                         bool                              haveEndingPage,
+                                         const std::vector<std::string>&   voicePages,
+                                         double                            timeSpanSec,
+                                         const std::string&                bkgMusicFile,
+                                         double                            bkgVolume,
+                                         const std::string&                segmentCacheDir,
+                                         const std::string&                outputFile) = 0;
     virtual int concatAudios(const std::vector<std::string>& audios, double timeSpanSec, const std::string& outputFile) = 0;
     virtual int loudnormAudio(const std::string& inputFile, const std::string& outputFile) = 0;
     virtual int convertAudioFile(const std::string& inputFile, const std::string& outputFile) = 0;
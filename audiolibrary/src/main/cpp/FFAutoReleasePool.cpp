@@ -7,10 +7,26 @@
 //
 
 #include "FFAutoReleasePool.hpp"
+#include "FFAllocTracker.hpp"
+
+FFAutoReleasePool::FFAutoReleasePool()
+: _trackTag(0)
+, _trackedBytes(0)
+{
+
+}
 
 void FFAutoReleasePool::autoRelease(FFAutoReleaseFunc func)
 {
     _releaseStack.push(func);
+    
+    // every release entry is a heap allocation, the per-frame pools make many of them
+    uint32_t tag = FFAllocTracker::trackAlloc(sizeof(FFAutoReleaseFunc));
+    if (tag)
+    {
+        _trackTag      = tag;
+        _trackedBytes += sizeof(FFAutoReleaseFunc);
+    }
 }
 
 FFAutoReleasePool::~FFAutoReleasePool()
@@ -21,4 +37,6 @@ FFAutoReleasePool::~FFAutoReleasePool()
         func();
         _releaseStack.pop();
     }
+    
+    FFAllocTracker::trackFree(_trackedBytes, _trackTag);
 }
\ No newline at end of file
@@ -11,6 +11,8 @@
 
 #include <functional>
 #include <stack>
+#include <stdint.h>
+#include <stddef.h>
 
 typedef std::function<void ()> FFAutoReleaseFunc;
 
@@ -18,8 +20,11 @@ class FFAutoReleasePool
 {
 private:
     std::stack<FFAutoReleaseFunc> _releaseStack;
+    uint32_t _trackTag;         // allocation tag of the tracked job, see FFAllocTracker
+    size_t   _trackedBytes;
     
 public:
+    FFAutoReleasePool();
     virtual ~FFAutoReleasePool();
     
 public:
@@ -0,0 +1,284 @@
+//
+//  FFLevelMeter.cpp
+//  FFAudioMixing
+//
+//  Peak, rms and short-term loudness of the recorded pcm, for the level display while recording.
+//
+
+#include "FFLevelMeter.hpp"
+#include "FFSimd.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+    const int BLOCKS_PER_SECOND = 10;
+    const int SHORT_TERM_BLOCKS = 30;
+    const float SILENCE_LUFS = -70;
+
+    // largest magnitude and sum of squares of s16 samples
+    void measureS16(const int16_t* samples, int count, int& peak, int64_t& squares)
+    {
+        int i = 0;
+        peak = 0;
+        squares = 0;
+#if defined(FF_SIMD_NEON)
+        int16x8_t maxAbs = vdupq_n_s16(0);
+        int64x2_t acc = vdupq_n_s64(0);
+        for (; i + 8 <= count; i += 8)
+        {
+            int16x8_t x = vld1q_s16(samples + i);
+            maxAbs = vmaxq_s16(maxAbs, vqabsq_s16(x));
+            acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+            acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+        }
+        int16x4_t max4 = vmax_s16(vget_low_s16(maxAbs), vget_high_s16(maxAbs));
+        max4 = vpmax_s16(max4, max4);
+        max4 = vpmax_s16(max4, max4);
+        peak = vget_lane_s16(max4, 0);
+        squares = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+#elif defined(FF_SIMD_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i maxAbs = zero;
+        __m128i acc = zero;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(samples + i));
+            // the saturating negation keeps -32768 in range
+            maxAbs = _mm_max_epi16(maxAbs, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+            // a pair of squares may reach 2^31, it's widened as unsigned
+            __m128i pairs = _mm_madd_epi16(x, x);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(pairs, zero));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(pairs, zero));
+        }
+        int16_t maxLanes[8];
+        int64_t accLanes[2];
+        _mm_storeu_si128((__m128i*)maxLanes, maxAbs);
+        _mm_storeu_si128((__m128i*)accLanes, acc);
+        for (int16_t lane : maxLanes)
+            peak = std::max<int>(peak, lane);
+        squares = accLanes[0] + accLanes[1];
+#endif
+        for (; i < count; ++i)
+        {
+            int x = samples[i];
+            peak = std::max(peak, std::abs(x));
+            squares += x * x;
+        }
+    }
+}
+
+FFLevels::FFLevels()
+: peak(0)
+, rms(0)
+, shortTermLufs(SILENCE_LUFS)
+, seconds(0)
+{
+
+}
+
+FFLevelSnapshot::FFLevelSnapshot()
+: _sequence(0)
+, _peak(0)
+, _rms(0)
+, _shortTermLufs(SILENCE_LUFS)
+, _seconds(0)
+{
+
+}
+
+void FFLevelSnapshot::publish(const FFLevels& levels)
+{
+    // odd while the values are written
+    uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    _peak.store(levels.peak, std::memory_order_relaxed);
+    _rms.store(levels.rms, std::memory_order_relaxed);
+    _shortTermLufs.store(levels.shortTermLufs, std::memory_order_relaxed);
+    _seconds.store(levels.seconds, std::memory_order_relaxed);
+
+    _sequence.store(sequence + 2, std::memory_order_release);
+}
+
+FFLevels FFLevelSnapshot::read() const
+{
+    FFLevels levels;
+    while (true)
+    {
+        uint32_t sequence = _sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+            continue;
+
+        levels.peak          = _peak.load(std::memory_order_relaxed);
+        levels.rms           = _rms.load(std::memory_order_relaxed);
+        levels.shortTermLufs = _shortTermLufs.load(std::memory_order_relaxed);
+        levels.seconds       = _seconds.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) == sequence)
+            return levels;
+    }
+}
+
+/*
+ The K-weighting filters of ITU-R BS.1770 designed for the sample rate,
+ the same design as libebur128 so that the loudness matches the loudnorm filter.
+ */
+FFLevelMeter::FFLevelMeter(int sampleRate, int channels, FFLevelSnapshot& snapshot)
+: _snapshot(snapshot)
+, _sampleRate(sampleRate)
+, _channels(std::max(channels, 1))
+, _blockFrames(std::max(sampleRate / BLOCKS_PER_SECOND, 1))
+, _blockPosition(0)
+, _frames(0)
+, _blockPeak(0)
+, _blockSquares(0)
+, _blockWeightedSquares(0)
+, _weightedBlocks(SHORT_TERM_BLOCKS, 0)
+, _weightedBlockIndex(0)
+, _weightedBlockCount(0)
+, _filterState(4 * _channels, 0)
+{
+    double f0 = 1681.974450955533;
+    double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / sampleRate);
+    double vh = pow(10.0, gain / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    _shelfB[0] = (vh + vb * k / q + k * k) / a0;
+    _shelfB[1] = 2.0 * (k * k - vh) / a0;
+    _shelfB[2] = (vh - vb * k / q + k * k) / a0;
+    _shelfA[0] = 1.0;
+    _shelfA[1] = 2.0 * (k * k - 1.0) / a0;
+    _shelfA[2] = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / sampleRate);
+    a0 = 1.0 + k / q + k * k;
+    _highPassB[0] = 1.0;
+    _highPassB[1] = -2.0;
+    _highPassB[2] = 1.0;
+    _highPassA[0] = 1.0;
+    _highPassA[1] = 2.0 * (k * k - 1.0) / a0;
+    _highPassA[2] = (1.0 - k / q + k * k) / a0;
+}
+
+void FFLevelMeter::process(const uint8_t* data, int frames, AVSampleFormat format)
+{
+    switch (format)
+    {
+        case AV_SAMPLE_FMT_S16:
+            _processS16((const int16_t*)data, frames);
+            break;
+        case AV_SAMPLE_FMT_FLT:
+            _processFloat((const float*)data, frames);
+            break;
+        case AV_SAMPLE_FMT_U8:
+            _convertBuffer.resize(frames * _channels);
+            for (int i = 0; i < frames * _channels; ++i)
+                _convertBuffer[i] = (data[i] - 128) / 128.f;
+            _processFloat(&_convertBuffer.front(), frames);
+            break;
+        default:
+            break;
+    }
+}
+
+void FFLevelMeter::_processS16(const int16_t* samples, int frames)
+{
+    while (frames > 0)
+    {
+        int count = std::min(frames, _blockFrames - _blockPosition);
+
+        int peak = 0;
+        int64_t squares = 0;
+        measureS16(samples, count * _channels, peak, squares);
+        _blockPeak = std::max(_blockPeak, peak / 32768.f);
+        _blockSquares += squares / (32768.0 * 32768.0);
+
+        for (int i = 0; i < count; ++i)
+        {
+            for (int c = 0; c < _channels; ++c)
+                _weight(c, samples[i * _channels + c] / 32768.f);
+        }
+
+        samples += count * _channels;
+        frames -= count;
+        _blockPosition += count;
+        if (_blockPosition == _blockFrames)
+            _endBlock();
+    }
+}
+
+void FFLevelMeter::_processFloat(const float* samples, int frames)
+{
+    while (frames > 0)
+    {
+        int count = std::min(frames, _blockFrames - _blockPosition);
+
+        for (int i = 0; i < count; ++i)
+        {
+            for (int c = 0; c < _channels; ++c)
+            {
+                float x = samples[i * _channels + c];
+                _blockPeak = std::max(_blockPeak, std::fabs(x));
+                _blockSquares += x * x;
+                _weight(c, x);
+            }
+        }
+
+        samples += count * _channels;
+        frames -= count;
+        _blockPosition += count;
+        if (_blockPosition == _blockFrames)
+            _endBlock();
+    }
+}
+
+// both biquads in transposed direct form II
+void FFLevelMeter::_weight(int channel, float sample)
+{
+    double* state = &_filterState[4 * channel];
+
+    double shelf = _shelfB[0] * sample + state[0];
+    state[0] = _shelfB[1] * sample - _shelfA[1] * shelf + state[1];
+    state[1] = _shelfB[2] * sample - _shelfA[2] * shelf;
+
+    double highPass = _highPassB[0] * shelf + state[2];
+    state[2] = _highPassB[1] * shelf - _highPassA[1] * highPass + state[3];
+    state[3] = _highPassB[2] * shelf - _highPassA[2] * highPass;
+
+    _blockWeightedSquares += highPass * highPass;
+}
+
+void FFLevelMeter::_endBlock()
+{
+    _frames += _blockPosition;
+
+    // the mean square of every channel, summed, is the power of the block
+    _weightedBlocks[_weightedBlockIndex] = _blockWeightedSquares / _blockPosition;
+    _weightedBlockIndex = (_weightedBlockIndex + 1) % SHORT_TERM_BLOCKS;
+    _weightedBlockCount = std::min(_weightedBlockCount + 1, SHORT_TERM_BLOCKS);
+
+    double power = 0;
+    for (int i = 0; i < _weightedBlockCount; ++i)
+        power += _weightedBlocks[i];
+    power /= _weightedBlockCount;
+
+    FFLevels levels;
+    levels.peak          = _blockPeak;
+    levels.rms           = (float)sqrt(_blockSquares / ((double)_blockPosition * _channels));
+    levels.shortTermLufs = (power > 0) ? std::max((float)(-0.691 + 10.0 * log10(power)), SILENCE_LUFS) : SILENCE_LUFS;
+    levels.seconds       = (float)_frames / _sampleRate;
+    _snapshot.publish(levels);
+
+    _blockPosition = 0;
+    _blockPeak = 0;
+    _blockSquares = 0;
+    _blockWeightedSquares = 0;
+}
@@ -0,0 +1,89 @@
+//
+//  FFLevelMeter.hpp
+//  FFAudioMixing
+//
+//  Peak, rms and short-term loudness of the recorded pcm, for the level display while recording.
+//
+
+#ifndef FFLevelMeter_hpp
+#define FFLevelMeter_hpp
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+struct FFLevels
+{
+    float peak;             // of the last 100 ms block, full scale is 1
+    float rms;              // of the last 100 ms block
+    float shortTermLufs;    // K-weighted loudness of the last 3 s (EBU R128 short-term), -70 for silence
+    float seconds;          // audio metered since the recording started
+
+    FFLevels();
+};
+
+/*
+ The last levels of a meter, written by the encoding thread and polled by any thread.
+ A sequence counter makes the read consistent without a lock, the reader retries while a write is going on.
+ */
+class FFLevelSnapshot
+{
+private:
+    std::atomic<uint32_t>   _sequence;
+    std::atomic<float>      _peak;
+    std::atomic<float>      _rms;
+    std::atomic<float>      _shortTermLufs;
+    std::atomic<float>      _seconds;
+
+public:
+    FFLevelSnapshot();
+
+    void publish(const FFLevels& levels);
+    FFLevels read() const;
+};
+
+/*
+ Meters interleaved pcm in 100 ms blocks and publishes the levels after every block.
+ Peak and rms of s16 are computed with NEON or SSE2 when the target has it, the K-weighting filters run per sample.
+ */
+class FFLevelMeter
+{
+private:
+    FFLevelSnapshot& _snapshot;
+    int _sampleRate;
+    int _channels;
+    int _blockFrames;
+    int _blockPosition;                     // frames of the current block
+    int64_t _frames;
+
+    float _blockPeak;
+    double _blockSquares;
+    double _blockWeightedSquares;           // K-weighted, summed over the channels
+    std::vector<double> _weightedBlocks;    // mean squares of the last 3 s of blocks, a ring
+    int _weightedBlockIndex;
+    int _weightedBlockCount;
+
+    // K-weighting, a high shelf followed by a high pass, a and b of both and the state of every channel
+    double _shelfB[3], _shelfA[3];
+    double _highPassB[3], _highPassA[3];
+    std::vector<double> _filterState;       // 4 per channel
+    std::vector<float> _convertBuffer;
+
+public:
+    FFLevelMeter(int sampleRate, int channels, FFLevelSnapshot& snapshot);
+
+    // whole frames of packed u8, s16 or flt, other formats are ignored
+    void process(const uint8_t* data, int frames, AVSampleFormat format);
+
+private:
+    void _processS16(const int16_t* samples, int frames);
+    void _processFloat(const float* samples, int frames);
+    void _weight(int channel, float sample);
+    void _endBlock();
+};
+
+#endif /* FFLevelMeter_hpp */
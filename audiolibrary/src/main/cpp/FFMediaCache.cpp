@@ -0,0 +1,281 @@
+//
+//  FFMediaCache.cpp
+//  FFAudioMixing
+//
+//  Content addressed on-disk cache for decoded assets and rendered segments.
+//
+
+#include "FFMediaCache.hpp"
+#include "FFAllocTracker.hpp"
+#include "FFMemoMap.hpp"
+
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+namespace
+{
+    const char* TEMP_SUFFIX = ".part";
+    // a temp file that wasn't written for this long was left by a job that was killed
+    const time_t STALE_TEMP_SEC = 60 * 60;
+
+    bool endsWith(const std::string& str, const std::string& suffix)
+    {
+        return (str.size() >= suffix.size()) && (0 == str.compare(str.size() - suffix.size(), suffix.size(), suffix));
+    }
+}
+
+FFCacheStats::FFCacheStats()
+: hits(0)
+, misses(0)
+, evictions(0)
+, bytesWritten(0)
+, bytesEvicted(0)
+{
+
+}
+
+const char* FFMediaCache::ENTRY_FILE_TYPE = ".wav";
+
+// FNV-1a
+uint64_t FFMediaCache::hashString(const std::string& str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : str)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string FFMediaCache::hashFile(const std::string& file)
+{
+    static std::mutex lock;
+    static FFMemoMap<std::string> hashes(1024);
+
+    struct stat info = {0};
+    if (file.empty() || stat(file.c_str(), &info))
+        return std::string();
+
+    std::ostringstream identity;
+    identity << file << ':' << (long long)info.st_size << ':' << (long long)info.st_mtime;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::string hex;
+        if (hashes.find(identity.str(), hex))
+            return hex;
+    }
+
+    FILE* stream = fopen(file.c_str(), "rb");
+    if (!stream)
+        return std::string();
+
+    uint64_t hash = 14695981039346656037ULL;
+    std::vector<unsigned char> buffer(64 * 1024);
+    uint32_t trackTag = FFAllocTracker::trackAlloc(buffer.size());
+    size_t size = 0;
+    while ((size = fread(&buffer[0], 1, buffer.size(), stream)) > 0)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    fclose(stream);
+    FFAllocTracker::trackFree(buffer.size(), trackTag);
+
+    char hex[32] = {0};
+    snprintf(hex, sizeof(hex), "%016llx-%llx", (unsigned long long)hash, (unsigned long long)info.st_size);
+
+    std::lock_guard<std::mutex> guard(lock);
+    hashes.insert(identity.str(), hex);
+    return hex;
+}
+
+std::string FFMediaCache::makeKey(const std::string& description)
+{
+    char key[32] = {0};
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hashString(description));
+    return key;
+}
+
+FFMediaCache::FFMediaCache(const std::string& directory, int64_t maxBytes, FFCacheStats& stats)
+: _directory(directory)
+, _maxBytes(maxBytes)
+, _stats(stats)
+, _totalBytes(0)
+, _pinnedBytes(0)
+{
+
+}
+
+int FFMediaCache::open()
+{
+    if (mkdir(_directory.c_str(), 0755) && EEXIST != errno)
+        return -errno;
+
+    _entries.clear();
+    _totalBytes  = 0;
+    _pinnedBytes = 0;
+
+    DIR* dir = opendir(_directory.c_str());
+    if (!dir)
+        return -errno;
+
+    std::string tempType = std::string(ENTRY_FILE_TYPE) + TEMP_SUFFIX;
+    time_t now = time(NULL);
+    while (struct dirent* item = readdir(dir))
+    {
+        std::string name = item->d_name;
+        bool temp = endsWith(name, tempType);
+        if (!temp && !endsWith(name, ENTRY_FILE_TYPE))
+            continue;
+
+        struct stat info = {0};
+        if (stat((_directory + "/" + name).c_str(), &info))
+            continue;
+
+        // the temp files of the other instances are still written to
+        if (temp)
+        {
+            if (now - info.st_mtime > STALE_TEMP_SEC)
+                unlink((_directory + "/" + name).c_str());
+            continue;
+        }
+
+        FFCacheEntry entry = { info.st_size, info.st_mtime, false };
+        _entries[name.substr(0, name.size() - strlen(ENTRY_FILE_TYPE))] = entry;
+        _totalBytes += info.st_size;
+    }
+    closedir(dir);
+    return 0;
+}
+
+bool FFMediaCache::lookup(const std::string& key, std::string& path)
+{
+    path = _getPath(key);
+
+    struct stat info = {0};
+    if (stat(path.c_str(), &info))
+    {
+        ++_stats.misses;
+        return false;
+    }
+
+    // the modification time is the lru order for the other instances
+    utimes(path.c_str(), NULL);
+    _useEntry(key, info.st_size, time(NULL));
+    ++_stats.hits;
+    return true;
+}
+
+std::string FFMediaCache::getTempPath(const std::string& key) const
+{
+    return _getPath(key) + TEMP_SUFFIX;
+}
+
+int FFMediaCache::commit(const std::string& key, std::string& path)
+{
+    std::string tempPath = getTempPath(key);
+    path = _getPath(key);
+
+    struct stat info = {0};
+    if (stat(tempPath.c_str(), &info))
+        return -errno;
+
+    if (rename(tempPath.c_str(), path.c_str()))
+        return -errno;
+
+    _useEntry(key, info.st_size, time(NULL));
+    _stats.bytesWritten += info.st_size;
+
+    if (_maxBytes > 0 && _totalBytes > _maxBytes)
+        _evict();
+    return 0;
+}
+
+void FFMediaCache::discard(const std::string& key)
+{
+    unlink(getTempPath(key).c_str());
+}
+
+void FFMediaCache::remove(const std::string& key)
+{
+    unlink(_getPath(key).c_str());
+
+    auto it = _entries.find(key);
+    if (it == _entries.end())
+        return;
+
+    _totalBytes -= it->second.size;
+    if (it->second.pinned)
+        _pinnedBytes -= it->second.size;
+    _entries.erase(it);
+}
+
+std::string FFMediaCache::_getPath(const std::string& key) const
+{
+    return _directory + "/" + key + ENTRY_FILE_TYPE;
+}
+
+// pins the entry, it may be new to this instance or replaced
+void FFMediaCache::_useEntry(const std::string& key, int64_t size, time_t lastUsed)
+{
+    FFCacheEntry& entry = _entries[key];
+    _totalBytes -= entry.size;
+    if (entry.pinned)
+        _pinnedBytes -= entry.size;
+
+    entry.size     = size;
+    entry.lastUsed = lastUsed;
+    entry.pinned   = true;
+    _totalBytes  += size;
+    _pinnedBytes += size;
+}
+
+void FFMediaCache::_evict()
+{
+    // only the pinned entries are left, nothing to do until an entry that isn't pinned is seen again
+    if (_totalBytes <= _pinnedBytes)
+        return;
+
+    std::vector<std::pair<time_t, std::string>> order;
+    order.reserve(_entries.size());
+    for (const auto& item : _entries)
+    {
+        if (!item.second.pinned)
+            order.push_back(std::make_pair(item.second.lastUsed, item.first));
+    }
+    std::sort(order.begin(), order.end());
+
+    for (const auto& item : order)
+    {
+        if (_totalBytes <= _maxBytes)
+            break;
+
+        auto it = _entries.find(item.second);
+        int64_t size = it->second.size;
+        bool removed = (0 == unlink(_getPath(item.second).c_str()));
+        if (!removed && ENOENT != errno)
+            continue;
+
+        // an entry removed by another instance is only forgotten
+        if (removed)
+        {
+            ++_stats.evictions;
+            _stats.bytesEvicted += size;
+        }
+        _totalBytes -= size;
+        _entries.erase(it);
+    }
+}
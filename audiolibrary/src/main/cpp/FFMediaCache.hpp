@@ -0,0 +1,80 @@
+//
+//  FFMediaCache.hpp
+//  FFAudioMixing
+//
+//  Content addressed on-disk cache for decoded assets and rendered segments.
+//
+
+#ifndef FFMediaCache_hpp
+#define FFMediaCache_hpp
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <time.h>
+
+struct FFCacheStats
+{
+    int     hits;
+    int     misses;
+    int     evictions;
+    int64_t bytesWritten;
+    int64_t bytesEvicted;
+
+    FFCacheStats();
+};
+
+/*
+ Entries are pcm wav files named by their key, in the sample format of the output profile.
+ The key is made by the caller from the content hash of the sources and the processing parameters.
+ The directory is scanned once by open(), then the size of it is kept in memory. When a commit makes it
+ larger than maxBytes, the least recently used entries are removed, the entries used by this instance are
+ never removed by it, 0 bytes is no limit. Several instances may share one directory, entries added by the others are seen
+ when they are looked up.
+ */
+class FFMediaCache
+{
+private:
+    struct FFCacheEntry
+    {
+        int64_t size;
+        time_t  lastUsed;
+        bool    pinned;
+    };
+
+    std::string             _directory;
+    int64_t                 _maxBytes;
+    FFCacheStats&           _stats;
+    std::map<std::string, FFCacheEntry> _entries;
+    int64_t                 _totalBytes;
+    int64_t                 _pinnedBytes;
+
+public:
+    static const char* ENTRY_FILE_TYPE;
+
+    static uint64_t hashString(const std::string& str);
+    // content hash of the file in hex, memoized by path, size and modification time, empty if it can't be read
+    static std::string hashFile(const std::string& file);
+    static std::string makeKey(const std::string& description);
+
+    FFMediaCache(const std::string& directory, int64_t maxBytes, FFCacheStats& stats);
+
+    // creates the directory and reads the sizes of the entries in it, removes the temp files of killed jobs
+    int open();
+
+    bool lookup(const std::string& key, std::string& path);
+
+    // write the entry into the temp path, then commit or discard it
+    std::string getTempPath(const std::string& key) const;
+    int commit(const std::string& key, std::string& path);
+    void discard(const std::string& key);
+    // deletes the committed entry, it's looked up again as a miss
+    void remove(const std::string& key);
+
+private:
+    std::string _getPath(const std::string& key) const;
+    void _useEntry(const std::string& key, int64_t size, time_t lastUsed);
+    void _evict();
+};
+
+#endif /* FFMediaCache_hpp */
@@ -0,0 +1,74 @@
+//
+//  FFMemoMap.hpp
+//  FFAudioMixing
+//
+//  Bounded memo of the process, the least recently used value is dropped when it's full.
+//
+
+#ifndef FFMemoMap_hpp
+#define FFMemoMap_hpp
+
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+/*
+ The memos of hashes, probes and trims live as long as the app process, so they are bounded by the
+ count of values. The map isn't locked, the owner locks it like the map it replaces.
+ */
+template <typename V>
+class FFMemoMap
+{
+private:
+    typedef std::list<std::pair<std::string, V>> FFMemoList;
+
+    size_t      _capacity;
+    FFMemoList  _values;        // the most recently used first
+    std::map<std::string, typename FFMemoList::iterator> _index;
+
+public:
+    explicit FFMemoMap(size_t capacity)
+    : _capacity(capacity)
+    {
+
+    }
+
+    bool find(const std::string& key, V& value)
+    {
+        auto it = _index.find(key);
+        if (it == _index.end())
+            return false;
+
+        _values.splice(_values.begin(), _values, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void insert(const std::string& key, const V& value)
+    {
+        auto it = _index.find(key);
+        if (it != _index.end())
+        {
+            it->second->second = value;
+            _values.splice(_values.begin(), _values, it->second);
+            return;
+        }
+
+        _values.push_front(std::make_pair(key, value));
+        _index[key] = _values.begin();
+        if (_values.size() > _capacity)
+        {
+            _index.erase(_values.back().first);
+            _values.pop_back();
+        }
+    }
+
+    size_t size() const
+    {
+        return _values.size();
+    }
+};
+
+#endif /* FFMemoMap_hpp */
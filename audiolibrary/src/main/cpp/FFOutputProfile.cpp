@@ -0,0 +1,39 @@
+//
+//  FFOutputProfile.cpp
+//  FFAudioMixing
+//
+//  Sample rate and channels of the mixing format and of the output files.
+//
+
+#include "FFOutputProfile.hpp"
+
+FFOutputProfile::FFOutputProfile()
+: sampleRate(44100)
+, channels(1)
+, sampleFormat(AV_SAMPLE_FMT_FLTP)
+{
+
+}
+
+FFOutputProfile::FFOutputProfile(int sampleRate_, int channels_, AVSampleFormat sampleFormat_)
+: sampleRate(sampleRate_)
+, channels(channels_)
+, sampleFormat(sampleFormat_)
+{
+
+}
+
+bool FFOutputProfile::isFixedPoint() const
+{
+    return (AV_SAMPLE_FMT_S16P == sampleFormat);
+}
+
+int64_t FFOutputProfile::samples(double seconds) const
+{
+    return (int64_t)(seconds * sampleRate);
+}
+
+double FFOutputProfile::seconds(int64_t samples) const
+{
+    return (double)samples / sampleRate;
+}
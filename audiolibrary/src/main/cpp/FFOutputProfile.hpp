@@ -0,0 +1,39 @@
+//
+//  FFOutputProfile.hpp
+//  FFAudioMixing
+//
+//  Sample rate and channels of the mixing format and of the output files.
+//
+
+#ifndef FFOutputProfile_hpp
+#define FFOutputProfile_hpp
+
+#include <stdint.h>
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+/*
+ The inputs are converted to the sample format at this rate and channel count before they are mixed, and the output
+ is encoded with it. Inputs which already have the rate and the channels are not resampled.
+ */
+struct FFOutputProfile
+{
+    int sampleRate;
+    int channels;           // the default layout of the channel count is used
+    AVSampleFormat sampleFormat;    // fltp, or s16p to mix, scale, fade and pad in fixed point on cpus without an fpu
+    
+    FFOutputProfile();
+    FFOutputProfile(int sampleRate_, int channels_, AVSampleFormat sampleFormat_ = AV_SAMPLE_FMT_FLTP);
+    
+    // the s16p pipeline, gains and mixing are Q15, see FFAudioHelper::makeGain and makeMixFixed
+    bool isFixedPoint() const;
+    
+    // samples of the given seconds at the sample rate
+    int64_t samples(double seconds) const;
+    // seconds of the given samples at the sample rate
+    double seconds(int64_t samples) const;
+};
+
+#endif /* FFOutputProfile_hpp */
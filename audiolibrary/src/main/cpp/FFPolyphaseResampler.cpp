@@ -0,0 +1,250 @@
+//
+//  FFPolyphaseResampler.cpp
+//  FFAudioMixing
+//
+//  Polyphase resampler for the fixed ratios that most of the inputs have:
+//  48000 -> 44100 (147/160) and 16000 -> 44100 (441/160) for the default profile,
+//  44100 -> 48000 (160/147) and 16000 -> 48000 (3/1) for the 48 kHz profile.
+//
+
+#include "FFPolyphaseResampler.hpp"
+#include "FFSimd.hpp"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <algorithm>
+
+namespace
+{
+    struct FFResampleRatio
+    {
+        int inputSampleRate;
+        int outputSampleRate;
+        int upFactor;
+        int downFactor;
+    };
+
+    const FFResampleRatio supportedRatios[] =
+    {
+        { 48000, 44100, 147, 160 },
+        { 16000, 44100, 441, 160 },
+        { 44100, 48000, 160, 147 },
+        { 16000, 48000,   3,   1 },
+    };
+
+    const FFResampleRatio* findRatio(int inputSampleRate, int outputSampleRate)
+    {
+        for (const FFResampleRatio& ratio : supportedRatios)
+        {
+            if (ratio.inputSampleRate == inputSampleRate && ratio.outputSampleRate == outputSampleRate)
+                return &ratio;
+        }
+        return NULL;
+    }
+
+    double besselI0(double x)
+    {
+        double sum = 1, term = 1;
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    /*
+     Kaiser windowed sinc designed at the intermediate rate (input rate * L), cut at 0.91 of the lower nyquist,
+     split into L phases. The coefficients of a phase are stored reversed, so that a phase can be applied
+     to the input samples with a plain dot product.
+     */
+    std::shared_ptr<const std::vector<float>> makeCoefficients(const FFResampleRatio& ratio, int taps)
+    {
+        static std::mutex lock;
+        static std::map<std::pair<const FFResampleRatio*, int>, std::shared_ptr<const std::vector<float>>> tables;
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto key = std::make_pair(&ratio, taps);
+        auto it = tables.find(key);
+        if (it != tables.end())
+            return it->second;
+
+        const int L = ratio.upFactor;
+        const int length = taps * L;
+        const double beta = (taps >= 32) ? 9.0 : 7.0;
+        const double cutoff = 0.91 * 0.5 * std::min(ratio.inputSampleRate, ratio.outputSampleRate) / ((double)ratio.inputSampleRate * L);
+        // integer center, the same delay is compensated by the resampler
+        const double center = (length - 1) / 2;
+
+        std::vector<float>* coefficients = new std::vector<float>(length);
+        for (int n = 0; n < length; ++n)
+        {
+            double x = n - center;
+            double sinc = (x == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+            double r = x / center;
+            double window = besselI0(beta * sqrt(std::max(0.0, 1 - r * r))) / besselI0(beta);
+
+            int phase = n % L;
+            int k = n / L;
+            (*coefficients)[phase * taps + (taps - 1 - k)] = (float)(L * sinc * window);
+        }
+
+        std::shared_ptr<const std::vector<float>> table(coefficients);
+        tables[key] = table;
+        return table;
+    }
+
+    inline float dotProduct(const float* a, const float* b, int n)
+    {
+#if defined(FF_SIMD_NEON)
+        float32x4_t acc0 = vdupq_n_f32(0);
+        float32x4_t acc1 = vdupq_n_f32(0);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+            acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        }
+        for (; i < n; i += 4)
+            acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vaddq_f32(acc0, acc1);
+        float32x2_t sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+        return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(FF_SIMD_SSE)
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        }
+        for (; i < n; i += 4)
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc0 = _mm_add_ps(acc0, acc1);
+        acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+        acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+        return _mm_cvtss_f32(acc0);
+#else
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (int i = 0; i < n; i += 4)
+        {
+            s0 += a[i] * b[i];
+            s1 += a[i + 1] * b[i + 1];
+            s2 += a[i + 2] * b[i + 2];
+            s3 += a[i + 3] * b[i + 3];
+        }
+        return (s0 + s1) + (s2 + s3);
+#endif
+    }
+}
+
+bool FFPolyphaseResampler::isSupported(int inputSampleRate, int outputSampleRate)
+{
+    return (NULL != findRatio(inputSampleRate, outputSampleRate));
+}
+
+FFPolyphaseResampler::FFPolyphaseResampler(int inputSampleRate, int outputSampleRate, int channels, int taps)
+: _outputSampleRate(outputSampleRate)
+, _upFactor(1)
+, _downFactor(1)
+, _taps((std::max(taps, 4) + 3) / 4 * 4)
+, _channels(channels)
+, _delay(0)
+, _inputCount(0)
+, _outputCount(0)
+, _bufferOrigin(0)
+, _flushed(false)
+{
+    const FFResampleRatio* ratio = findRatio(inputSampleRate, outputSampleRate);
+    if (ratio)
+    {
+        _upFactor     = ratio->upFactor;
+        _downFactor   = ratio->downFactor;
+        _coefficients = makeCoefficients(*ratio, _taps);
+    }
+
+    _delay = ((int64_t)_taps * _upFactor - 1) / 2;
+
+    // the samples before the first input are silence
+    _bufferOrigin = -(_taps - 1);
+    _buffers.resize(_channels, std::vector<float>(_taps - 1, 0.f));
+}
+
+int FFPolyphaseResampler::getOutputSampleRate() const
+{
+    return _outputSampleRate;
+}
+
+int FFPolyphaseResampler::getOutputCapacity(int inputSamples) const
+{
+    return (int)(((int64_t)inputSamples * _upFactor + _downFactor - 1) / _downFactor) + 1;
+}
+
+int FFPolyphaseResampler::process(const float* const* input, int inputSamples, float* const* output, int outputCapacity)
+{
+    if (!_coefficients || _flushed)
+        return 0;
+
+    for (int c = 0; c < _channels; ++c)
+        _buffers[c].insert(_buffers[c].end(), input[c], input[c] + inputSamples);
+    _inputCount += inputSamples;
+
+    return _produce(output, outputCapacity, _inputCount);
+}
+
+int FFPolyphaseResampler::flush(float* const* output, int outputCapacity)
+{
+    if (!_coefficients || _flushed)
+        return 0;
+
+    _flushed = true;
+
+    // pad silence behind the input, enough for the filter to reach the last output sample
+    int64_t wholeOutput = (_inputCount * _upFactor + _downFactor - 1) / _downFactor;
+    int64_t lastInput = ((wholeOutput - 1) * _downFactor + _delay) / _upFactor;
+    int64_t padding = std::max<int64_t>(lastInput + 1 - _inputCount, 0);
+    for (int c = 0; c < _channels; ++c)
+        _buffers[c].resize(_buffers[c].size() + padding, 0.f);
+
+    int capacity = (int)std::min<int64_t>(outputCapacity, wholeOutput - _outputCount);
+    return _produce(output, std::max(capacity, 0), _inputCount + padding);
+}
+
+int FFPolyphaseResampler::_produce(float* const* output, int outputCapacity, int64_t availableInput)
+{
+    const float* coefficients = &_coefficients->front();
+
+    int produced = 0;
+    while (produced < outputCapacity)
+    {
+        // output sample j is at j * M on the intermediate rate, the newest input sample it needs is at (j * M + delay) / L
+        int64_t t = _outputCount * _downFactor + _delay;
+        int64_t newest = t / _upFactor;
+        if (newest >= availableInput)
+            break;
+
+        int phase = (int)(t % _upFactor);
+        const float* phaseCoefficients = coefficients + phase * _taps;
+        size_t offset = (size_t)(newest - (_taps - 1) - _bufferOrigin);
+
+        for (int c = 0; c < _channels; ++c)
+            output[c][produced] = dotProduct(phaseCoefficients, &_buffers[c][offset], _taps);
+
+        ++produced;
+        ++_outputCount;
+    }
+
+    // drop the input samples that no longer reach any output
+    int64_t next = (_outputCount * _downFactor + _delay) / _upFactor;
+    int64_t drop = std::min<int64_t>(next - (_taps - 1) - _bufferOrigin, (int64_t)_buffers[0].size());
+    if (drop > 0)
+    {
+        for (int c = 0; c < _channels; ++c)
+            _buffers[c].erase(_buffers[c].begin(), _buffers[c].begin() + (size_t)drop);
+        _bufferOrigin += drop;
+    }
+
+    return produced;
+}
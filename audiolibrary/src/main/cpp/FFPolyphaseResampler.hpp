@@ -0,0 +1,53 @@
+//
+//  FFPolyphaseResampler.hpp
+//  FFAudioMixing
+//
+//  Polyphase resampler for the fixed ratios that most of the inputs have:
+//  48000 -> 44100 (147/160) and 16000 -> 44100 (441/160) for the default profile,
+//  44100 -> 48000 (160/147) and 16000 -> 48000 (3/1) for the 48 kHz profile.
+//
+
+#ifndef FFPolyphaseResampler_hpp
+#define FFPolyphaseResampler_hpp
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+
+class FFPolyphaseResampler
+{
+private:
+    int _outputSampleRate;
+    int _upFactor;          // L
+    int _downFactor;        // M
+    int _taps;              // coefficients per phase, multiple of 4
+    int _channels;
+    int64_t _delay;         // filter delay at the intermediate rate, compensated so that the output is not shifted
+    int64_t _inputCount;    // input samples received
+    int64_t _outputCount;   // output samples produced
+    int64_t _bufferOrigin;  // input index of the first sample kept in _buffers
+    bool _flushed;
+    std::shared_ptr<const std::vector<float>> _coefficients;   // _upFactor phases x _taps, reversed for the dot product
+    std::vector<std::vector<float>> _buffers;
+
+public:
+    static bool isSupported(int inputSampleRate, int outputSampleRate);
+
+    FFPolyphaseResampler(int inputSampleRate, int outputSampleRate, int channels, int taps);
+    
+    int getOutputSampleRate() const;
+
+    // max output samples for the given input samples
+    int getOutputCapacity(int inputSamples) const;
+
+    // planar float in/out, returns the output samples written
+    int process(const float* const* input, int inputSamples, float* const* output, int outputCapacity);
+
+    // outputs the tail of the signal, returns the output samples written
+    int flush(float* const* output, int outputCapacity);
+
+private:
+    int _produce(float* const* output, int outputCapacity, int64_t availableInput);
+};
+
+#endif /* FFPolyphaseResampler_hpp */
@@ -0,0 +1,263 @@
+//
+//  FFSilenceDetector.cpp
+//  FFAudioMixing
+//
+//  Finds where the speech of a recorded page starts and ends, to trim the leading and trailing silence.
+//
+
+#include "FFSilenceDetector.hpp"
+#include "FFAudioHelper.hpp"
+#include "FFMediaCache.hpp"
+#include "FFMemoMap.hpp"
+#include "FFSimd.hpp"
+
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace FFAudioHelper;
+
+namespace
+{
+    const int BLOCKS_PER_SECOND = 100;
+    const int MIN_SPEECH_BLOCKS = 3;
+
+    float sumSquares(const float* samples, int count)
+    {
+        int i = 0;
+        float sum = 0;
+#if defined(FF_SIMD_NEON)
+        float32x4_t acc = vdupq_n_f32(0);
+        for (; i + 4 <= count; i += 4)
+        {
+            float32x4_t x = vld1q_f32(samples + i);
+            acc = vmlaq_f32(acc, x, x);
+        }
+        float32x2_t sum2 = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+        sum = vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+#elif defined(FF_SIMD_SSE)
+        __m128 acc = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(samples + i);
+            acc = _mm_add_ps(acc, _mm_mul_ps(x, x));
+        }
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+        sum = _mm_cvtss_f32(acc);
+#endif
+        for (; i < count; ++i)
+            sum += samples[i] * samples[i];
+        return sum;
+    }
+
+    // sum of squares, full scale is 1, of count samples of the packed format
+    double sumSquares(const uint8_t* data, int count, AVSampleFormat format)
+    {
+        double sum = 0;
+        switch (format)
+        {
+            case AV_SAMPLE_FMT_FLT:
+                sum = sumSquares((const float*)data, count);
+                break;
+            case AV_SAMPLE_FMT_S16:
+            {
+                int64_t squares = 0;
+                for (int i = 0; i < count; ++i)
+                    squares += ((const int16_t*)data)[i] * ((const int16_t*)data)[i];
+                sum = squares / (32768.0 * 32768.0);
+                break;
+            }
+            case AV_SAMPLE_FMT_U8:
+                for (int i = 0; i < count; ++i)
+                    sum += (data[i] - 128) * (data[i] - 128) / (128.0 * 128.0);
+                break;
+            // 24 bit wav and flac pages
+            case AV_SAMPLE_FMT_S32:
+                for (int i = 0; i < count; ++i)
+                {
+                    double sample = ((const int32_t*)data)[i] / 2147483648.0;
+                    sum += sample * sample;
+                }
+                break;
+            case AV_SAMPLE_FMT_DBL:
+                for (int i = 0; i < count; ++i)
+                    sum += ((const double*)data)[i] * ((const double*)data)[i];
+                break;
+            default:
+                break;
+        }
+        return sum;
+    }
+
+    std::string formatTime(double seconds)
+    {
+        std::ostringstream str;
+        str << std::fixed << std::setprecision(6) << seconds;
+        return str.str();
+    }
+}
+
+FFSilenceDetector::FFSilenceDetector(int sampleRate, int channels, double thresholdDb)
+: _channels(std::max(channels, 1))
+, _blockFrames(std::max(sampleRate / BLOCKS_PER_SECOND, 1))
+, _thresholdSquares(0)
+, _blockPosition(0)
+, _blockSquares(0)
+, _frames(0)
+, _loudBlocks(0)
+, _speechStart(-1)
+, _speechEnd(-1)
+{
+    _thresholdSquares = pow(10.0, thresholdDb / 10.0) * _blockFrames * _channels;
+}
+
+void FFSilenceDetector::process(const uint8_t* const* planes, int frames, AVSampleFormat format)
+{
+    bool planar = av_sample_fmt_is_planar(format);
+    AVSampleFormat packedFormat = av_get_packed_sample_fmt(format);
+    int sampleBytes = av_get_bytes_per_sample(format);
+    int planeCount = planar ? _channels : 1;
+    int samplesPerFrame = planar ? 1 : _channels;
+
+    int offset = 0;
+    while (frames > 0)
+    {
+        int count = std::min(frames, _blockFrames - _blockPosition);
+
+        for (int p = 0; p < planeCount; ++p)
+            _blockSquares += sumSquares(planes[p] + (size_t)offset * samplesPerFrame * sampleBytes, count * samplesPerFrame, packedFormat);
+
+        offset += count;
+        frames -= count;
+        _blockPosition += count;
+        if (_blockPosition == _blockFrames)
+            _endBlock();
+    }
+}
+
+bool FFSilenceDetector::getSpeech(int64_t& startFrame, int64_t& endFrame) const
+{
+    if (_speechStart < 0)
+        return false;
+
+    startFrame = _speechStart;
+    endFrame   = _speechEnd;
+    return true;
+}
+
+void FFSilenceDetector::_endBlock()
+{
+    int64_t blockStart = _frames;
+    _frames += _blockPosition;
+
+    if (_blockSquares >= _thresholdSquares)
+    {
+        ++_loudBlocks;
+        if (_loudBlocks >= MIN_SPEECH_BLOCKS)
+        {
+            if (_speechStart < 0)
+                _speechStart = blockStart - (int64_t)(MIN_SPEECH_BLOCKS - 1) * _blockFrames;
+            _speechEnd = _frames;
+        }
+    }
+    else
+        _loudBlocks = 0;
+
+    _blockPosition = 0;
+    _blockSquares = 0;
+}
+
+int FFSilenceDetector::trimFile(const std::string& file, double thresholdDb, double marginSec, std::string& trimmedFile)
+{
+    static std::mutex lock;
+    static FFMemoMap<std::string> trimmedFiles(256);
+
+    trimmedFile = file;
+
+    std::string path;
+    double clipStart = 0, clipEnd = -1;
+    parseClip(file, path, clipStart, clipEnd);
+
+    // by content, a page recorded again under the same name is analysed again
+    std::string hash = FFMediaCache::hashFile(path);
+    std::ostringstream key;
+    key << hash << CLIP_FRAGMENT << std::setprecision(17) << clipStart << ',' << clipEnd << ':' << thresholdDb << ':' << marginSec;
+    if (hash.length())
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (trimmedFiles.find(key.str(), trimmedFile))
+            return 0;
+    }
+
+    int err = 0;
+    {
+        FFAutoReleasePool pool;
+
+        AVProcessContext context;
+        pool.autoRelease([&context]
+                         {
+                             if (context.codec)
+                                 avcodec_free_context(&context.codec);
+                             if (context.format)
+                                 avformat_close_input(&context.format);
+                         });
+
+        err = openInputFile(file, context, AV_SAMPLE_FMT_FLTP);
+        AV_ERROR_CHECK(err);
+
+        AVFrame* frame = av_frame_alloc();
+        pool.autoRelease([&frame]
+                         {
+                             av_frame_free(&frame);
+                         });
+        ERROR_CHECKEX(frame, err = AVERROR(ENOMEM));
+
+        int sampleRate = context.codec->sample_rate;
+        FFSilenceDetector detector(sampleRate, context.codec->channels, thresholdDb);
+        bool finished = false;
+        while (true)
+        {
+            err = decodeRangeFrame(context, frame, finished);
+            AV_ERROR_CHECK(err);
+            if (finished)
+                break;
+
+            if (av_frame_get_channels(frame) == context.codec->channels)
+                detector.process(frame->extended_data, frame->nb_samples, (AVSampleFormat)frame->format);
+        }
+
+        // in seconds of the clip, the margin is cut at the ends of the clip
+        int64_t startFrame = 0, endFrame = 0;
+        if (detector.getSpeech(startFrame, endFrame))
+        {
+            int64_t margin = (int64_t)(marginSec * sampleRate);
+            int64_t frames = context.currentPTS;
+            startFrame = std::max<int64_t>(startFrame - margin, 0);
+            endFrame   = std::min(endFrame + margin, frames);
+
+            if (startFrame > 0 || endFrame < frames)
+            {
+                // an open end stays open, the end of a clip stays where it was
+                std::string start = formatTime(clipStart + (double)startFrame / sampleRate);
+                if (endFrame < frames)
+                    trimmedFile = path + CLIP_FRAGMENT + start + "," + formatTime(clipStart + (double)endFrame / sampleRate);
+                else if (clipEnd >= 0)
+                    trimmedFile = path + CLIP_FRAGMENT + start + "," + formatTime(clipEnd);
+                else
+                    trimmedFile = path + CLIP_FRAGMENT + start;
+            }
+        }
+
+        if (hash.length())
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            trimmedFiles.insert(key.str(), trimmedFile);
+        }
+    }
+
+Exit0:
+    return err;
+}
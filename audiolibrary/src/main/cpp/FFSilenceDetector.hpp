@@ -0,0 +1,55 @@
+//
+//  FFSilenceDetector.hpp
+//  FFAudioMixing
+//
+//  Finds where the speech of a recorded page starts and ends, to trim the leading and trailing silence.
+//
+
+#ifndef FFSilenceDetector_hpp
+#define FFSilenceDetector_hpp
+
+#include <stdint.h>
+#include <string>
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+/*
+ Measures the energy of 10 ms blocks, speech is 30 ms or more of blocks above the threshold,
+ so that a click in the silence doesn't count.
+ */
+class FFSilenceDetector
+{
+private:
+    int _channels;
+    int _blockFrames;
+    double _thresholdSquares;       // mean square of a block at the threshold, times the frames of a block
+    int _blockPosition;
+    double _blockSquares;
+    int64_t _frames;
+    int _loudBlocks;                // blocks above the threshold in a row
+    int64_t _speechStart;           // frames, -1 until speech is found
+    int64_t _speechEnd;
+
+public:
+    FFSilenceDetector(int sampleRate, int channels, double thresholdDb);
+
+    // whole frames of u8, s16 or flt, packed or planar, other formats are ignored
+    void process(const uint8_t* const* planes, int frames, AVSampleFormat format);
+
+    // the frames from the start of the first speech to the end of the last one, false if there is no speech
+    bool getSpeech(int64_t& startFrame, int64_t& endFrame) const;
+
+    /*
+     The clip of the file without the leading and trailing silence, keeping marginSec of it around the speech,
+     see FFAudioHelper::parseClip. The file may already be a clip. A file without speech is returned as is.
+     The result is memoized by the content of the file and the parameters.
+     */
+    static int trimFile(const std::string& file, double thresholdDb, double marginSec, std::string& trimmedFile);
+
+private:
+    void _endBlock();
+};
+
+#endif /* FFSilenceDetector_hpp */
@@ -0,0 +1,29 @@
+//
+//  FFSimd.hpp
+//  FFAudioMixing
+//
+//  The vector instructions of the target, for the inner loops of the meters, the detectors and the resampler.
+//
+
+#ifndef FFSimd_hpp
+#define FFSimd_hpp
+
+/*
+ FF_SIMD_NEON on arm targets that have NEON, FF_SIMD_SSE for float and FF_SIMD_SSE2 for integer loops on x86.
+ Without them the loops are scalar, the armeabi build has neither.
+ */
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FF_SIMD_NEON
+#else
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FF_SIMD_SSE
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FF_SIMD_SSE2
+#endif
+#endif
+
+#endif /* FFSimd_hpp */
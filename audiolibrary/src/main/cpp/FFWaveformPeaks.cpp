@@ -0,0 +1,504 @@
+//
+//  FFWaveformPeaks.cpp
+//  FFAudioMixing
+//
+//  Min/max peaks of audio files at several zoom levels for drawing waveforms, kept in a sidecar file.
+//
+
+#include "FFWaveformPeaks.hpp"
+#include "FFAudioHelper.hpp"
+#include "FFMediaCache.hpp"
+#include "FFSimd.hpp"
+
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace FFAudioHelper;
+
+namespace
+{
+    const char* PEAKS_FILE_TYPE = ".peaks";
+    const char* TEMP_SUFFIX     = ".part";
+    const char PEAKS_MAGIC[4]   = { 'F', 'F', 'P', 'K' };
+    const int32_t PEAKS_VERSION = 1;
+
+    /*
+     The sidecar is native endian, after the header every level has its samples per bucket and bucket count,
+     then the peaks of every level follow in the same order.
+     */
+    struct FFPeaksHeader
+    {
+        char    magic[4];
+        int32_t version;
+        uint64_t sourceHash;        // of the input file name, clips of one file have different peaks
+        int64_t sourceSize;
+        int64_t sourceTime;
+        int32_t sampleRate;
+        int32_t channels;
+        int64_t frames;
+        int32_t levelCount;
+        int32_t reserved;
+    };
+
+    bool getSourceIdentity(const std::string& sourceFile, FFPeaksHeader& header)
+    {
+        std::string path;
+        double startTime = 0, endTime = 0;
+        parseClip(sourceFile, path, startTime, endTime);
+
+        struct stat info = {0};
+        if (stat(path.c_str(), &info))
+            return false;
+
+        header.sourceHash = FFMediaCache::hashString(sourceFile);
+        header.sourceSize = info.st_size;
+        header.sourceTime = info.st_mtime;
+        return true;
+    }
+
+    int16_t toPeak(float x)
+    {
+        return (int16_t)std::max(std::min(lrintf(x * 32767.f), 32767L), -32768L);
+    }
+
+    // updates min and max with the s16 samples
+    void minMaxS16(const int16_t* samples, int count, int& min, int& max)
+    {
+        int i = 0;
+#if defined(FF_SIMD_NEON)
+        if (count >= 8)
+        {
+            int16x8_t minLanes = vdupq_n_s16(SHRT_MAX);
+            int16x8_t maxLanes = vdupq_n_s16(SHRT_MIN);
+            for (; i + 8 <= count; i += 8)
+            {
+                int16x8_t x = vld1q_s16(samples + i);
+                minLanes = vminq_s16(minLanes, x);
+                maxLanes = vmaxq_s16(maxLanes, x);
+            }
+            int16x4_t min4 = vmin_s16(vget_low_s16(minLanes), vget_high_s16(minLanes));
+            int16x4_t max4 = vmax_s16(vget_low_s16(maxLanes), vget_high_s16(maxLanes));
+            min4 = vpmin_s16(min4, min4);
+            min4 = vpmin_s16(min4, min4);
+            max4 = vpmax_s16(max4, max4);
+            max4 = vpmax_s16(max4, max4);
+            min = std::min<int>(min, vget_lane_s16(min4, 0));
+            max = std::max<int>(max, vget_lane_s16(max4, 0));
+        }
+#elif defined(FF_SIMD_SSE2)
+        if (count >= 8)
+        {
+            __m128i minLanes = _mm_set1_epi16(SHRT_MAX);
+            __m128i maxLanes = _mm_set1_epi16(SHRT_MIN);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(samples + i));
+                minLanes = _mm_min_epi16(minLanes, x);
+                maxLanes = _mm_max_epi16(maxLanes, x);
+            }
+            int16_t mins[8], maxs[8];
+            _mm_storeu_si128((__m128i*)mins, minLanes);
+            _mm_storeu_si128((__m128i*)maxs, maxLanes);
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                min = std::min<int>(min, mins[lane]);
+                max = std::max<int>(max, maxs[lane]);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            min = std::min<int>(min, samples[i]);
+            max = std::max<int>(max, samples[i]);
+        }
+    }
+
+    // updates min and max with the float samples
+    void minMaxFloat(const float* samples, int count, float& min, float& max)
+    {
+        int i = 0;
+#if defined(FF_SIMD_NEON)
+        if (count >= 4)
+        {
+            float32x4_t minLanes = vdupq_n_f32(min);
+            float32x4_t maxLanes = vdupq_n_f32(max);
+            for (; i + 4 <= count; i += 4)
+            {
+                float32x4_t x = vld1q_f32(samples + i);
+                minLanes = vminq_f32(minLanes, x);
+                maxLanes = vmaxq_f32(maxLanes, x);
+            }
+            float32x2_t min2 = vmin_f32(vget_low_f32(minLanes), vget_high_f32(minLanes));
+            float32x2_t max2 = vmax_f32(vget_low_f32(maxLanes), vget_high_f32(maxLanes));
+            min = vget_lane_f32(vpmin_f32(min2, min2), 0);
+            max = vget_lane_f32(vpmax_f32(max2, max2), 0);
+        }
+#elif defined(FF_SIMD_SSE2)
+        if (count >= 4)
+        {
+            __m128 minLanes = _mm_set1_ps(min);
+            __m128 maxLanes = _mm_set1_ps(max);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(samples + i);
+                minLanes = _mm_min_ps(minLanes, x);
+                maxLanes = _mm_max_ps(maxLanes, x);
+            }
+            minLanes = _mm_min_ps(minLanes, _mm_movehl_ps(minLanes, minLanes));
+            maxLanes = _mm_max_ps(maxLanes, _mm_movehl_ps(maxLanes, maxLanes));
+            minLanes = _mm_min_ss(minLanes, _mm_shuffle_ps(minLanes, minLanes, 1));
+            maxLanes = _mm_max_ss(maxLanes, _mm_shuffle_ps(maxLanes, maxLanes, 1));
+            min = _mm_cvtss_f32(minLanes);
+            max = _mm_cvtss_f32(maxLanes);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            min = std::min(min, samples[i]);
+            max = std::max(max, samples[i]);
+        }
+    }
+
+    // updates min and max, in s16 units, with count samples of the packed format
+    void minMax(const uint8_t* data, int count, AVSampleFormat format, int& min, int& max)
+    {
+        switch (format)
+        {
+            case AV_SAMPLE_FMT_S16:
+                minMaxS16((const int16_t*)data, count, min, max);
+                break;
+            case AV_SAMPLE_FMT_FLT:
+            {
+                float fmin = HUGE_VALF, fmax = -HUGE_VALF;
+                minMaxFloat((const float*)data, count, fmin, fmax);
+                if (count > 0)
+                {
+                    min = std::min<int>(min, toPeak(fmin));
+                    max = std::max<int>(max, toPeak(fmax));
+                }
+                break;
+            }
+            case AV_SAMPLE_FMT_U8:
+                for (int i = 0; i < count; ++i)
+                {
+                    min = std::min(min, (data[i] - 128) * 256);
+                    max = std::max(max, (data[i] - 128) * 256);
+                }
+                break;
+            case AV_SAMPLE_FMT_S32:
+                for (int i = 0; i < count; ++i)
+                {
+                    min = std::min(min, ((const int32_t*)data)[i] >> 16);
+                    max = std::max(max, ((const int32_t*)data)[i] >> 16);
+                }
+                break;
+            case AV_SAMPLE_FMT_DBL:
+                for (int i = 0; i < count; ++i)
+                {
+                    min = std::min<int>(min, toPeak((float)((const double*)data)[i]));
+                    max = std::max<int>(max, toPeak((float)((const double*)data)[i]));
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+FFWaveformPeaks::FFWaveformPeaks()
+: sampleRate(0)
+, channels(0)
+, frames(0)
+{
+
+}
+
+const FFPeakLevel* FFWaveformPeaks::findLevel(int samplesPerBucket) const
+{
+    if (levels.empty())
+        return NULL;
+
+    const FFPeakLevel* found = &levels.front();
+    for (const FFPeakLevel& level : levels)
+    {
+        if (level.samplesPerBucket <= samplesPerBucket)
+            found = &level;
+    }
+    return found;
+}
+
+int FFWaveformPeaks::read(const std::string& peaksFile, const std::string& sourceFile)
+{
+    FFPeaksHeader source = {{0}};
+    if (!getSourceIdentity(sourceFile, source))
+        return AVERROR(ENOENT);
+
+    FILE* stream = fopen(peaksFile.c_str(), "rb");
+    if (!stream)
+        return AVERROR(errno);
+
+    int err = 0;
+    {
+        FFAutoReleasePool pool;
+        pool.autoRelease([stream]
+                         {
+                             fclose(stream);
+                         });
+
+        FFPeaksHeader header = {{0}};
+        ERROR_CHECKEX(1 == fread(&header, sizeof(header), 1, stream), err = AVERROR_INVALIDDATA);
+        ERROR_CHECKEX(std::equal(PEAKS_MAGIC, PEAKS_MAGIC + 4, header.magic) && (PEAKS_VERSION == header.version), err = AVERROR_INVALIDDATA);
+
+        // stale
+        CHECKEX((header.sourceHash == source.sourceHash) && (header.sourceSize == source.sourceSize) && (header.sourceTime == source.sourceTime),
+                      err = AVERROR_INVALIDDATA);
+        ERROR_CHECKEX(header.levelCount > 0 && header.levelCount <= 32, err = AVERROR_INVALIDDATA);
+
+        std::vector<FFPeakLevel> readLevels(header.levelCount);
+        for (FFPeakLevel& level : readLevels)
+        {
+            int32_t sizes[2] = {0};
+            ERROR_CHECKEX(1 == fread(sizes, sizeof(sizes), 1, stream), err = AVERROR_INVALIDDATA);
+            ERROR_CHECKEX(sizes[0] > 0 && sizes[1] >= 0 && sizes[1] <= header.frames / sizes[0] + 1, err = AVERROR_INVALIDDATA);
+            level.samplesPerBucket = sizes[0];
+            level.peaks.resize(2 * (size_t)sizes[1]);
+        }
+        for (FFPeakLevel& level : readLevels)
+        {
+            if (level.peaks.empty())
+                continue;
+            ERROR_CHECKEX(level.peaks.size() == fread(&level.peaks.front(), sizeof(int16_t), level.peaks.size(), stream), err = AVERROR_INVALIDDATA);
+        }
+
+        sampleRate = header.sampleRate;
+        channels   = header.channels;
+        frames     = header.frames;
+        levels.swap(readLevels);
+    }
+
+Exit0:
+    return err;
+}
+
+int FFWaveformPeaks::write(const std::string& peaksFile, const std::string& sourceFile) const
+{
+    FFPeaksHeader header = {{0}};
+    if (!getSourceIdentity(sourceFile, header))
+        return AVERROR(ENOENT);
+
+    std::copy(PEAKS_MAGIC, PEAKS_MAGIC + 4, header.magic);
+    header.version    = PEAKS_VERSION;
+    header.sampleRate = sampleRate;
+    header.channels   = channels;
+    header.frames     = frames;
+    header.levelCount = (int32_t)levels.size();
+
+    // written aside and renamed, a reader never sees a partial file
+    std::string tempFile = peaksFile + TEMP_SUFFIX;
+    FILE* stream = fopen(tempFile.c_str(), "wb");
+    if (!stream)
+        return AVERROR(errno);
+
+    int err = 0;
+    {
+        FFAutoReleasePool pool;
+        pool.autoRelease([&stream, &tempFile]
+                         {
+                             if (stream)
+                             {
+                                 fclose(stream);
+                                 unlink(tempFile.c_str());
+                             }
+                         });
+
+        ERROR_CHECKEX(1 == fwrite(&header, sizeof(header), 1, stream), err = AVERROR(EIO));
+        for (const FFPeakLevel& level : levels)
+        {
+            int32_t sizes[2] = { level.samplesPerBucket, (int32_t)(level.peaks.size() / 2) };
+            ERROR_CHECKEX(1 == fwrite(sizes, sizeof(sizes), 1, stream), err = AVERROR(EIO));
+        }
+        for (const FFPeakLevel& level : levels)
+        {
+            if (level.peaks.empty())
+                continue;
+            ERROR_CHECKEX(level.peaks.size() == fwrite(&level.peaks.front(), sizeof(int16_t), level.peaks.size(), stream), err = AVERROR(EIO));
+        }
+
+        FILE* written = stream;
+        stream = NULL;
+        ERROR_CHECKEX(0 == fclose(written), err = AVERROR(EIO); unlink(tempFile.c_str()));
+        ERROR_CHECKEX(0 == rename(tempFile.c_str(), peaksFile.c_str()), err = AVERROR(errno); unlink(tempFile.c_str()));
+    }
+
+Exit0:
+    return err;
+}
+
+int FFWaveformPeaks::extract(const std::string& inputFile, const std::string& peaksFile, FFWaveformPeaks& peaks)
+{
+    std::string path = peaksFile.length() ? peaksFile : inputFile + PEAKS_FILE_TYPE;
+    if (0 == peaks.read(path, inputFile))
+        return 0;
+
+    int err = 0;
+    {
+        FFAutoReleasePool pool;
+
+        AVProcessContext context;
+        pool.autoRelease([&context]
+                         {
+                             if (context.codec)
+                                 avcodec_free_context(&context.codec);
+                             if (context.format)
+                                 avformat_close_input(&context.format);
+                         });
+
+        err = openInputFile(inputFile, context, AV_SAMPLE_FMT_FLTP);
+        AV_ERROR_CHECK(err);
+
+        AVFrame* frame = av_frame_alloc();
+        pool.autoRelease([&frame]
+                         {
+                             av_frame_free(&frame);
+                         });
+        ERROR_CHECKEX(frame, err = AVERROR(ENOMEM));
+
+        // one pass fills every level
+        FFPeakBuilder builder(context.codec->sample_rate, context.codec->channels);
+        bool finished = false;
+        while (true)
+        {
+            err = decodeRangeFrame(context, frame, finished);
+            AV_ERROR_CHECK(err);
+            if (finished)
+                break;
+
+            if (av_frame_get_channels(frame) == context.codec->channels)
+                builder.process(frame->extended_data, frame->nb_samples, (AVSampleFormat)frame->format);
+        }
+        builder.finish(peaks);
+
+        // the peaks are returned even if the sidecar can't be written
+        int writeErr = peaks.write(path, inputFile);
+        if (writeErr < 0)
+            std::cerr << "write peaks err = " << writeErr << " " << getErrorText(writeErr) << " " << path << std::endl;
+    }
+
+Exit0:
+    return err;
+}
+
+FFPeakBuilder::FFPeakBuilder(int sampleRate, int channels, int samplesPerBucket, int levelCount, int levelFactor)
+: _sampleRate(sampleRate)
+, _channels(std::max(channels, 1))
+, _levelFactor(std::max(levelFactor, 2))
+, _bucketPosition(0)
+, _frames(0)
+, _bucketMin(INT_MAX)
+, _bucketMax(INT_MIN)
+, _levels(std::max(levelCount, 1))
+, _pendingMin(_levels.size(), INT_MAX)
+, _pendingMax(_levels.size(), INT_MIN)
+, _pendingCount(_levels.size(), 0)
+{
+    int bucket = std::max(samplesPerBucket, 1);
+    for (FFPeakLevel& level : _levels)
+    {
+        level.samplesPerBucket = bucket;
+        bucket *= _levelFactor;
+    }
+}
+
+void FFPeakBuilder::process(const uint8_t* const* planes, int frames, AVSampleFormat format)
+{
+    bool planar = av_sample_fmt_is_planar(format);
+    AVSampleFormat packedFormat = av_get_packed_sample_fmt(format);
+    int sampleBytes = av_get_bytes_per_sample(format);
+    int planeCount = planar ? _channels : 1;
+    int samplesPerFrame = planar ? 1 : _channels;
+
+    int offset = 0;
+    while (frames > 0)
+    {
+        int count = std::min(frames, _levels[0].samplesPerBucket - _bucketPosition);
+
+        for (int p = 0; p < planeCount; ++p)
+        {
+            minMax(planes[p] + (size_t)offset * samplesPerFrame * sampleBytes, count * samplesPerFrame, packedFormat,
+                   _bucketMin, _bucketMax);
+        }
+
+        offset += count;
+        frames -= count;
+        _frames += count;
+        _bucketPosition += count;
+        if (_bucketPosition == _levels[0].samplesPerBucket)
+        {
+            _addBucket(0, _bucketMin, _bucketMax);
+            _bucketPosition = 0;
+            _bucketMin = INT_MAX;
+            _bucketMax = INT_MIN;
+        }
+    }
+}
+
+void FFPeakBuilder::finish(FFWaveformPeaks& peaks)
+{
+    if (_bucketPosition > 0)
+        _addBucket(0, _bucketMin, _bucketMax);
+
+    // the partial buckets of the coarser levels, every one completes the next level's
+    for (size_t level = 1; level < _levels.size(); ++level)
+    {
+        if (_pendingCount[level] > 0)
+            _addBucket((int)level, _pendingMin[level], _pendingMax[level]);
+    }
+
+    peaks.sampleRate = _sampleRate;
+    peaks.channels   = _channels;
+    peaks.frames     = _frames;
+    peaks.levels.swap(_levels);
+
+    _levels.resize(peaks.levels.size());
+    for (size_t level = 0; level < _levels.size(); ++level)
+        _levels[level].samplesPerBucket = peaks.levels[level].samplesPerBucket;
+    _bucketPosition = 0;
+    _frames = 0;
+    _bucketMin = INT_MAX;
+    _bucketMax = INT_MIN;
+    std::fill(_pendingMin.begin(), _pendingMin.end(), INT_MAX);
+    std::fill(_pendingMax.begin(), _pendingMax.end(), INT_MIN);
+    std::fill(_pendingCount.begin(), _pendingCount.end(), 0);
+}
+
+void FFPeakBuilder::_addBucket(int level, int min, int max)
+{
+    // a bucket of unsupported samples is silence
+    if (min > max)
+        min = max = 0;
+
+    FFPeakLevel& current = _levels[level];
+    current.peaks.push_back((int16_t)min);
+    current.peaks.push_back((int16_t)max);
+
+    int next = level + 1;
+    if (next >= (int)_levels.size())
+        return;
+
+    _pendingMin[next] = std::min(_pendingMin[next], min);
+    _pendingMax[next] = std::max(_pendingMax[next], max);
+    if (++_pendingCount[next] == _levelFactor)
+    {
+        int pendingMin = _pendingMin[next];
+        int pendingMax = _pendingMax[next];
+        _pendingMin[next] = INT_MAX;
+        _pendingMax[next] = INT_MIN;
+        _pendingCount[next] = 0;
+        _addBucket(next, pendingMin, pendingMax);
+    }
+}
@@ -0,0 +1,95 @@
+//
+//  FFWaveformPeaks.hpp
+//  FFAudioMixing
+//
+//  Min/max peaks of audio files at several zoom levels for drawing waveforms, kept in a sidecar file.
+//
+
+#ifndef FFWaveformPeaks_hpp
+#define FFWaveformPeaks_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+struct FFPeakLevel
+{
+    int samplesPerBucket;           // sample frames of the source rate per bucket
+    std::vector<int16_t> peaks;     // min and max of every bucket over all the channels, full scale is 32767
+};
+
+/*
+ The levels are ordered from the finest, every level has levelFactor times larger buckets than the previous one.
+ The last bucket of a level may be partial.
+ */
+struct FFWaveformPeaks
+{
+    int sampleRate;
+    int channels;
+    int64_t frames;
+    std::vector<FFPeakLevel> levels;
+
+    FFWaveformPeaks();
+
+    // the coarsest level whose buckets are not larger than samplesPerBucket, the finest level if all are, NULL if empty
+    const FFPeakLevel* findLevel(int samplesPerBucket) const;
+
+    /*
+     The sidecar file records the size and the modification time of the source file, read fails with
+     AVERROR_INVALIDDATA when the source has changed since the peaks were written.
+     */
+    int read(const std::string& peaksFile, const std::string& sourceFile);
+    int write(const std::string& peaksFile, const std::string& sourceFile) const;
+
+    /*
+     Reads the sidecar of the input file, or decodes the file once and writes the sidecar when it's missing or stale.
+     The input file may select a clip, see FFAudioHelper::parseClip. peaksFile defaults to the input file + ".peaks".
+     */
+    static int extract(const std::string& inputFile, const std::string& peaksFile, FFWaveformPeaks& peaks);
+};
+
+/*
+ Builds the peaks of all the levels from one pass over the samples.
+ The min/max reductions of s16 and flt are computed with NEON or SSE2 when the target has it.
+ */
+class FFPeakBuilder
+{
+public:
+    static const int DEFAULT_SAMPLES_PER_BUCKET = 256;
+    static const int DEFAULT_LEVEL_COUNT = 4;
+    static const int DEFAULT_LEVEL_FACTOR = 4;
+
+private:
+    int _sampleRate;
+    int _channels;
+    int _levelFactor;
+    int _bucketPosition;            // frames of the current bucket of the finest level
+    int64_t _frames;
+    int _bucketMin;
+    int _bucketMax;
+    std::vector<FFPeakLevel> _levels;
+    // min, max and bucket count of the level's current bucket, made of the finished buckets of the previous level
+    std::vector<int> _pendingMin;
+    std::vector<int> _pendingMax;
+    std::vector<int> _pendingCount;
+
+public:
+    FFPeakBuilder(int sampleRate, int channels,
+                  int samplesPerBucket = DEFAULT_SAMPLES_PER_BUCKET,
+                  int levelCount = DEFAULT_LEVEL_COUNT,
+                  int levelFactor = DEFAULT_LEVEL_FACTOR);
+
+    // whole frames in any sample format, planes has one pointer per channel for planar formats
+    void process(const uint8_t* const* planes, int frames, AVSampleFormat format);
+    // ends the partial buckets and moves the peaks out, the builder is empty then
+    void finish(FFWaveformPeaks& peaks);
+
+private:
+    void _addBucket(int level, int min, int max);
+};
+
+#endif /* FFWaveformPeaks_hpp */
@@ -4,13 +4,73 @@
 #include <string.h>
 #include <jni.h>
 #include <sstream>
+#include <algorithm>
 #include "FFAudioBufferEncoder.hpp"
+#include "JNI_Helper.hpp"
 #include <android/log.h>
 
 #define DEBUG 1
 
 #define LOG(...) __android_log_print(ANDROID_LOG_ERROR,"FFAudioBufferEncoder",__VA_ARGS__)
 
+namespace
+{
+    // levels of the recording, polled by FFBufferEncoder.getLevels from any thread
+    FFLevelSnapshot levelSnapshot;
+    // sidecar of the next recording, see FFBufferEncoder.setPeaksFile
+    std::string nextPeaksFile;
+
+    void setEncoderOutputs(FFAudioBufferEncoder *encoder) {
+        encoder->setLevelSnapshot(&levelSnapshot);
+        if (!nextPeaksFile.empty()) {
+            encoder->setPeaksOutput(nextPeaksFile);
+            nextPeaksFile.clear();
+        }
+    }
+
+    // android.media.AudioFormat encoding
+    AVSampleFormat getSampleFormat(jint audioFormat) {
+        if (audioFormat == 3)           // ENCODING_PCM_8BIT
+            return AV_SAMPLE_FMT_U8;
+        if (audioFormat == 4)           // ENCODING_PCM_FLOAT
+            return AV_SAMPLE_FMT_FLT;
+        return AV_SAMPLE_FMT_S16;
+    }
+
+    // NULL with an unknown preset, the encoder options override the options of the preset
+    FFAudioBufferEncoder *createEncoder(JNIEnv *env, jstring outFilePath_, jstring outFileTyp_, jint outBitRate,
+                                        jint sampleRate, jint channels, jstring encoderPreset_, jobject encoderOptions_) {
+        const char *outFilePath = env->GetStringUTFChars(outFilePath_, 0);
+        const char *outFileTyp = env->GetStringUTFChars(outFileTyp_, 0);
+
+        std::string codecOptions;
+        bool presetFound = true;
+        if (encoderPreset_) {
+            const char *encoderPreset = env->GetStringUTFChars(encoderPreset_, 0);
+            presetFound = FFAudioHelper::getEncoderPresetOptions(encoderPreset, outFileTyp, codecOptions);
+            if (!presetFound) {
+                LOG("unknown encoder preset %s", encoderPreset);
+            }
+            env->ReleaseStringUTFChars(encoderPreset_, encoderPreset);
+        }
+
+        std::map<std::string, std::string> encoderOptions;
+        getStringMap(env, encoderOptions_, encoderOptions);
+        FFAudioHelper::addEncoderOptions(encoderOptions, codecOptions);
+
+        FFAudioBufferEncoder *encoder = NULL;
+        if (presetFound) {
+            encoder = new FFAudioBufferEncoder(outFilePath, outFileTyp, outBitRate,
+                                               FFOutputProfile(sampleRate, channels), codecOptions);
+            setEncoderOutputs(encoder);
+        }
+
+        env->ReleaseStringUTFChars(outFilePath_, outFilePath);
+        env->ReleaseStringUTFChars(outFileTyp_, outFileTyp);
+        return encoder;
+    }
+}
+
 extern "C" {
 
 FFAudioBufferEncoder *glf_encoder = NULL;
@@ -24,6 +84,7 @@ Java_com_chenwb_audiolibrary_FFBufferEncoder_startEncode(JNIEnv *env, jobject in
     const char *outFileTyp = env->GetStringUTFChars(outFileTyp_, 0);
 
     glf_encoder = new FFAudioBufferEncoder(outFilePath, outFileTyp, outBitRate);
+    setEncoderOutputs(glf_encoder);
     int error = glf_encoder->beginInput();
 
     if (error != 0) {
@@ -36,9 +97,75 @@ Java_com_chenwb_audiolibrary_FFBufferEncoder_startEncode(JNIEnv *env, jobject in
     return error;
 }
 
+// audioFormat is an android.media.AudioFormat encoding, the output is encoded at the capture rate and channels
+JNIEXPORT jint JNICALL
+Java_com_chenwb_audiolibrary_FFBufferEncoder_startEncodeWithFormat(JNIEnv *env, jobject instance,
+                                                                        jstring outFilePath_,
+                                                                        jstring outFileTyp_,
+                                                                        jint outBitRate,
+                                                                        jint sampleRate,
+                                                                        jint channels,
+                                                                        jint audioFormat,
+                                                                        jstring encoderPreset_,
+                                                                        jobject encoderOptions_) {
+    glf_encoder = createEncoder(env, outFilePath_, outFileTyp_, outBitRate, sampleRate, channels, encoderPreset_, encoderOptions_);
+    if (!glf_encoder) {
+        return AVERROR(EINVAL);
+    }
+    int error = glf_encoder->beginInput(sampleRate, getSampleFormat(audioFormat), channels);
+
+    if (error != 0) {
+        LOG("beginInput err %s", &FFAudioHelper::getErrorText(error).front());
+    }
+
+    return error;
+}
+
+// mixes the background into the output while recording, the voice alone goes to voiceFilePath when it's not null
+JNIEXPORT jint JNICALL
+Java_com_chenwb_audiolibrary_FFBufferEncoder_startEncodeWithBackground(JNIEnv *env, jobject instance,
+                                                                            jstring outFilePath_,
+                                                                            jstring outFileTyp_,
+                                                                            jint outBitRate,
+                                                                            jint sampleRate,
+                                                                            jint channels,
+                                                                            jint audioFormat,
+                                                                            jstring encoderPreset_,
+                                                                            jstring bkgMusicFile_,
+                                                                            jdouble bkgVolume,
+                                                                            jboolean loopBkgMusic,
+                                                                            jstring voiceFilePath_) {
+    glf_encoder = createEncoder(env, outFilePath_, outFileTyp_, outBitRate, sampleRate, channels, encoderPreset_, NULL);
+    if (!glf_encoder) {
+        return AVERROR(EINVAL);
+    }
+
+    const char *bkgMusicFile = env->GetStringUTFChars(bkgMusicFile_, 0);
+    glf_encoder->setBackground(bkgMusicFile, bkgVolume, loopBkgMusic);
+    env->ReleaseStringUTFChars(bkgMusicFile_, bkgMusicFile);
+
+    if (voiceFilePath_) {
+        const char *voiceFilePath = env->GetStringUTFChars(voiceFilePath_, 0);
+        glf_encoder->setVoiceOutput(voiceFilePath);
+        env->ReleaseStringUTFChars(voiceFilePath_, voiceFilePath);
+    }
+
+    int error = glf_encoder->beginInput(sampleRate, getSampleFormat(audioFormat), channels);
+
+    if (error != 0) {
+        LOG("beginInput err %s", &FFAudioHelper::getErrorText(error).front());
+    }
+
+    return error;
+}
+
 JNIEXPORT jint JNICALL
 Java_com_chenwb_audiolibrary_FFBufferEncoder_appendData(JNIEnv *env, jobject instance,
                                                              jbyteArray data_, jint len) {
+    if (!glf_encoder) {
+        return AVERROR(EINVAL);
+    }
+
     jbyte *data = env->GetByteArrayElements(data_, NULL);
 
     int error = glf_encoder->appendData((const uint8_t *) data, len);
@@ -65,4 +192,23 @@ Java_com_chenwb_audiolibrary_FFBufferEncoder_endInput(JNIEnv *env, jobject insta
 
     return error;
 }
-}
\ No newline at end of file
+// the next recording writes its waveform peaks into the sidecar file, null for none
+JNIEXPORT void JNICALL
+Java_com_chenwb_audiolibrary_FFBufferEncoder_setPeaksFile(JNIEnv *env, jobject instance, jstring peaksFile_) {
+    nextPeaksFile.clear();
+    if (peaksFile_) {
+        const char *peaksFile = env->GetStringUTFChars(peaksFile_, 0);
+        nextPeaksFile = peaksFile;
+        env->ReleaseStringUTFChars(peaksFile_, peaksFile);
+    }
+}
+
+// peak, rms, short-term lufs and seconds of the recording into levels, nothing is allocated
+JNIEXPORT void JNICALL
+Java_com_chenwb_audiolibrary_FFBufferEncoder_getLevels(JNIEnv *env, jobject instance, jfloatArray levels_) {
+    FFLevels levels = levelSnapshot.read();
+    jfloat values[4] = {levels.peak, levels.rms, levels.shortTermLufs, levels.seconds};
+    jsize count = std::min<jsize>(env->GetArrayLength(levels_), 4);
+    env->SetFloatArrayRegion(levels_, 0, count, values);
+}
+}
@@ -1,7 +1,69 @@
 
 #include <jni.h>
 #include <sstream>
+#include <algorithm>
 #include "FFAudioMixing.hpp"
+#include "FFWaveformPeaks.hpp"
+#include "JNI_Helper.hpp"
+
+namespace
+{
+    // options of the java object, see FFAudioMixing.setEncoderPreset
+    FFAudioMixingOptions getOptions(JNIEnv *env, jobject instance) {
+        FFAudioMixingOptions options;
+
+        jfieldID presetField = env->GetFieldID(env->GetObjectClass(instance), "encoderPreset", "Ljava/lang/String;");
+        jstring jPreset = presetField ? (jstring) env->GetObjectField(instance, presetField) : NULL;
+        if (jPreset) {
+            const char *preset = env->GetStringUTFChars(jPreset, JNI_FALSE);
+            options.encoderPreset = preset;
+            env->ReleaseStringUTFChars(jPreset, preset);
+        }
+
+        jfieldID encoderOptionsField = env->GetFieldID(env->GetObjectClass(instance), "encoderOptions", "Ljava/util/Map;");
+        if (encoderOptionsField) {
+            jobject jEncoderOptions = env->GetObjectField(instance, encoderOptionsField);
+            getStringMap(env, jEncoderOptions, options.encoderOptions);
+            env->DeleteLocalRef(jEncoderOptions);
+        }
+
+        jfieldID checkpointField = env->GetFieldID(env->GetObjectClass(instance), "checkpointDir", "Ljava/lang/String;");
+        jstring jCheckpointDir = checkpointField ? (jstring) env->GetObjectField(instance, checkpointField) : NULL;
+        if (jCheckpointDir) {
+            const char *checkpointDir = env->GetStringUTFChars(jCheckpointDir, JNI_FALSE);
+            options.checkpointDir = checkpointDir;
+            env->ReleaseStringUTFChars(jCheckpointDir, checkpointDir);
+        }
+
+        jfieldID keepField = env->GetFieldID(env->GetObjectClass(instance), "keepCheckpoints", "Z");
+        if (keepField) {
+            options.keepCheckpoints = env->GetBooleanField(instance, keepField);
+        }
+
+        jfieldID trimField = env->GetFieldID(env->GetObjectClass(instance), "trimSilence", "Z");
+        if (trimField) {
+            options.trimSilence = env->GetBooleanField(instance, trimField);
+        }
+
+        jfieldID swellField = env->GetFieldID(env->GetObjectClass(instance), "bkgSwellGain", "D");
+        if (swellField) {
+            options.backgroundSwellGain = env->GetDoubleField(instance, swellField);
+        }
+
+        jfieldID fixedField = env->GetFieldID(env->GetObjectClass(instance), "fixedPointMixing", "Z");
+        if (fixedField && env->GetBooleanField(instance, fixedField)) {
+            options.outputProfile.sampleFormat = AV_SAMPLE_FMT_S16P;
+        }
+
+        jfieldID queuedField = env->GetFieldID(env->GetObjectClass(instance), "maxQueuedMs", "I");
+        jfieldID framesField = env->GetFieldID(env->GetObjectClass(instance), "maxFramesPerInput", "I");
+        if (queuedField && framesField) {
+            options.maxQueuedMs = env->GetIntField(instance, queuedField);
+            options.maxFramesPerInput = env->GetIntField(instance, framesField);
+        }
+        return options;
+    }
+}
 
 extern "C"
 {
@@ -57,14 +119,16 @@ Java_com_chenwb_audiolibrary_FFAudioMixing_startAudioMixing(JNIEnv *env, jobject
 
     IFFAudioMixing* audioMixing = FFAudioMixingFactory::createInstance();
 
+    int err = 0;
     if (isM4A) {
-        audioMixing->init(".mp4", 128000);
+        err = audioMixing->init(".mp4", 128000, getOptions(env, instance));
     } else {
-        audioMixing->init();
+        err = audioMixing->init(OUTPUT_FILE_TYPE, OUTPUT_BIT_RATE, getOptions(env, instance));
     }
 
     env->CallVoidMethod(instance, printMessage, env->NewStringUTF("combineAudios starting ++++++"));
-    int err = audioMixing->combineAudios(beginEffectFile,
+    if (err >= 0)
+        err = audioMixing->combineAudios(beginEffectFile,
                                         endEffectFile,
                                         jHaveIntroPage,
                                         jHaveEndingPage,
@@ -78,8 +142,71 @@ Java_com_chenwb_audiolibrary_FFAudioMixing_startAudioMixing(JNIEnv *env, jobject
 
     env->CallVoidMethod(instance, printMessage, env->NewStringUTF("combineAudios end ------- "));
 
-    char str[15];
-    sprintf(str, "result = %d\n", err);
+    char str[32];
+    snprintf(str, sizeof(str), "result = %d\n", err);
+    return env->NewStringUTF(str);
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_chenwb_audiolibrary_FFAudioMixing_previewAudioMixing(JNIEnv *env, jobject instance,
+                                                                   jstring jBeginEffect,
+                                                                   jstring jEndEffect_,
+                                                                   jboolean jHaveIntroPage,
+                                                                   jboolean jHaveEndingPage,
+                                                                   jobjectArray jVoicePages,
+                                                                   jdouble jTimeSpanSec,
+                                                                   jstring jBkgMusicFile,
+                                                                   jdouble jBkgVolume,
+                                                                   jdouble jPreviewStartSec,
+                                                                   jdouble jPreviewDurationSec,
+                                                                   jstring jOutputFile) {
+
+    jint size = env->GetArrayLength(jVoicePages);
+    if (size <= 0) {
+        return env->NewStringUTF("File size Empty!");
+    }
+
+    const char *beginEffect = env->GetStringUTFChars(jBeginEffect, JNI_FALSE);
+    const char *endEffect = env->GetStringUTFChars(jEndEffect_, JNI_FALSE);
+    const char *bkgMusicFile = env->GetStringUTFChars(jBkgMusicFile, JNI_FALSE);
+    const char *outputFile = env->GetStringUTFChars(jOutputFile, JNI_FALSE);
+
+    std::vector<std::string> inputFiles;
+    for (jint i = 0; i < size; i++) {
+        jstring strObj = (jstring) env->GetObjectArrayElement(jVoicePages, i);
+        const char *chr = env->GetStringUTFChars(strObj, JNI_FALSE);
+        inputFiles.push_back(chr);
+        env->ReleaseStringUTFChars(strObj, chr);
+    }
+    std::string beginEffectFile(beginEffect);
+    std::string endEffectFile(endEffect);
+    std::string backgroundFile(bkgMusicFile);
+    std::string outputFileStr(outputFile);
+
+    env->ReleaseStringUTFChars(jBeginEffect, beginEffect);
+    env->ReleaseStringUTFChars(jEndEffect_, endEffect);
+    env->ReleaseStringUTFChars(jBkgMusicFile, bkgMusicFile);
+    env->ReleaseStringUTFChars(jOutputFile, outputFile);
+
+    IFFAudioMixing* audioMixing = FFAudioMixingFactory::createInstance();
+    int err = audioMixing->init(OUTPUT_FILE_TYPE, OUTPUT_BIT_RATE, getOptions(env, instance));
+    if (err >= 0)
+        err = audioMixing->previewCombineAudios(beginEffectFile,
+                                               endEffectFile,
+                                               jHaveIntroPage,
+                                               jHaveEndingPage,
+                                               inputFiles,
+                                               jTimeSpanSec,
+                                               backgroundFile,
+                                               jBkgVolume,
+                                               jPreviewStartSec,
+                                               jPreviewDurationSec,
+                                               outputFileStr);
+
+    audioMixing->destroy();
+
+    char str[32];
+    snprintf(str, sizeof(str), "result = %d\n", err);
     return env->NewStringUTF(str);
 }
 
@@ -94,16 +221,16 @@ Java_com_chenwb_audiolibrary_FFAudioMixing_loudnormAudio(JNIEnv *env, jobject in
     std::string outputFileStr(outputFile);
 
     IFFAudioMixing* audioMixing = FFAudioMixingFactory::createInstance();
-    audioMixing->init(".mp4", 128000);
-
-    int err = audioMixing->loudnormAudio(inputFileStr, outputFileStr);
+    int err = audioMixing->init(".mp4", 128000, getOptions(env, instance));
+    if (err >= 0)
+        err = audioMixing->loudnormAudio(inputFileStr, outputFileStr);
     audioMixing->destroy();
 
     env->ReleaseStringUTFChars(inputFile_, inputFile);
     env->ReleaseStringUTFChars(outputFile_, outputFile);
 
-    char str[15];
-    sprintf(str, "result = %d\n", err);
+    char str[32];
+    snprintf(str, sizeof(str), "result = %d\n", err);
     return env->NewStringUTF(str);
 }
 
@@ -125,20 +252,59 @@ Java_com_chenwb_audiolibrary_FFAudioMixing_concatAudios(JNIEnv *env, jobject ins
 
     IFFAudioMixing* audioMixing = FFAudioMixingFactory::createInstance();
 
+    int err = 0;
     if (isM4a) {
-        audioMixing->init(".mp4", 128000);
+        err = audioMixing->init(".mp4", 128000, getOptions(env, instance));
     } else {
-        audioMixing->init();
+        err = audioMixing->init(OUTPUT_FILE_TYPE, OUTPUT_BIT_RATE, getOptions(env, instance));
     }
 
-    int err = audioMixing->concatAudios(inputFiles, timeSpanSec, outputFile);
+    if (err >= 0)
+        err = audioMixing->concatAudios(inputFiles, timeSpanSec, outputFile);
 
     audioMixing->destroy();
 
     env->ReleaseStringUTFChars(outputFile_, outputFile);
 
-    char str[15];
-    sprintf(str, "result = %d\n", err);
+    char str[32];
+    snprintf(str, sizeof(str), "result = %d\n", err);
     return env->NewStringUTF(str);
 }
+
+// min/max pairs of the level nearest to samplesPerBucket, levelInfo receives the sample rate and the bucket size
+JNIEXPORT jshortArray JNICALL
+Java_com_chenwb_audiolibrary_FFAudioMixing_getWaveformPeaks(JNIEnv *env, jobject instance,
+                                                             jstring inputFile_,
+                                                             jstring peaksFile_,
+                                                             jint samplesPerBucket,
+                                                             jintArray levelInfo_) {
+    const char *inputFile = env->GetStringUTFChars(inputFile_, 0);
+    std::string inputFileStr(inputFile);
+    env->ReleaseStringUTFChars(inputFile_, inputFile);
+
+    std::string peaksFileStr;
+    if (peaksFile_) {
+        const char *peaksFile = env->GetStringUTFChars(peaksFile_, 0);
+        peaksFileStr = peaksFile;
+        env->ReleaseStringUTFChars(peaksFile_, peaksFile);
+    }
+
+    FFWaveformPeaks peaks;
+    int err = FFWaveformPeaks::extract(inputFileStr, peaksFileStr, peaks);
+    const FFPeakLevel *level = peaks.findLevel(samplesPerBucket);
+    if (err < 0 || !level) {
+        return NULL;
+    }
+
+    if (levelInfo_) {
+        jint info[2] = {peaks.sampleRate, level->samplesPerBucket};
+        env->SetIntArrayRegion(levelInfo_, 0, std::min<jsize>(env->GetArrayLength(levelInfo_), 2), info);
+    }
+
+    jshortArray result = env->NewShortArray((jsize) level->peaks.size());
+    if (result && !level->peaks.empty()) {
+        env->SetShortArrayRegion(result, 0, (jsize) level->peaks.size(), &level->peaks.front());
+    }
+    return result;
+}
 }
\ No newline at end of file
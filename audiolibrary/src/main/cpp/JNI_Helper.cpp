@@ -0,0 +1,56 @@
+//
+//  JNI_Helper.cpp
+//  FFAudioMixing
+//
+
+#include "JNI_Helper.hpp"
+
+namespace
+{
+    std::string getString(JNIEnv *env, jstring str_) {
+        const char *str = env->GetStringUTFChars(str_, JNI_FALSE);
+        std::string value = str;
+        env->ReleaseStringUTFChars(str_, str);
+        return value;
+    }
+}
+
+void getStringMap(JNIEnv *env, jobject map, std::map<std::string, std::string> &values) {
+    if (!map) {
+        return;
+    }
+
+    jclass mapClass = env->FindClass("java/util/Map");
+    jclass setClass = env->FindClass("java/util/Set");
+    jclass iteratorClass = env->FindClass("java/util/Iterator");
+    jclass entryClass = env->FindClass("java/util/Map$Entry");
+    jmethodID entrySet = env->GetMethodID(mapClass, "entrySet", "()Ljava/util/Set;");
+    jmethodID iterator = env->GetMethodID(setClass, "iterator", "()Ljava/util/Iterator;");
+    jmethodID hasNext = env->GetMethodID(iteratorClass, "hasNext", "()Z");
+    jmethodID next = env->GetMethodID(iteratorClass, "next", "()Ljava/lang/Object;");
+    jmethodID getKey = env->GetMethodID(entryClass, "getKey", "()Ljava/lang/Object;");
+    jmethodID getValue = env->GetMethodID(entryClass, "getValue", "()Ljava/lang/Object;");
+
+    jobject entries = env->CallObjectMethod(map, entrySet);
+    jobject it = env->CallObjectMethod(entries, iterator);
+    while (env->CallBooleanMethod(it, hasNext)) {
+        jobject entry = env->CallObjectMethod(it, next);
+        jstring key = (jstring) env->CallObjectMethod(entry, getKey);
+        jstring value = (jstring) env->CallObjectMethod(entry, getValue);
+        if (key && value) {
+            values[getString(env, key)] = getString(env, value);
+        }
+
+        // a large map would fill the local reference table
+        env->DeleteLocalRef(value);
+        env->DeleteLocalRef(key);
+        env->DeleteLocalRef(entry);
+    }
+
+    env->DeleteLocalRef(it);
+    env->DeleteLocalRef(entries);
+    env->DeleteLocalRef(entryClass);
+    env->DeleteLocalRef(iteratorClass);
+    env->DeleteLocalRef(setClass);
+    env->DeleteLocalRef(mapClass);
+}
@@ -0,0 +1,18 @@
+//
+//  JNI_Helper.hpp
+//  FFAudioMixing
+//
+//  Conversions of java objects shared by the native methods.
+//
+
+#ifndef JNI_Helper_hpp
+#define JNI_Helper_hpp
+
+#include <jni.h>
+#include <map>
+#include <string>
+
+// the entries of a java.util.Map<String, String>, null keys and values are skipped, a null map has none
+void getStringMap(JNIEnv *env, jobject map, std::map<std::string, std::string> &values);
+
+#endif /* JNI_Helper_hpp */
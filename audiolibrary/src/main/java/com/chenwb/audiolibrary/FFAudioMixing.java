@@ -1,5 +1,7 @@
 package com.chenwb.audiolibrary;
 
+import java.util.Map;
+
 public class FFAudioMixing {
     static {
         System.loadLibrary("avcodec-57");
@@ -14,6 +16,87 @@ public class FFAudioMixing {
         System.loadLibrary("audiomixing");
     }
 
+    private String encoderPreset = "default";
+    private Map<String, String> encoderOptions = null;
+    private boolean trimSilence = false;
+    private double bkgSwellGain = 1;
+    private boolean fixedPointMixing = false;
+    private int maxQueuedMs = 0;
+    private int maxFramesPerInput = 128;
+    private String checkpointDir = null;
+    private boolean keepCheckpoints = false;
+
+    /**
+     * Encoder settings of the outputs: "realtime" encodes fastest, "export" and "archival" spend more time
+     * for quality. The native calls read it.
+     */
+    public void setEncoderPreset(String encoderPreset) {
+        this.encoderPreset = encoderPreset;
+    }
+
+    /**
+     * avcodec options of the output encoder such as "cutoff" or "compression_level", they override the
+     * options of the preset. null for none.
+     */
+    public void setEncoderOptions(Map<String, String> encoderOptions) {
+        this.encoderOptions = encoderOptions;
+    }
+
+    /**
+     * Cuts the leading and trailing silence of every voice page before startAudioMixing, previewAudioMixing
+     * and concatAudios place it, about 0.2 s is kept around the speech. The boundaries are remembered per
+     * file content, a page is analysed once per process.
+     */
+    public void setTrimSilence(boolean trimSilence) {
+        this.trimSilence = trimSilence;
+    }
+
+    /**
+     * The background music plays at bkgVolume under the pages and rises to bkgVolume * bkgSwellGain
+     * between them, ramping over 0.8 s. 1 keeps it at bkgVolume throughout.
+     */
+    public void setBkgSwellGain(double bkgSwellGain) {
+        this.bkgSwellGain = bkgSwellGain;
+    }
+
+    /**
+     * Decodes, scales, mixes and encodes in 16-bit fixed point instead of float, for devices without an FPU
+     * such as armeabi phones. Gains and mixes are within 2 LSB of the float mix, the background swell is within
+     * 1/512 of the sample. Fades step once per decoded frame, about 25 ms, instead of every sample.
+     */
+    public void setFixedPointMixing(boolean fixedPointMixing) {
+        this.fixedPointMixing = fixedPointMixing;
+    }
+
+    /**
+     * Bounds the memory of long renders: an input is fed at most maxFramesPerInput decoded frames at a time,
+     * and no more than one while maxQueuedMs of audio is queued in the mix over all inputs. The decoder of a
+     * finished page is released right away then. 0 ms keeps the queue unbounded.
+     */
+    public void setMemoryBudget(int maxQueuedMs, int maxFramesPerInput) {
+        this.maxQueuedMs = maxQueuedMs;
+        this.maxFramesPerInput = maxFramesPerInput;
+    }
+
+    /**
+     * Makes startAudioMixing resumable: every page is mixed into checkpointDir and kept there as soon as it's
+     * done, and the pages are encoded into the output at the end. When the same export is started again after
+     * a failure, the pages already in the directory are not decoded and mixed again. The pages are removed
+     * when the output is written, and the directory is kept under 1 GB by removing the pages of older jobs.
+     * null turns it off.
+     */
+    public void setCheckpointDir(String checkpointDir) {
+        this.checkpointDir = checkpointDir;
+    }
+
+    /**
+     * Keeps the pages of a finished export in the checkpoint directory, so that exporting again after editing
+     * some pages mixes only those. Off by default.
+     */
+    public void setKeepCheckpoints(boolean keepCheckpoints) {
+        this.keepCheckpoints = keepCheckpoints;
+    }
+
     public String startAudioMixing(RecordAudio recordAudio) {
         return startAudioMixing(recordAudio.beginEffect,
                 recordAudio.endEffect,
@@ -38,10 +121,53 @@ public class FFAudioMixing {
                                           String outputFile,
                                           boolean isM4a);
 
+    /**
+     * Renders previewDurationSec seconds from previewStartSec of the mixing result into a wav file,
+     * only the pages around the window are decoded.
+     */
+    public String previewAudioMixing(RecordAudio recordAudio, double previewStartSec, double previewDurationSec, String outputFile) {
+        return previewAudioMixing(recordAudio.beginEffect,
+                recordAudio.endEffect,
+                recordAudio.haveIntroPage,
+                recordAudio.haveEndingPage,
+                recordAudio.voicePages,
+                recordAudio.timeSpanSec,
+                recordAudio.bkgMusicFile,
+                recordAudio.bkgVolume,
+                previewStartSec,
+                previewDurationSec,
+                outputFile);
+    }
+
+    public native String previewAudioMixing(String beginEffect,
+                                            String endEffect,
+                                            boolean haveIntroPage,
+                                            boolean haveEndingPage,
+                                            String[] voicePages,
+                                            double timeSpanSec,
+                                            String bkgMusicFile,
+                                            double bkgVolume,
+                                            double previewStartSec,
+                                            double previewDurationSec,
+                                            String outputFile);
+
     public native String loudnormAudio(String inputFile, String outputFile);
 
     public native String concatAudios(String[] audioFiles, String outputFile, double timeSpanSec, boolean isM4a);
 
+    /**
+     * Min and max of every bucket of the waveform, full scale 32767, interleaved. The peaks of all
+     * the zoom levels (256, 1024, 4096 and 16384 samples per bucket) are made in one decoding pass
+     * and kept in the sidecar file, which is used until the input file changes.
+     *
+     * @param peaksFile        sidecar file, null for inputFile + ".peaks"
+     * @param samplesPerBucket the largest level not above it is returned, or the finest level
+     * @param levelInfo        receives the sample rate and the samples per bucket of the returned
+     *                         level, may be null
+     * @return null if the input can't be decoded
+     */
+    public native short[] getWaveformPeaks(String inputFile, String peaksFile, int samplesPerBucket, int[] levelInfo);
+
     protected void printMessage(String message) {
     }
 
@@ -1,5 +1,7 @@
 package com.chenwb.audiolibrary;
 
+import java.util.Map;
+
 public class FFBufferEncoder {
     static {
         System.loadLibrary("avcodec-57");
@@ -16,7 +18,66 @@ public class FFBufferEncoder {
 
     public native static int startEncode(String outFilePath, String outFileTyp, int outBitRate);
 
+    /**
+     * Encodes at the capture format instead of 44100 Hz mono, the data is not resampled when the
+     * encoder supports the sample rate.
+     *
+     * @param audioFormat AudioFormat.ENCODING_PCM_16BIT, ENCODING_PCM_8BIT or ENCODING_PCM_FLOAT
+     */
+    public static int startEncodeWithFormat(String outFilePath, String outFileTyp, int outBitRate,
+                                            int sampleRate, int channels, int audioFormat) {
+        return startEncodeWithFormat(outFilePath, outFileTyp, outBitRate, sampleRate, channels, audioFormat, null, null);
+    }
+
+    /**
+     * @param encoderPreset "default", "realtime", "export" or "archival", null for the default
+     */
+    public static int startEncodeWithFormat(String outFilePath, String outFileTyp, int outBitRate,
+                                            int sampleRate, int channels, int audioFormat,
+                                            String encoderPreset) {
+        return startEncodeWithFormat(outFilePath, outFileTyp, outBitRate, sampleRate, channels, audioFormat, encoderPreset, null);
+    }
+
+    /**
+     * @param encoderPreset  "default", "realtime", "export" or "archival", null for the default
+     * @param encoderOptions avcodec options of the encoder such as "cutoff" or "compression_level", they
+     *                       override the options of the preset, null for none
+     */
+    public native static int startEncodeWithFormat(String outFilePath, String outFileTyp, int outBitRate,
+                                                   int sampleRate, int channels, int audioFormat,
+                                                   String encoderPreset, Map<String, String> encoderOptions);
+
+    /**
+     * Mixes the background music into the output while recording, the file is finished when the
+     * recording stops.
+     *
+     * @param loopBkgMusic  restarts the music when it ends, otherwise silence follows it
+     * @param voiceFilePath also encodes the voice alone into this file for later mixing, may be null
+     */
+    public native static int startEncodeWithBackground(String outFilePath, String outFileTyp, int outBitRate,
+                                                       int sampleRate, int channels, int audioFormat,
+                                                       String encoderPreset, String bkgMusicFile,
+                                                       double bkgVolume, boolean loopBkgMusic,
+                                                       String voiceFilePath);
+
+    /**
+     * The next recording writes the waveform peaks into this sidecar file when it ends, of the voice
+     * file if there is one, otherwise of the recording with its background mixed in.
+     * FFAudioMixing.getWaveformPeaks reads them without decoding the recording. Call before
+     * starting, null for none.
+     */
+    public native static void setPeaksFile(String peaksFile);
+
     public native static int appendData(byte[] data, int len);
 
+    /**
+     * Levels of the data appended so far, measured natively after every 100 ms. Can be called from
+     * any thread, nothing is allocated.
+     *
+     * @param levels receives peak and rms (full scale 1), short-term loudness in LUFS and the
+     *               recorded seconds, in this order, as many as it has room for
+     */
+    public native static void getLevels(float[] levels);
+
     public native static int endInput();
 }
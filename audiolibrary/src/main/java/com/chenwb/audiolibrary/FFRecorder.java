@@ -11,10 +11,11 @@ import java.io.IOException;
 public class FFRecorder {
     private static final String TAG = FFRecorder.class.getSimpleName();
     private static final int FRAME_COUNT = 1024 * 2;
-    private static final int SAMPLE_RATE_IN_HZ = 44100;
+    private static final int DEFAULT_SAMPLE_RATE_IN_HZ = 44100;
     private static final PCMFormat AUDIO_FORMAT = PCMFormat.PCM_16BIT;
 
     private AudioRecord audioRecord = null;
+    private int sampleRateInHz = DEFAULT_SAMPLE_RATE_IN_HZ;
 
     private int bufferSize;
     private byte[] buffer;
@@ -22,10 +23,19 @@ public class FFRecorder {
     private ScheduleThread mScheduleThread;
 
     private boolean isRecording = false;
-    private int mCurrAmplitude;
+    private final float[] mAmplitudeLevels = new float[2];
     private Runnable mEndedCallBack;
     private String mCurrOutputPath;
 
+    /**
+     * Records and encodes at this rate, pass the native rate of the device
+     * (AudioManager.PROPERTY_OUTPUT_SAMPLE_RATE) so that the platform doesn't resample the capture.
+     */
+    public void setSampleRate(int sampleRateInHz) {
+        if (isRecording) return;
+        this.sampleRateInHz = sampleRateInHz;
+    }
+
     public void startRecording(String outputPath, final Runnable startCallBack) throws IOException {
         if (isRecording) return;
         printLog("Start recording");
@@ -51,26 +61,12 @@ public class FFRecorder {
                 long spendTime = System.currentTimeMillis();
                 long mDuration = 0;
 
-                int count = 0;
-                int maxSamples = SAMPLE_RATE_IN_HZ / 1000 * 2 * 100; //每100毫秒计算一次音量值
-                long volume = 0;
+                // the levels are measured by the encoder, see getLevels
                 while (isRecording) {
                     int bytes = audioRecord.read(buffer, 0, bufferSize);
                     if (bytes > 0) {
                         try {
                             mScheduleThread.writeData(buffer, bytes);
-
-                            //calculate the RMS (Root-Mean-Square).
-                            for (int i = 0; i < bytes - 1; i += 2) {
-                                int sampleValue = (buffer[i + 1] << 8) | buffer[i];
-                                volume += sampleValue * sampleValue;
-                                count += 1;
-                                if (count >= maxSamples) {
-                                    mCurrAmplitude = (int) Math.sqrt(volume / maxSamples);
-                                    count = 0;
-                                    volume = 0;
-                                }
-                            }
                         } catch (Exception e) {
                             e.printStackTrace();
                         }
@@ -125,7 +121,7 @@ public class FFRecorder {
         /* Get number of samples. Calculate the buffer size (round up to the
            factor of given frame size) */
         int channelConfig = AudioFormat.CHANNEL_IN_MONO;
-        int minBufferSize = AudioRecord.getMinBufferSize(SAMPLE_RATE_IN_HZ, channelConfig,
+        int minBufferSize = AudioRecord.getMinBufferSize(sampleRateInHz, channelConfig,
                 AUDIO_FORMAT.getAudioFormat());
         int frameSize = minBufferSize / bytesPerFrame;
         printLog("Frame size: ---------1---" + frameSize);
@@ -136,12 +132,12 @@ public class FFRecorder {
         bufferSize = frameSize * bytesPerFrame * 2;
 
         audioRecord = new AudioRecord(MediaRecorder.AudioSource.MIC,
-                SAMPLE_RATE_IN_HZ, channelConfig, AUDIO_FORMAT.getAudioFormat(),
+                sampleRateInHz, channelConfig, AUDIO_FORMAT.getAudioFormat(),
                 bufferSize);
 
         buffer = new byte[bufferSize];
 
-        mScheduleThread = new ScheduleThread(outputPath, bufferSize);
+        mScheduleThread = new ScheduleThread(outputPath, bufferSize, sampleRateInHz, 1, AUDIO_FORMAT.getAudioFormat());
         mScheduleThread.start();
     }
 
@@ -151,8 +147,21 @@ public class FFRecorder {
         mEndedCallBack = endCallBack;
     }
 
+    /**
+     * RMS of the last 100 ms in 16 bit sample units.
+     */
     public int getCurAmplitude() {
-        return mCurrAmplitude;
+        synchronized (mAmplitudeLevels) {
+            FFBufferEncoder.getLevels(mAmplitudeLevels);
+            return (int) (mAmplitudeLevels[1] * 32768);
+        }
+    }
+
+    /**
+     * Peak, rms, short-term LUFS and recorded seconds, see FFBufferEncoder.getLevels.
+     */
+    public void getLevels(float[] levels) {
+        FFBufferEncoder.getLevels(levels);
     }
 
     public boolean isRecording() {
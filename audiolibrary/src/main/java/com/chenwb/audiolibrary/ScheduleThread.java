@@ -23,8 +23,8 @@ class ScheduleThread extends Thread {
     private ByteArrayOutputStream mOutput2;
     private boolean isWriteToOut1 = true;
 
-    ScheduleThread(String outputPath, int tempSize) throws IOException {
-        int ret = FFBufferEncoder.startEncode(outputPath, ".mp4", 128000);
+    ScheduleThread(String outputPath, int tempSize, int sampleRate, int channels, int audioFormat) throws IOException {
+        int ret = FFBufferEncoder.startEncodeWithFormat(outputPath, ".mp4", 128000, sampleRate, channels, audioFormat);
         if (ret != 0) {
             throw new IOException("startEncode error");
         }